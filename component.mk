@@ -1,4 +1,4 @@
 COMPONENT_ADD_INCLUDEDIRS = src
 COMPONENT_SRCDIRS = src
-COMPONENT_DEPENDS = log tcp_transport esp-tls
+COMPONENT_DEPENDS = log tcp_transport esp-tls mbedtls esp_timer
 
@@ -0,0 +1,55 @@
+/*
+ * SocketIO client C++20 coroutine API.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "sioco.h"
+
+#ifdef SIO_COROUTINES
+#include <stddef.h>
+
+static_assert((SIO_CO_FRAMES >= 1) && (SIO_CO_FRAMES <= 32), "SIO_CO_FRAMES must be 1 .. 32");
+
+#define SIO_CO_ALL  ((SIO_CO_FRAMES == 32) ? 0xFFFFFFFFu : ((1u << SIO_CO_FRAMES) - 1))
+
+alignas(max_align_t) static char sio_co_mem[SIO_CO_FRAMES][SIO_CO_FRAME_SIZE];
+static std::atomic<uint32_t> sio_co_map(0);     /* Bit set - frame in use */
+
+/*!
+ * \brief Take a frame from the pool.
+ */
+void* sio_co_alloc(size_t size)
+{
+    uint32_t u = sio_co_map.load(std::memory_order_relaxed), b;
+
+    if (size > SIO_CO_FRAME_SIZE) return NULL;
+    do {
+        if (u == SIO_CO_ALL) return NULL;
+        /* Lowest free frame */
+        b = ~u & (u + 1);
+    } while (!sio_co_map.compare_exchange_weak(u, u | b, std::memory_order_acquire, std::memory_order_relaxed));
+    return sio_co_mem[__builtin_ctz(b)];
+}
+
+/*!
+ * \brief Return a frame to the pool.
+ */
+void sio_co_free(void* p)
+{
+    uint32_t i = ((char*)p - &sio_co_mem[0][0]) / SIO_CO_FRAME_SIZE;
+    sio_co_map.fetch_and(~(1u << i), std::memory_order_release);
+}
+
+/*!
+ * \brief Frames in use.
+ */
+int sio_co_used()
+{
+    return __builtin_popcount(sio_co_map.load(std::memory_order_relaxed));
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * SocketIO client C++20 coroutine API.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_SIOCO__
+#define __RV_SIOCO__
+
+#include "socketioclient.h"
+
+#ifdef SIO_COROUTINES
+#include <coroutine>
+#include <atomic>
+#include <stdlib.h>
+
+#ifndef SIO_CO_FRAMES
+#define SIO_CO_FRAMES       (8)    ///< Coroutine frames in the pool (1 .. 32)
+#endif
+#ifndef SIO_CO_FRAME_SIZE
+#define SIO_CO_FRAME_SIZE   (512)  ///< Coroutine frame size in bytes
+#endif
+
+/*!
+ * \brief Take a frame from the pool (NULL - pool empty or size > SIO_CO_FRAME_SIZE).
+ */
+void* sio_co_alloc(size_t size);
+
+/*!
+ * \brief Return a frame to the pool.
+ */
+void sio_co_free(void* p);
+
+/*!
+ * \brief Frames in use.
+ */
+int sio_co_used();
+
+/*!
+ * \brief Coroutine task (return type of coroutines using the client).
+ *
+ * Calling the coroutine starts it on the calling task; after a co_await it continues on the task
+ * which woke it (network task, or dispatcher worker for events and acks). The frame comes from
+ * a fixed pool and returns to it when the coroutine ends. Nobody waits for the task.
+ */
+class SioTask {
+public:
+    struct promise_type {
+        static void* operator new(size_t size) noexcept { return sio_co_alloc(size); }
+        static void operator delete(void* p) noexcept { sio_co_free(p); }
+        static SioTask get_return_object_on_allocation_failure() { return SioTask(false); }
+        SioTask get_return_object() { return SioTask(true); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+
+    /*!
+     * \brief Coroutine started (false - no free frame in the pool, or frame larger than SIO_CO_FRAME_SIZE).
+     */
+    bool started() const { return m_started; }
+
+private:
+    explicit SioTask(bool s) : m_started(s) {}
+    bool m_started;
+};
+
+/*!
+ * \brief Resume coroutine of the waiter.
+ */
+inline void sio_co_resume(SioWaiter* w)
+{
+    std::coroutine_handle<>::from_address(w->h).resume();
+}
+
+/*!
+ * \brief co_await client.connected().
+ */
+class SioJoinAwait {
+public:
+    explicit SioJoinAwait(SocketIoClient* c) : m_c(c) {}
+    bool await_ready() const { return m_c->isJoined(); }
+    bool await_suspend(std::coroutine_handle<> h) {
+        m_w.event = NULL;
+        m_w.resume = sio_co_resume;
+        m_w.h = h.address();
+        return m_c->wait(&m_w);
+    }
+    void await_resume() {}
+
+private:
+    SocketIoClient* m_c;
+    SioWaiter       m_w;
+};
+
+/*!
+ * \brief co_await client.next(event) - result: event arguments, valid until the next co_await.
+ */
+class SioEventAwait {
+public:
+    SioEventAwait(SocketIoClient* c, const char* event) : m_c(c) { m_w.event = event; }
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        m_w.resume = sio_co_resume;
+        m_w.h = h.address();
+        return m_c->wait(&m_w);
+    }
+    char* await_resume() { return m_w.msg; }
+
+private:
+    SocketIoClient* m_c;
+    SioWaiter       m_w;
+};
+
+/*!
+ * \brief Result of co_await client.emitWithAck().
+ */
+typedef struct {
+    const char* args;               /*!< Ack arguments (NULL - not sent or connection lost), valid until the next co_await */
+    int         len;                /*!< Arguments length                                  */
+} SioAckResult;
+
+/*!
+ * \brief co_await client.emitWithAck(key, val).
+ */
+class SioAckAwait {
+public:
+    SioAckAwait(SocketIoClient* c, const char* key, const char* val) : m_c(c), m_key(key), m_val(val), m_done(false) {}
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        m_h = h;
+        m_res.args = NULL;
+        m_res.len = 0;
+        int r = m_c->sendWithAck(m_key, m_val, [this](SocketIoClient*, const char* msg, int len) {
+            m_res.args = msg;
+            m_res.len = len;
+            /* Ack may arrive before await_suspend returns - the later of the two continues */
+            if (m_done.exchange(true)) m_h.resume();
+        });
+        if (r <= 0) return false;
+        return !m_done.exchange(true);
+    }
+    SioAckResult await_resume() { return m_res; }
+
+private:
+    SocketIoClient*         m_c;
+    const char*             m_key;
+    const char*             m_val;
+    std::atomic<bool>       m_done;
+    std::coroutine_handle<> m_h;
+    SioAckResult            m_res;
+};
+
+inline SioJoinAwait SocketIoClient::connected() { return SioJoinAwait(this); }
+inline SioAckAwait SocketIoClient::emitWithAck(const char* key, const char* val) { return SioAckAwait(this, key, val); }
+inline SioEventAwait SocketIoClient::next(const char* event) { return SioEventAwait(this, event); }
+
+#endif
+
+#endif
@@ -0,0 +1,698 @@
+/*
+ * Socket.IO packet encoding (default text encoding, MessagePack).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "sioparser.h"
+#include "socketioclient.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIO_MP_DEPTH        (32)   ///< Maximum nesting of arrays and maps
+
+//==========================================================================================
+// Default encoding
+//==========================================================================================
+
+/*!
+ * \brief Encode packet (type character + body).
+ */
+int SioJsonParser::encode(char type, const char* body, uint32_t len, char* out, uint32_t size)
+{
+    if (len + 2 > size) return -1;
+    out[0] = type;
+    memcpy(&out[1], body, len);
+    out[len + 1] = '\0';
+    return len + 1;
+}
+
+/*!
+ * \brief Decode packet (type character + body).
+ */
+int SioJsonParser::decode(const char* in, uint32_t len, char* type, char* out, uint32_t size)
+{
+    if ((len < 1) || (len > size)) return -1;
+    *type = in[0];
+    memcpy(out, &in[1], len - 1);
+    out[len - 1] = '\0';
+    return len - 1;
+}
+
+//==========================================================================================
+// MessagePack writer
+//==========================================================================================
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* end;
+} MpOut;
+
+static bool mp_put(MpOut* o, const void* d, uint32_t n)
+{
+    if ((uint32_t)(o->end - o->p) < n) return false;
+    memcpy(o->p, d, n);
+    o->p += n;
+    return true;
+}
+
+static bool mp_byte(MpOut* o, uint8_t b)
+{
+    if (o->p >= o->end) return false;
+    *o->p++ = b;
+    return true;
+}
+
+/*!
+ * \brief Tag followed by n bytes of v (big endian).
+ */
+static bool mp_be(MpOut* o, uint8_t tag, uint64_t v, int n)
+{
+    if ((o->end - o->p) < n + 1) return false;
+    *o->p++ = tag;
+    for (int i = n - 1; i >= 0; i--) *o->p++ = (uint8_t)(v >> (i * 8));
+    return true;
+}
+
+static bool mp_uint(MpOut* o, uint64_t v)
+{
+    if (v < 0x80) return mp_byte(o, (uint8_t)v);
+    if (v <= 0xFF) return mp_be(o, 0xcc, v, 1);
+    if (v <= 0xFFFF) return mp_be(o, 0xcd, v, 2);
+    if (v <= 0xFFFFFFFFu) return mp_be(o, 0xce, v, 4);
+    return mp_be(o, 0xcf, v, 8);
+}
+
+static bool mp_int(MpOut* o, int64_t v)
+{
+    if (v >= 0) return mp_uint(o, (uint64_t)v);
+    if (v >= -32) return mp_byte(o, (uint8_t)v);
+    if (v >= INT8_MIN) return mp_be(o, 0xd0, (uint64_t)v, 1);
+    if (v >= INT16_MIN) return mp_be(o, 0xd1, (uint64_t)v, 2);
+    if (v >= INT32_MIN) return mp_be(o, 0xd2, (uint64_t)v, 4);
+    return mp_be(o, 0xd3, (uint64_t)v, 8);
+}
+
+static bool mp_double(MpOut* o, double d)
+{
+    float f = (float)d;
+    if ((double)f == d) {
+        uint32_t u;
+        memcpy(&u, &f, 4);
+        return mp_be(o, 0xca, u, 4);
+    }
+    uint64_t u;
+    memcpy(&u, &d, 8);
+    return mp_be(o, 0xcb, u, 8);
+}
+
+static bool mp_str(MpOut* o, const char* s, uint32_t n)
+{
+    return mp_byte(o, 0xa0 | n) && mp_put(o, s, n);
+}
+
+/*!
+ * \brief Write header of a string (kind 0), array (1) or map (2) in the byte reserved at h,
+ *        content (n bytes or elements) already follows it.
+ */
+static bool mp_header(MpOut* o, uint8_t* h, uint32_t n, int kind)
+{
+    static const uint8_t fix[3] = { 0xa0, 0x90, 0x80 };
+    static const uint8_t fixMax[3] = { 31, 15, 15 };
+    static const uint8_t tag16[3] = { 0xda, 0xdc, 0xde };
+    static const uint8_t tag32[3] = { 0xdb, 0xdd, 0xdf };
+    uint8_t hdr[5];
+    int hn;
+
+    if (n <= fixMax[kind]) {
+        *h = fix[kind] | n;
+        return true;
+    }
+    if ((kind == 0) && (n <= 0xFF)) {
+        hdr[0] = 0xd9; hdr[1] = n; hn = 2;
+    } else if (n <= 0xFFFF) {
+        hdr[0] = tag16[kind]; hdr[1] = n >> 8; hdr[2] = n; hn = 3;
+    } else {
+        hdr[0] = tag32[kind]; hdr[1] = n >> 24; hdr[2] = n >> 16; hdr[3] = n >> 8; hdr[4] = n; hn = 5;
+    }
+    /* Make room for the longer header */
+    if ((o->end - o->p) < hn - 1) return false;
+    memmove(h + hn, h + 1, o->p - h - 1);
+    o->p += hn - 1;
+    memcpy(h, hdr, hn);
+    return true;
+}
+
+//==========================================================================================
+// JSON -> MessagePack
+//==========================================================================================
+
+typedef struct {
+    const char* s;
+    const char* e;
+} JsIn;
+
+static void js_ws(JsIn* in)
+{
+    while ((in->s < in->e) && ((*in->s == ' ') || (*in->s == '\t') || (*in->s == '\n') || (*in->s == '\r'))) in->s++;
+}
+
+static bool js_word(JsIn* in, const char* w, int n)
+{
+    if ((in->e - in->s < n) || memcmp(in->s, w, n)) return false;
+    in->s += n;
+    return true;
+}
+
+static bool js_hex4(JsIn* in, uint32_t* cp)
+{
+    if (in->e - in->s < 4) return false;
+    *cp = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *in->s++;
+        *cp <<= 4;
+        if ((c >= '0') && (c <= '9')) *cp |= c - '0';
+        else if ((c >= 'a') && (c <= 'f')) *cp |= c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F')) *cp |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief JSON string (in->s at the opening quote) to MessagePack str.
+ */
+static bool js_string(JsIn* in, MpOut* o)
+{
+    uint8_t* h = o->p;
+
+    if (!mp_byte(o, 0)) return false;
+    in->s++;
+    for (;;) {
+        /* Copy plain characters */
+        const char* r = in->s;
+        while ((r < in->e) && (*r != '"') && (*r != '\\')) r++;
+        if (!mp_put(o, in->s, r - in->s)) return false;
+        in->s = r;
+        if (r >= in->e) return false;
+        if (*r == '"') break;
+        /* Escape sequence */
+        if (in->e - in->s < 2) return false;
+        char c = in->s[1];
+        uint8_t b;
+        in->s += 2;
+        switch (c) {
+            case '"': case '\\': case '/': b = c; break;
+            case 'b': b = '\b'; break;
+            case 'f': b = '\f'; break;
+            case 'n': b = '\n'; break;
+            case 'r': b = '\r'; break;
+            case 't': b = '\t'; break;
+            case 'u': {
+                uint32_t cp, lo;
+                uint8_t u[4];
+                int n;
+                if (!js_hex4(in, &cp)) return false;
+                if ((cp >= 0xD800) && (cp <= 0xDBFF)) {
+                    /* Surrogate pair */
+                    if ((in->e - in->s < 2) || (in->s[0] != '\\') || (in->s[1] != 'u')) return false;
+                    in->s += 2;
+                    if ((!js_hex4(in, &lo)) || (lo < 0xDC00) || (lo > 0xDFFF)) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                if (cp < 0x80) {
+                    u[0] = cp; n = 1;
+                } else if (cp < 0x800) {
+                    u[0] = 0xC0 | (cp >> 6); u[1] = 0x80 | (cp & 0x3F); n = 2;
+                } else if (cp < 0x10000) {
+                    u[0] = 0xE0 | (cp >> 12); u[1] = 0x80 | ((cp >> 6) & 0x3F); u[2] = 0x80 | (cp & 0x3F); n = 3;
+                } else {
+                    u[0] = 0xF0 | (cp >> 18); u[1] = 0x80 | ((cp >> 12) & 0x3F); u[2] = 0x80 | ((cp >> 6) & 0x3F); u[3] = 0x80 | (cp & 0x3F); n = 4;
+                }
+                if (!mp_put(o, u, n)) return false;
+            } continue;
+            default: return false;
+        }
+        if (!mp_byte(o, b)) return false;
+    }
+    in->s++;
+    return mp_header(o, h, o->p - h - 1, 0);
+}
+
+/*!
+ * \brief JSON number to MessagePack int (when it fits) or float.
+ */
+static bool js_number(JsIn* in, MpOut* o)
+{
+    const char* s = in->s;
+    uint64_t v = 0;
+    bool neg = false, flt = false, ovf = false;
+    int nd = 0;
+
+    if ((s < in->e) && (*s == '-')) { neg = true; s++; }
+    while ((s < in->e) && (*s >= '0') && (*s <= '9')) {
+        uint32_t d = *s - '0';
+        if (v > (UINT64_MAX - d) / 10) ovf = true;
+        v = v * 10 + d;
+        s++;
+        nd++;
+    }
+    if (!nd) return false;
+    if ((s < in->e) && ((*s == '.') || (*s == 'e') || (*s == 'E'))) {
+        flt = true;
+        while ((s < in->e) && (((*s >= '0') && (*s <= '9')) || (*s == '.') || (*s == 'e') || (*s == 'E') || (*s == '+') || (*s == '-'))) s++;
+    }
+    if (flt || ovf || (neg && (v > (uint64_t)INT64_MAX + 1))) {
+        char b[40];
+        int n = s - in->s;
+        if (n >= (int)sizeof(b)) return false;
+        memcpy(b, in->s, n);
+        b[n] = '\0';
+        in->s = s;
+        return mp_double(o, strtod(b, NULL));
+    }
+    in->s = s;
+    if (neg) return mp_int(o, (v == (uint64_t)INT64_MAX + 1) ? INT64_MIN : -(int64_t)v);
+    return mp_uint(o, v);
+}
+
+static bool js_value(JsIn* in, MpOut* o, int depth)
+{
+    js_ws(in);
+    if ((in->s >= in->e) || (depth > SIO_MP_DEPTH)) return false;
+    switch (*in->s) {
+        case '{':
+        case '[': {
+            bool map = (*in->s == '{');
+            char close = map ? '}' : ']';
+            uint8_t* h = o->p;
+            uint32_t n = 0;
+            if (!mp_byte(o, 0)) return false;
+            in->s++;
+            js_ws(in);
+            if ((in->s < in->e) && (*in->s == close)) {
+                in->s++;
+                return mp_header(o, h, 0, map ? 2 : 1);
+            }
+            for (;;) {
+                if (map) {
+                    js_ws(in);
+                    if ((in->s >= in->e) || (*in->s != '"') || (!js_string(in, o))) return false;
+                    js_ws(in);
+                    if ((in->s >= in->e) || (*in->s != ':')) return false;
+                    in->s++;
+                }
+                if (!js_value(in, o, depth + 1)) return false;
+                n++;
+                js_ws(in);
+                if (in->s >= in->e) return false;
+                if (*in->s == ',') { in->s++; continue; }
+                if (*in->s != close) return false;
+                in->s++;
+                break;
+            }
+            return mp_header(o, h, n, map ? 2 : 1);
+        }
+        case '"': return js_string(in, o);
+        case 't': return js_word(in, "true", 4) && mp_byte(o, 0xc3);
+        case 'f': return js_word(in, "false", 5) && mp_byte(o, 0xc2);
+        case 'n': return js_word(in, "null", 4) && mp_byte(o, 0xc0);
+        default: return js_number(in, o);
+    }
+}
+
+//==========================================================================================
+// MessagePack -> JSON
+//==========================================================================================
+
+/* NULL output - skip value */
+typedef struct {
+    char* p;
+    char* end;
+} JsOut;
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* e;
+} MpIn;
+
+static bool js_put(JsOut* o, const char* d, uint32_t n)
+{
+    if (!o) return true;
+    if ((uint32_t)(o->end - o->p) < n) return false;
+    memcpy(o->p, d, n);
+    o->p += n;
+    return true;
+}
+
+static bool js_ch(JsOut* o, char c)
+{
+    if (!o) return true;
+    if (o->p >= o->end) return false;
+    *o->p++ = c;
+    return true;
+}
+
+static bool js_uint(JsOut* o, uint64_t v)
+{
+    char b[24];
+    int i = sizeof(b);
+    do { b[--i] = '0' + (v % 10); v /= 10; } while (v);
+    return js_put(o, &b[i], sizeof(b) - i);
+}
+
+static bool js_int(JsOut* o, int64_t v)
+{
+    if (v >= 0) return js_uint(o, (uint64_t)v);
+    return js_ch(o, '-') && js_uint(o, (uint64_t)(-(v + 1)) + 1);
+}
+
+static bool js_double(JsOut* o, double d, int digits)
+{
+    char b[32];
+    int n;
+    if (!o) return true;
+    if (isnan(d) || isinf(d)) return js_put(o, "null", 4);
+    n = snprintf(b, sizeof(b), "%.*g", digits, d);
+    if (strtod(b, NULL) != d) n = snprintf(b, sizeof(b), "%.17g", d);
+    return js_put(o, b, n);
+}
+
+/*!
+ * \brief JSON string with escapes.
+ */
+static bool js_escaped(JsOut* o, const uint8_t* s, uint32_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint32_t i = 0;
+
+    if (!o) return true;
+    if (!js_ch(o, '"')) return false;
+    while (i < n) {
+        uint32_t r = i;
+        while ((r < n) && (s[r] >= 0x20) && (s[r] != '"') && (s[r] != '\\')) r++;
+        if (!js_put(o, (const char*)&s[i], r - i)) return false;
+        if (r >= n) break;
+        char e[6] = { '\\', 0, '0', '0', 0, 0 };
+        int en = 2;
+        switch (s[r]) {
+            case '"': e[1] = '"'; break;
+            case '\\': e[1] = '\\'; break;
+            case '\n': e[1] = 'n'; break;
+            case '\r': e[1] = 'r'; break;
+            case '\t': e[1] = 't'; break;
+            case '\b': e[1] = 'b'; break;
+            case '\f': e[1] = 'f'; break;
+            default:
+                e[1] = 'u'; e[4] = hex[s[r] >> 4]; e[5] = hex[s[r] & 15]; en = 6;
+                break;
+        }
+        if (!js_put(o, e, en)) return false;
+        i = r + 1;
+    }
+    return js_ch(o, '"');
+}
+
+/*!
+ * \brief Binary data as base64 JSON string.
+ */
+static bool js_base64(JsOut* o, const uint8_t* s, uint32_t n)
+{
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    if (!o) return true;
+    if ((uint32_t)(o->end - o->p) < ((n + 2) / 3) * 4 + 2) return false;
+    *o->p++ = '"';
+    for (uint32_t i = 0; i < n; i += 3) {
+        uint32_t v = s[i] << 16;
+        if (i + 1 < n) v |= s[i + 1] << 8;
+        if (i + 2 < n) v |= s[i + 2];
+        *o->p++ = b64[(v >> 18) & 63];
+        *o->p++ = b64[(v >> 12) & 63];
+        *o->p++ = (i + 1 < n) ? b64[(v >> 6) & 63] : '=';
+        *o->p++ = (i + 2 < n) ? b64[v & 63] : '=';
+    }
+    *o->p++ = '"';
+    return true;
+}
+
+/*!
+ * \brief Read n bytes big endian.
+ */
+static bool mp_get(MpIn* in, int n, uint64_t* v)
+{
+    if (in->e - in->p < n) return false;
+    *v = 0;
+    for (int i = 0; i < n; i++) *v = (*v << 8) | *in->p++;
+    return true;
+}
+
+/*!
+ * \brief MessagePack value to JSON (o == NULL - skip value).
+ */
+static bool mp_value(MpIn* in, JsOut* o, int depth)
+{
+    uint64_t v;
+    uint32_t n;
+    uint8_t t;
+    bool map;
+
+    if ((in->p >= in->e) || (depth > SIO_MP_DEPTH)) return false;
+    t = *in->p++;
+    if (t <= 0x7f) return js_uint(o, t);
+    if (t >= 0xe0) return js_int(o, (int8_t)t);
+    if ((t & 0xe0) == 0xa0) { n = t & 0x1f; goto str; }
+    if ((t & 0xf0) == 0x90) { n = t & 0x0f; map = false; goto container; }
+    if ((t & 0xf0) == 0x80) { n = t & 0x0f; map = true; goto container; }
+    switch (t) {
+        case 0xc0: return js_put(o, "null", 4);
+        case 0xc2: return js_put(o, "false", 5);
+        case 0xc3: return js_put(o, "true", 4);
+        case 0xc4: case 0xc5: case 0xc6:
+            /* bin 8/16/32 */
+            if (!mp_get(in, 1 << (t - 0xc4), &v)) return false;
+            if ((uint64_t)(in->e - in->p) < v) return false;
+            in->p += v;
+            return js_base64(o, in->p - v, v);
+        case 0xc7: case 0xc8: case 0xc9:
+            /* ext 8/16/32 */
+            if (!mp_get(in, 1 << (t - 0xc7), &v)) return false;
+            if ((uint64_t)(in->e - in->p) < v + 1) return false;
+            in->p += v + 1;
+            return js_put(o, "null", 4);
+        case 0xca: {
+            float f;
+            uint32_t u;
+            if (!mp_get(in, 4, &v)) return false;
+            u = v;
+            memcpy(&f, &u, 4);
+            return js_double(o, f, 9);
+        }
+        case 0xcb: {
+            double d;
+            if (!mp_get(in, 8, &v)) return false;
+            memcpy(&d, &v, 8);
+            return js_double(o, d, 15);
+        }
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            return mp_get(in, 1 << (t - 0xcc), &v) && js_uint(o, v);
+        case 0xd0: return mp_get(in, 1, &v) && js_int(o, (int8_t)v);
+        case 0xd1: return mp_get(in, 2, &v) && js_int(o, (int16_t)v);
+        case 0xd2: return mp_get(in, 4, &v) && js_int(o, (int32_t)v);
+        case 0xd3: return mp_get(in, 8, &v) && js_int(o, (int64_t)v);
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+            /* fixext 1/2/4/8/16 */
+            n = 1 + (1 << (t - 0xd4));
+            if ((uint32_t)(in->e - in->p) < n) return false;
+            in->p += n;
+            return js_put(o, "null", 4);
+        case 0xd9: case 0xda: case 0xdb:
+            if (!mp_get(in, 1 << (t - 0xd9), &v)) return false;
+            n = v;
+            goto str;
+        case 0xdc: case 0xdd:
+            if (!mp_get(in, 2 << (t - 0xdc), &v)) return false;
+            n = v; map = false;
+            goto container;
+        case 0xde: case 0xdf:
+            if (!mp_get(in, 2 << (t - 0xde), &v)) return false;
+            n = v; map = true;
+            goto container;
+        default:
+            return false;
+    }
+str:
+    if ((uint32_t)(in->e - in->p) < n) return false;
+    in->p += n;
+    return js_escaped(o, in->p - n, n);
+container:
+    if (!js_ch(o, map ? '{' : '[')) return false;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i && (!js_ch(o, ','))) return false;
+        if (map) {
+            /* JSON keys are strings */
+            bool skey = (in->p < in->e) && (((*in->p & 0xe0) == 0xa0) || ((*in->p >= 0xd9) && (*in->p <= 0xdb)));
+            if ((!skey) && (!js_ch(o, '"'))) return false;
+            if (!mp_value(in, o, depth + 1)) return false;
+            if ((!skey) && (!js_ch(o, '"'))) return false;
+            if (!js_ch(o, ':')) return false;
+        }
+        if (!mp_value(in, o, depth + 1)) return false;
+    }
+    return js_ch(o, map ? '}' : ']');
+}
+
+/*!
+ * \brief Read string (key).
+ */
+static bool mp_get_str(MpIn* in, const char** s, uint32_t* n)
+{
+    uint64_t v;
+    if (in->p >= in->e) return false;
+    uint8_t t = *in->p++;
+    if ((t & 0xe0) == 0xa0) {
+        v = t & 0x1f;
+    } else if ((t >= 0xd9) && (t <= 0xdb)) {
+        if (!mp_get(in, 1 << (t - 0xd9), &v)) return false;
+    } else {
+        return false;
+    }
+    if ((uint64_t)(in->e - in->p) < v) return false;
+    *s = (const char*)in->p;
+    *n = v;
+    in->p += v;
+    return true;
+}
+
+/*!
+ * \brief Read integer.
+ */
+static bool mp_get_int(MpIn* in, int64_t* r)
+{
+    uint64_t v;
+    if (in->p >= in->e) return false;
+    uint8_t t = *in->p++;
+    if (t <= 0x7f) { *r = t; return true; }
+    if (t >= 0xe0) { *r = (int8_t)t; return true; }
+    if ((t >= 0xcc) && (t <= 0xcf)) { if (!mp_get(in, 1 << (t - 0xcc), &v)) return false; *r = (int64_t)v; return true; }
+    if ((t >= 0xd0) && (t <= 0xd3)) {
+        int n = 1 << (t - 0xd0);
+        if (!mp_get(in, n, &v)) return false;
+        if (n < 8) v = (v ^ (1ull << (n * 8 - 1))) - (1ull << (n * 8 - 1));
+        *r = (int64_t)v;
+        return true;
+    }
+    return false;
+}
+
+//==========================================================================================
+// MessagePack packets
+//==========================================================================================
+
+/*!
+ * \brief Encode packet as map {type, data, nsp, id}.
+ */
+int SioMsgPackParser::encode(char type, const char* body, uint32_t len, char* out, uint32_t size)
+{
+    MpOut o = { (uint8_t*)out, (uint8_t*)out + size };
+    const char* b = body, * e = body + len;
+    int64_t id = -1;
+    bool ok;
+
+    /* Ack id before the data (events and acks) */
+    if ((type == SIO_MSG_EVENT) || (type == SIO_MSG_ACK) || (type == SIO_MSG_BINARY_EV) || (type == SIO_MSG_BINARY_ACK)) {
+        while ((b < e) && (*b >= '0') && (*b <= '9')) { id = ((id < 0) ? 0 : id * 10) + (*b - '0'); b++; }
+    }
+    /* Main namespace only */
+    if ((b < e) && (*b == '/')) {
+        b++;
+        if ((b < e) && (*b == ',')) b++;
+    }
+    JsIn in = { b, e };
+    js_ws(&in);
+    bool data = (in.s < in.e);
+
+    ok = mp_byte(&o, 0x80 | (2 + (data ? 1 : 0) + ((id >= 0) ? 1 : 0)));
+    ok = ok && mp_str(&o, "type", 4) && mp_uint(&o, type - '0');
+    if (data) {
+        ok = ok && mp_str(&o, "data", 4) && js_value(&in, &o, 0);
+        js_ws(&in);
+        ok = ok && (in.s == in.e);
+    }
+    ok = ok && mp_str(&o, "nsp", 3) && mp_str(&o, "/", 1);
+    if (id >= 0) ok = ok && mp_str(&o, "id", 2) && mp_uint(&o, id);
+    return ok ? (int)(o.p - (uint8_t*)out) : -1;
+}
+
+/*!
+ * \brief Decode packet map {type, data, nsp, id} (any key order).
+ */
+int SioMsgPackParser::decode(const char* buf, uint32_t len, char* type, char* out, uint32_t size)
+{
+    MpIn in = { (const uint8_t*)buf, (const uint8_t*)buf + len };
+    const uint8_t* data = NULL;
+    int64_t ptype = -1, id = -1;
+    uint64_t n;
+
+    if ((len < 1) || (size < 1)) return -1;
+    uint8_t t = *in.p++;
+    if ((t & 0xf0) == 0x80) n = t & 0x0f;
+    else if ((t == 0xde) || (t == 0xdf)) { if (!mp_get(&in, 2 << (t - 0xde), &n)) return -1; }
+    else return -1;
+
+    for (uint64_t i = 0; i < n; i++) {
+        const char* k;
+        uint32_t kl;
+        if (!mp_get_str(&in, &k, &kl)) return -1;
+        if ((kl == 4) && (!memcmp(k, "type", 4))) {
+            if (!mp_get_int(&in, &ptype)) return -1;
+        } else if ((kl == 2) && (!memcmp(k, "id", 2))) {
+            if (!mp_get_int(&in, &id)) return -1;
+        } else {
+            if ((kl == 4) && (!memcmp(k, "data", 4))) data = in.p;
+            if (!mp_value(&in, NULL, 0)) return -1;
+        }
+    }
+    if ((ptype < 0) || (ptype > 9)) return -1;
+    *type = '0' + ptype;
+
+    JsOut o = { out, out + size - 1 };
+    if ((id >= 0) && (!js_uint(&o, id))) return -1;
+    if (data) {
+        MpIn d = { data, in.e };
+        if (!mp_value(&d, &o, 0)) return -1;
+    }
+    *o.p = '\0';
+    return o.p - out;
+}
+
+/*!
+ * \brief Convert JSON value to MessagePack.
+ */
+int sio_json_to_msgpack(const char* json, uint32_t len, uint8_t* out, uint32_t size)
+{
+    JsIn in = { json, json + len };
+    MpOut o = { out, out + size };
+    if (!js_value(&in, &o, 0)) return -1;
+    js_ws(&in);
+    if (in.s != in.e) return -1;
+    return o.p - out;
+}
+
+/*!
+ * \brief Convert MessagePack value to JSON (NUL terminated).
+ */
+int sio_msgpack_to_json(const uint8_t* in, uint32_t len, char* out, uint32_t size)
+{
+    MpIn i = { in, in + len };
+    if (size < 1) return -1;
+    JsOut o = { out, out + size - 1 };
+    if (!mp_value(&i, &o, 0)) return -1;
+    *o.p = '\0';
+    return o.p - out;
+}
@@ -0,0 +1,92 @@
+/*
+ * Socket.IO packet encoding (default text encoding, MessagePack).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_SIOPARSER__
+#define __RV_SIOPARSER__
+
+#include <stdint.h>
+#include "websocketclient.h"
+
+/*!
+ * \brief Socket.IO packet parser.
+ *
+ * The client API works with the packet body in text form - the part after "4<type>" in the
+ * default encoding: optional ack id followed by JSON ("12[\"event\",1]", "{\"pid\":\"x\"}").
+ * A parser turns it into the Socket.IO packet sent in one Engine.IO message and back,
+ * the client adds the Engine.IO framing. Parsers do not allocate memory.
+ */
+class SioParser {
+public:
+    virtual ~SioParser() {}
+
+    /*!
+     * \brief WebSocket frame type of encoded packets (WS_FR_OP_TXT / WS_FR_OP_BIN).
+     */
+    virtual int opcode() const = 0;
+
+    /*!
+     * \brief Encode packet.
+     * \param type - packet type (SIO_MSG_xxx),
+     * \param body - packet body in text form,
+     * \param len - body length,
+     * \param out - output buffer,
+     * \param size - output buffer size,
+     * \return encoded length, -1 - invalid body or output buffer too small.
+     */
+    virtual int encode(char type, const char* body, uint32_t len, char* out, uint32_t size) = 0;
+
+    /*!
+     * \brief Decode packet.
+     * \param in - packet data,
+     * \param len - packet length,
+     * \param type - packet type (SIO_MSG_xxx),
+     * \param out - packet body in text form (NUL terminated),
+     * \param size - output buffer size,
+     * \return body length, -1 - invalid packet or output buffer too small.
+     */
+    virtual int decode(const char* in, uint32_t len, char* type, char* out, uint32_t size) = 0;
+};
+
+/*!
+ * \brief Default Socket.IO encoding (packet type character + text body).
+ */
+class SioJsonParser : public SioParser {
+public:
+    int opcode() const override { return WS_FR_OP_TXT; }
+    int encode(char type, const char* body, uint32_t len, char* out, uint32_t size) override;
+    int decode(const char* in, uint32_t len, char* type, char* out, uint32_t size) override;
+};
+
+/*!
+ * \brief MessagePack encoding, compatible with socket.io-msgpack-parser
+ * (packet is a map {type, data, nsp, id}, sent in binary frames).
+ *
+ * JSON bodies are converted to MessagePack and back on the fly: binary data is decoded
+ * as a base64 string, extension types as null.
+ */
+class SioMsgPackParser : public SioParser {
+public:
+    int opcode() const override { return WS_FR_OP_BIN; }
+    int encode(char type, const char* body, uint32_t len, char* out, uint32_t size) override;
+    int decode(const char* in, uint32_t len, char* type, char* out, uint32_t size) override;
+};
+
+/*!
+ * \brief Convert JSON value to MessagePack.
+ * \return MessagePack length, -1 - invalid JSON or output buffer too small.
+ */
+int sio_json_to_msgpack(const char* json, uint32_t len, uint8_t* out, uint32_t size);
+
+/*!
+ * \brief Convert MessagePack value to JSON (NUL terminated).
+ * \return JSON length, -1 - invalid MessagePack or output buffer too small.
+ */
+int sio_msgpack_to_json(const uint8_t* in, uint32_t len, char* out, uint32_t size);
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ * SocketIO outbound (offline) emit queue.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "sioqueue.h"
+#include <esp_log.h>
+#include <string.h>
+
+static char tag[] = "SIOQ";
+
+#ifdef DEBUG
+#define cl_sioq_debug(fmt, args...)  ESP_LOGI(tag, fmt, ## args);
+#define cl_sioq_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#else
+#define cl_sioq_debug(fmt, args...)
+#define cl_sioq_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#endif
+
+#define SIOQ_FILE_HDR   (8)    /* magic + head offset */
+#define SIOQ_MAGIC      "SIQ2" /* file layout version */
+#define SIOQ_REC_HDR    (12)   /* live, key length, reserved, data length, sequence number */
+#define SIOQ_COMPACT    (4096) /* minimum of consumed bytes before the file is rewritten */
+
+//==========================================================================================
+// RAM store
+//==========================================================================================
+
+int SioRamStore::push(const char* key, const char* data, uint32_t len)
+{
+    m_items.push_back({ std::string(key), std::string(data, len), m_seq++ });
+    m_bytes += strlen(key) + len;
+    return 1;
+}
+
+int SioRamStore::front(std::string& key, std::string& data, uint32_t& seq)
+{
+    if (m_items.empty()) return 0;
+    key = m_items.front().key;
+    data = m_items.front().data;
+    seq = m_items.front().seq;
+    return 1;
+}
+
+int SioRamStore::pop()
+{
+    if (m_items.empty()) return 0;
+    m_bytes -= m_items.front().key.length() + m_items.front().data.length();
+    m_items.pop_front();
+    return 1;
+}
+
+uint32_t SioRamStore::erase(const char* key)
+{
+    uint32_t r = 0;
+    for (auto itr = m_items.begin(); itr != m_items.end();) {
+        if (itr->key == key) {
+            r += itr->key.length() + itr->data.length();
+            itr = m_items.erase(itr);
+        } else {
+            itr++;
+        }
+    }
+    m_bytes -= r;
+    return r;
+}
+
+void SioRamStore::clear()
+{
+    m_items.clear();
+    m_bytes = 0;
+}
+
+//==========================================================================================
+// File store
+//==========================================================================================
+
+/*!
+ * \brief Open (or create) queue file.
+ * \param path - file path (i.e. "/spiffs/sioq.bin").
+ */
+SioFileStore::SioFileStore(const char* path) : m_path(path)
+{
+    uint8_t hdr[SIOQ_REC_HDR];
+    char magic[4];
+
+    m_head = SIOQ_FILE_HDR;
+    m_end = SIOQ_FILE_HDR;
+    m_count = 0;
+    m_bytes = 0;
+    m_seq = 0;
+    m_f = fopen(path, "r+b");
+    if (m_f && (fread(magic, 1, 4, m_f) == 4) && (!memcmp(magic, SIOQ_MAGIC, 4)) && (fread(&m_head, 1, 4, m_f) == 4)) {
+        /* Existing queue - count live records */
+        fseek(m_f, 0, SEEK_END);
+        m_end = ftell(m_f);
+        for (uint32_t pos = m_head; readHeader(pos, hdr);) {
+            uint32_t dlen;
+            memcpy(&dlen, &hdr[4], 4);
+            if (hdr[0]) {
+                m_count++;
+                m_bytes += hdr[1] + dlen;
+            }
+            /* Continue after the newest record */
+            memcpy(&m_seq, &hdr[8], 4);
+            m_seq++;
+            pos += SIOQ_REC_HDR + hdr[1] + dlen;
+        }
+        cl_sioq_debug("Queue file %s (count = %u, bytes = %u)", path, m_count, m_bytes);
+        return;
+    }
+    if (m_f) fclose(m_f);
+    m_f = NULL;
+    clear();
+}
+
+SioFileStore::~SioFileStore()
+{
+    if (m_f) fclose(m_f);
+}
+
+/*!
+ * \brief Read record header at the given offset (0 at the end of file).
+ */
+int SioFileStore::readHeader(uint32_t pos, uint8_t* hdr)
+{
+    uint32_t dlen;
+
+    if (pos + SIOQ_REC_HDR > m_end) return 0;
+    if (fseek(m_f, pos, SEEK_SET) != 0) return 0;
+    if (fread(hdr, 1, SIOQ_REC_HDR, m_f) != SIOQ_REC_HDR) return 0;
+    memcpy(&dlen, &hdr[4], 4);
+    if (pos + SIOQ_REC_HDR + hdr[1] + dlen > m_end) return 0;
+    return 1;
+}
+
+/*!
+ * \brief Move head over removed records.
+ */
+void SioFileStore::skipDead()
+{
+    uint8_t hdr[SIOQ_REC_HDR];
+    uint32_t dlen;
+
+    while (readHeader(m_head, hdr) && (!hdr[0])) {
+        memcpy(&dlen, &hdr[4], 4);
+        m_head += SIOQ_REC_HDR + hdr[1] + dlen;
+    }
+}
+
+/*!
+ * \brief Store head offset (or start from scratch when all records are consumed).
+ */
+void SioFileStore::writeHead()
+{
+    uint32_t live = m_bytes + m_count * SIOQ_REC_HDR;
+
+    if (m_count == 0) {
+        clear();
+        return;
+    }
+    /* Consumed/removed records dominate the file - rewrite live ones */
+    if ((m_end - SIOQ_FILE_HDR - live >= SIOQ_COMPACT) && (m_end - SIOQ_FILE_HDR > 2 * live)) {
+        compact();
+        if (!m_f || (m_head == SIOQ_FILE_HDR)) return;
+    }
+    fseek(m_f, 4, SEEK_SET);
+    fwrite(&m_head, 1, 4, m_f);
+    fflush(m_f);
+}
+
+/*!
+ * \brief Copy live records into a fresh file and replace the queue file with it.
+ */
+void SioFileStore::compact()
+{
+    std::string tmp = m_path + ".tmp";
+    uint8_t hdr[SIOQ_REC_HDR];
+    uint32_t head = SIOQ_FILE_HDR, end = SIOQ_FILE_HDR, dlen, n, pos;
+    char buf[256];
+    FILE* f;
+    bool ok;
+
+    f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        cl_sioq_error("Unable to create %s", tmp.c_str());
+        return;
+    }
+    ok = (fwrite(SIOQ_MAGIC, 1, 4, f) == 4) && (fwrite(&head, 1, 4, f) == 4);
+    for (pos = m_head; ok && readHeader(pos, hdr); pos += SIOQ_REC_HDR + hdr[1] + dlen) {
+        memcpy(&dlen, &hdr[4], 4);
+        if (!hdr[0]) continue;
+        ok = (fwrite(hdr, 1, SIOQ_REC_HDR, f) == SIOQ_REC_HDR);
+        /* Key + data in chunks (file position is just after the header) */
+        for (uint32_t left = hdr[1] + dlen; ok && left; left -= n) {
+            n = (left > sizeof(buf)) ? sizeof(buf) : left;
+            ok = (fread(buf, 1, n, m_f) == n) && (fwrite(buf, 1, n, f) == n);
+        }
+        end += SIOQ_REC_HDR + hdr[1] + dlen;
+    }
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        cl_sioq_error("Unable to compact %s", m_path.c_str());
+        remove(tmp.c_str());
+        return;
+    }
+    fclose(m_f);
+    /* SPIFFS/FAT do not replace an existing file on rename */
+    if (rename(tmp.c_str(), m_path.c_str()) != 0) {
+        remove(m_path.c_str());
+        rename(tmp.c_str(), m_path.c_str());
+    }
+    m_f = fopen(m_path.c_str(), "r+b");
+    if (!m_f) {
+        cl_sioq_error("Unable to open %s", m_path.c_str());
+        m_count = 0;
+        m_bytes = 0;
+        return;
+    }
+    cl_sioq_debug("Queue file %s compacted (%u -> %u bytes)", m_path.c_str(), m_end, end);
+    m_head = head;
+    m_end = end;
+}
+
+int SioFileStore::push(const char* key, const char* data, uint32_t len)
+{
+    uint8_t hdr[SIOQ_REC_HDR] = { 1, 0, 0, 0 };
+    uint32_t klen = strlen(key);
+
+    if ((!m_f) || (klen > SIO_QUEUE_KEY_MAX)) return 0;
+    hdr[1] = klen;
+    memcpy(&hdr[4], &len, 4);
+    memcpy(&hdr[8], &m_seq, 4);
+    fseek(m_f, m_end, SEEK_SET);
+    if ((fwrite(hdr, 1, SIOQ_REC_HDR, m_f) != SIOQ_REC_HDR) || (fwrite(key, 1, klen, m_f) != klen) || (fwrite(data, 1, len, m_f) != len)) {
+        cl_sioq_error("Unable to write %s", m_path.c_str());
+        fflush(m_f);
+        return 0;
+    }
+    fflush(m_f);
+    m_end += SIOQ_REC_HDR + klen + len;
+    m_seq++;
+    m_count++;
+    m_bytes += klen + len;
+    return 1;
+}
+
+int SioFileStore::front(std::string& key, std::string& data, uint32_t& seq)
+{
+    uint8_t hdr[SIOQ_REC_HDR];
+    uint32_t dlen;
+
+    if (!m_f || !m_count) return 0;
+    skipDead();
+    if (!readHeader(m_head, hdr)) return 0;
+    memcpy(&dlen, &hdr[4], 4);
+    memcpy(&seq, &hdr[8], 4);
+    key.resize(hdr[1]);
+    data.resize(dlen);
+    if (hdr[1] && (fread(&key[0], 1, hdr[1], m_f) != hdr[1])) return 0;
+    if (dlen && (fread(&data[0], 1, dlen, m_f) != dlen)) return 0;
+    return 1;
+}
+
+int SioFileStore::pop()
+{
+    uint8_t hdr[SIOQ_REC_HDR];
+    uint32_t dlen;
+
+    if (!m_f || !m_count) return 0;
+    skipDead();
+    if (!readHeader(m_head, hdr)) return 0;
+    memcpy(&dlen, &hdr[4], 4);
+    m_head += SIOQ_REC_HDR + hdr[1] + dlen;
+    m_count--;
+    m_bytes -= hdr[1] + dlen;
+    writeHead();
+    return 1;
+}
+
+uint32_t SioFileStore::erase(const char* key)
+{
+    uint8_t hdr[SIOQ_REC_HDR], dead = 0;
+    uint32_t klen = strlen(key), dlen, r = 0;
+    char k[256];
+
+    if (!m_f || !m_count) return 0;
+    for (uint32_t pos = m_head; readHeader(pos, hdr); pos += SIOQ_REC_HDR + hdr[1] + dlen) {
+        memcpy(&dlen, &hdr[4], 4);
+        if ((!hdr[0]) || (hdr[1] != klen)) continue;
+        if ((fread(k, 1, klen, m_f) != klen) || memcmp(k, key, klen)) continue;
+        /* Mark record as removed */
+        fseek(m_f, pos, SEEK_SET);
+        fwrite(&dead, 1, 1, m_f);
+        m_count--;
+        m_bytes -= klen + dlen;
+        r += klen + dlen;
+    }
+    fflush(m_f);
+    if (r) {
+        skipDead();
+        writeHead();
+    }
+    return r;
+}
+
+void SioFileStore::clear()
+{
+    if (m_f) fclose(m_f);
+    m_f = fopen(m_path.c_str(), "w+b");
+    m_head = SIOQ_FILE_HDR;
+    m_end = SIOQ_FILE_HDR;
+    m_count = 0;
+    m_bytes = 0;
+    if (!m_f) {
+        cl_sioq_error("Unable to create %s", m_path.c_str());
+        return;
+    }
+    fwrite(SIOQ_MAGIC, 1, 4, m_f);
+    fwrite(&m_head, 1, 4, m_f);
+    fflush(m_f);
+}
+
+//==========================================================================================
+// Queue
+//==========================================================================================
+
+/*!
+ * \brief Construct a new SioEmitQueue object.
+ * \param store - backing store (owned by the queue),
+ * \param maxBytes - byte budget (event names + packet data),
+ * \param policy - default drop policy.
+ */
+SioEmitQueue::SioEmitQueue(SioEmitStore* store, uint32_t maxBytes, int policy)
+{
+    m_store = store;
+    m_maxBytes = maxBytes;
+    m_policy = policy;
+    m_dropped = 0;
+    m_lock = xSemaphoreCreateMutex();
+}
+
+SioEmitQueue::~SioEmitQueue()
+{
+    delete m_store;
+    vSemaphoreDelete(m_lock);
+}
+
+/*!
+ * \brief Set drop policy of the event.
+ */
+void SioEmitQueue::setPolicy(const char* key, int policy)
+{
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    m_policies[key] = policy;
+    xSemaphoreGive(m_lock);
+}
+
+int SioEmitQueue::getPolicy(const char* key)
+{
+    auto itr = m_policies.find(key);
+    return (itr != m_policies.end()) ? itr->second : m_policy;
+}
+
+/*!
+ * \brief Queue packet, return 1 when queued, 0 when dropped.
+ */
+int SioEmitQueue::push(const char* key, const char* data, uint32_t len)
+{
+    uint32_t klen = strlen(key), size = klen + len;
+    std::string k, d;
+    uint32_t seq;
+    int policy, r;
+
+    /* Key length is stored in one byte - a cut key would not match in erase() and budget */
+    if ((klen > SIO_QUEUE_KEY_MAX) || (size > m_maxBytes)) {
+        m_dropped++;
+        return 0;
+    }
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    policy = getPolicy(key);
+    if (policy == SIO_KEEP_LATEST) {
+        /* Only the newest value matters */
+        m_store->erase(key);
+    }
+    while (m_store->bytes() + size > m_maxBytes) {
+        if (policy == SIO_DROP_NEWEST) {
+            cl_sioq_debug("Queue full - drop new %s", key);
+            m_dropped++;
+            xSemaphoreGive(m_lock);
+            return 0;
+        }
+        if (!m_store->front(k, d, seq) || !m_store->pop()) break;
+        cl_sioq_debug("Queue full - drop old %s", k.c_str());
+        m_dropped++;
+    }
+    r = m_store->push(key, data, len);
+    if (!r) m_dropped++;
+    xSemaphoreGive(m_lock);
+    return r;
+}
+
+int SioEmitQueue::front(std::string& key, std::string& data, uint32_t& seq)
+{
+    int r;
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    r = m_store->front(key, data, seq);
+    xSemaphoreGive(m_lock);
+    return r;
+}
+
+int SioEmitQueue::pop()
+{
+    int r;
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    r = m_store->pop();
+    xSemaphoreGive(m_lock);
+    return r;
+}
+
+/*!
+ * \brief Remove first record only when it is still the one returned by front().
+ */
+int SioEmitQueue::popIf(uint32_t seq)
+{
+    std::string k, d;
+    uint32_t s;
+    int r = 0;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    if (m_store->front(k, d, s) && (s == seq)) r = m_store->pop();
+    xSemaphoreGive(m_lock);
+    return r;
+}
+
+void SioEmitQueue::clear()
+{
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    m_store->clear();
+    xSemaphoreGive(m_lock);
+}
@@ -0,0 +1,182 @@
+/*
+ * SocketIO outbound (offline) emit queue.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_SIOQUEUE__
+#define __RV_SIOQUEUE__
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <map>
+#include <string>
+
+#define SIO_DROP_OLDEST     (0)    ///< Queue full - remove oldest entries to make room
+#define SIO_DROP_NEWEST     (1)    ///< Queue full - reject the new entry
+#define SIO_KEEP_LATEST     (2)    ///< Keep only the newest entry of the event (drop oldest when still full)
+#define SIO_QUEUE_KEY_MAX   (255)  ///< Longest event name which can be queued (longer ones are dropped)
+
+/*!
+ * \brief Backing store of the emit queue (FIFO of key + packet data records).
+ */
+class SioEmitStore {
+public:
+    virtual ~SioEmitStore() {}
+
+    /*!
+     * \brief Append record at the end of the queue.
+     * \param key - event name,
+     * \param data - packet data,
+     * \param len - packet data size in bytes.
+     */
+    virtual int push(const char* key, const char* data, uint32_t len) = 0;
+
+    /*!
+     * \brief Get first record and its sequence number (0 when empty).
+     *
+     * Sequence numbers grow by one per push (also across clear()), so a record is never
+     * mistaken for another one with the same contents.
+     */
+    virtual int front(std::string& key, std::string& data, uint32_t& seq) = 0;
+
+    /*!
+     * \brief Remove first record.
+     */
+    virtual int pop() = 0;
+
+    /*!
+     * \brief Remove all records of the event, return number of released bytes.
+     */
+    virtual uint32_t erase(const char* key) = 0;
+
+    virtual uint32_t count() const = 0;
+    virtual uint32_t bytes() const = 0;
+    virtual void clear() = 0;
+};
+
+/*!
+ * \brief RAM backed store.
+ */
+class SioRamStore : public SioEmitStore {
+public:
+    int push(const char* key, const char* data, uint32_t len);
+    int front(std::string& key, std::string& data, uint32_t& seq);
+    int pop();
+    uint32_t erase(const char* key);
+    uint32_t count() const { return m_items.size(); }
+    uint32_t bytes() const { return m_bytes; }
+    void clear();
+
+private:
+    struct Item {
+        std::string key;
+        std::string data;
+        uint32_t    seq;
+    };
+    std::deque<Item> m_items;
+    uint32_t         m_bytes = 0;
+    uint32_t         m_seq = 0;     /*!< Sequence number of the next record */
+};
+
+/*!
+ * \brief File backed store (SPIFFS/LittleFS/FAT on flash), survives reboot.
+ *
+ * File layout: "SIQ2" + head offset (u32), then records:
+ * live (u8), key length (u8), reserved (u16), data length (u32), sequence number (u32), key, data.
+ */
+class SioFileStore : public SioEmitStore {
+public:
+    /*!
+     * \brief Open (or create) queue file.
+     * \param path - file path (i.e. "/spiffs/sioq.bin").
+     */
+    SioFileStore(const char* path);
+    ~SioFileStore();
+
+    int push(const char* key, const char* data, uint32_t len);
+    int front(std::string& key, std::string& data, uint32_t& seq);
+    int pop();
+    uint32_t erase(const char* key);
+    uint32_t count() const { return m_count; }
+    uint32_t bytes() const { return m_bytes; }
+    void clear();
+
+    bool isOpen() const { return m_f != NULL; }
+
+private:
+    int  readHeader(uint32_t pos, uint8_t* hdr);
+    void skipDead();
+    void writeHead();
+    void compact();
+
+    std::string m_path;
+    FILE*       m_f;
+    uint32_t    m_head;     /*!< Offset of the first (live) record */
+    uint32_t    m_end;      /*!< File size                         */
+    uint32_t    m_count;
+    uint32_t    m_bytes;
+    uint32_t    m_seq;      /*!< Sequence number of the next record */
+};
+
+/*!
+ * \brief Bounded emit queue (byte budget + per event drop policy).
+ */
+class SioEmitQueue {
+public:
+    /*!
+     * \brief Construct a new SioEmitQueue object.
+     * \param store - backing store (owned by the queue),
+     * \param maxBytes - byte budget (event names + packet data),
+     * \param policy - default drop policy.
+     */
+    SioEmitQueue(SioEmitStore* store, uint32_t maxBytes, int policy = SIO_DROP_OLDEST);
+    ~SioEmitQueue();
+
+    /*!
+     * \brief Queue packet, return 1 when queued, 0 when dropped (also event name longer than
+     * SIO_QUEUE_KEY_MAX).
+     */
+    int push(const char* key, const char* data, uint32_t len);
+
+    /*!
+     * \brief Get first record and its sequence number (0 when empty).
+     */
+    int front(std::string& key, std::string& data, uint32_t& seq);
+    int pop();
+
+    /*!
+     * \brief Remove first record only when it is still the one returned by front() (sent meanwhile
+     * without the lock), return 0 when a push evicted it - the new first record stays.
+     * \param seq - sequence number returned by front().
+     */
+    int popIf(uint32_t seq);
+    void clear();
+
+    /*!
+     * \brief Set drop policy of the event.
+     */
+    void setPolicy(const char* key, int policy);
+    int  getPolicy(const char* key);
+
+    uint32_t count() const { return m_store->count(); }
+    uint32_t bytes() const { return m_store->bytes(); }
+    uint32_t maxBytes() const { return m_maxBytes; }
+    uint32_t dropped() const { return m_dropped; }
+
+private:
+    SioEmitStore*              m_store;
+    uint32_t                   m_maxBytes;
+    int                        m_policy;
+    std::map<std::string, int> m_policies;
+    uint32_t                   m_dropped;
+    SemaphoreHandle_t          m_lock;
+};
+
+#endif
@@ -8,14 +8,19 @@
  * published by the Free Software Foundation.
  */
 #include "socketioclient.h"
+#include "wstrace.h"
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/timers.h>
+#include <esp_timer.h>
+#include <stdlib.h>
 #include <string.h>
 
 static char tag[] = "SIOC";
 
+#define SIO_FR_DEBT         (0x10000)  /* sendPacket() flag: take shaper tokens without waiting (repaid later) */
+
 #ifdef DEBUG
 #define cl_sio_debug(fmt, args...)  ESP_LOGI(tag, fmt, ## args);
 #define cl_sio_info(fmt, args...)   ESP_LOGI(tag, fmt, ## args);
@@ -26,6 +31,32 @@ static char tag[] = "SIOC";
 #define cl_sio_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
 #endif
 
+/*!
+ * \brief Get event name (first string of the JSON array).
+ */
+static void sio_event_name(const char* data, int len, std::string& out)
+{
+    const char* k = data;
+    while ((len > 0) && ((*k == '[') || (*k == ' '))) { k++; len--; }
+    if ((len > 0) && (*k == '"')) { k++; len--; }
+    const char* x = k;
+    while ((len > 0) && (*x != '"') && (*x != ',')) { x++; len--; }
+    out.assign(k, x - k);
+}
+
+/*!
+ * \brief Get last string argument of the JSON array (connection state recovery offset).
+ */
+static void sio_last_string(const char* data, int len, std::string& out)
+{
+    int e = len - 1, b;
+    while ((e > 0) && ((data[e] == ']') || (data[e] == ' '))) e--;
+    if ((e <= 0) || (data[e] != '"')) return;
+    for (b = e - 1; (b > 0) && (data[b] != '"'); b--);
+    if ((b <= 0) || (data[b - 1] != ',' && data[b - 1] != ' ')) return;
+    out.assign(&data[b + 1], e - b - 1);
+}
+
 /*!
  * \brief Construct a new SocketIoClient object.
  * \param url - WebSocket url (http://, https://),
@@ -37,11 +68,52 @@ static char tag[] = "SIOC";
  */
 SocketIoClient::SocketIoClient(const char* url, const char* token, int pingInterval_ms, int maxBufSize, uint8_t pr, BaseType_t coreID)
 {
+    m_queue = NULL;
+    m_flushLock = xSemaphoreCreateMutex();
+    m_joined = false;
+    m_latestCount = 0;
+    m_latestLock = xSemaphoreCreateMutex();
+    m_latestFlush = xSemaphoreCreateMutex();
+    m_shaping = false;
+    ws_bucket_init(&m_bucket, 0, 0, 0);
+    m_shapeLock = xSemaphoreCreateMutex();
+    m_shapeWaiting = 0;
+    m_recover = true;
+    m_recovered = false;
+    m_tPhase = 0;
+    m_ackId = 0;
+    m_ackLock = xSemaphoreCreateMutex();
+    m_rxAck = -1;
+    m_waiters = NULL;
+    m_waitLock = xSemaphoreCreateMutex();
+    m_fragType = -1;
+    m_sinkLock = xSemaphoreCreateMutex();
+    m_binSink = NULL;
+    m_binLeft = 0;
+    m_attFirst = false;
+    m_disp = NULL;
+    m_parser = NULL;
+    m_parserBuf = 0;
+    m_encBuf[0] = m_encBuf[1] = NULL;
+    m_encLock[0] = xSemaphoreCreateMutex();
+    m_encLock[1] = xSemaphoreCreateMutex();
+    m_decBuf = NULL;
+    memset(&m_stats, 0, sizeof(m_stats));
     m_ws = new WebSocketClient(url, token, pingInterval_ms, maxBufSize, pr, coreID);
 
     m_ws->setConnectCB([this](WebSocketClient* ws, bool b) {
+        m_tPhase = esp_timer_get_time();
         if (!b) {
+            m_joined = false;
+            m_fragType = -1;
+            /* Low-memory mode: give back the fragment buffer of the last large message */
+            if (ws->getLowMemory()) std::string().swap(m_frag);
+            /* Attachments of a binary event will not come */
+            if (m_binSink) attachmentDone(WS_SINK_ABORTED);
+            failAcks();
             if (this->m_ccb) this->m_ccb(this, false);
+        } else if (ws->isWebSocketOnly()) {
+            cl_sio_debug("wait for open packet");
         } else {
             cl_sio_debug("send introduce");
             /* Send introduce */
@@ -50,76 +122,441 @@ SocketIoClient::SocketIoClient(const char* url, const char* token, int pingInter
         }
     });
 
+    /* Topic values which would block go out when the link allows */
+    m_ws->setTxReadyCB([this](WebSocketClient*) { flushLatest(); });
+
     m_ws->setCB([this](WebSocketClient* c, char* payload, int length, int type) {
         char eType;
 
+        if ((type == WS_FR_OP_CONT) || (!c->ws_is_fin)) {
+            /* Fragmented message - collect fragments, parse the whole packet */
+            int limit = (c->getEioMaxPayload() > 0) ? c->getEioMaxPayload() : c->getMaxBufLimit();
+            if (type != WS_FR_OP_CONT) {
+                m_fragType = type;
+                m_frag.assign(payload, length);
+            } else if (m_fragType >= 0) {
+                m_frag.append(payload, length);
+            }
+            if ((m_fragType >= 0) && ((int)m_frag.length() > limit)) {
+                cl_sio_error("Fragmented message too long (%d > %d) - dropped", (int)m_frag.length(), limit);
+                m_fragType = -1;
+            }
+            if ((!c->ws_is_fin) || (m_fragType < 0)) return;
+            type = m_fragType;
+            m_fragType = -1;
+            payload = &m_frag[0];
+            length = m_frag.length();
+        }
+        if (type == WS_FR_OP_BIN) {
+            if (m_parser && (m_parser->opcode() == WS_FR_OP_BIN)) {
+                /* Binary encoded packet (Engine.IO v3 prefixes binary messages with 4) */
+                if (c->m_sio_v < 4) {
+                    if ((length < 1) || (payload[0] != 4)) return;
+                    payload++;
+                    length--;
+                }
+                WS_TRACE(WST_PARSE, (SIO_IO_MESSAGE << 8) | 0xFF, length);
+                decodePacket(payload, length);
+                return;
+            }
+            /* Binary attachment (binary events are not supported) */
+            cl_sio_debug("binary attachment ignored (%d)", length);
+            return;
+        }
         if (length < 1) return;
         eType = (char)payload[0];
+        WS_TRACE(WST_PARSE, ((uint8_t)eType << 8) | ((length > 1) ? (uint8_t)payload[1] : 0), length);
 
         switch (eType) {
+            case SIO_IO_OPEN:
+                cl_sio_debug("get open (%d)", length);
+                c->parseOpenPacket(payload + 1, length - 1);
+                if (c->isWebSocketOnly()) {
+                    phaseDone(WS_PHASE_PROBE);
+                    /* No probe on direct WebSocket transport - join namespace right away */
+                    this->sendConnect();
+                }
+                break;
+
             case SIO_IO_PING:
+                c->heartbeat();
                 payload[0] = SIO_IO_PONG;
                 cl_sio_debug("get ping send pong");
-                c->send(payload, length, WS_FR_OP_TXT);
+                c->send(payload, length, WS_FR_OP_TXT | WS_FR_URGENT);
                 break;
 
             case SIO_IO_PONG:
                 cl_sio_debug("get pong");
                 if ((length == 6) && (!strncmp(payload, "3probe", 6))) {
                     cl_sio_debug("WS Connected :-)");
-                    this->send(SIO_MSG_CONNECT, "/", 1);
+                    phaseDone(WS_PHASE_PROBE);
+                    this->sendConnect();
+                } else {
+                    /* Engine.IO v3 heartbeat */
+                    c->heartbeat(true);
                 }
                 break;
-            case SIO_IO_MESSAGE: {
+            case SIO_IO_MESSAGE:
                 if (length < 2) return;
-                char ioType = (char)payload[1];
-                char* data = &payload[2];
-                int lData = length - 2;
-                switch (ioType) {
-                    case SIO_MSG_EVENT:
-                        cl_sio_debug("get event (%d)", lData);
-                        if (this->m_cb) this->m_cb(this, data, lData, ioType);
-                        /* Analize and execute on callbacks */
-                        if (m_on.size()) {
-                            char* k = data, * x;
-                            bool lev = false;
-                            int len = lData;
-                            /* Get first string from array */
-                            while ((len > 0) && ((*k == '[') || (*k == '"') || (*k == ' '))) { if (*k == '"') lev = true; k++;len--; }
-                            x = k + 1;len--;
-                            while ((len > 0) && (*x != '"') && (*x != ',') && ((lev) || (*x != ' '))) { x++; len--; }
-                            std::string key(k, (int)(x - k));
-                            cl_sio_debug("key (%s)", key.c_str());
-                            auto itr = m_on.find(key);
-                            if ((len > 1) && (itr != m_on.end())) {
-                                x++;len--;
-                                x[len - 1] = '\0'; len--;
-                                while ((len > 0) && (*x == ',') && (*x != ' ')) { x++; len--; }
-                                while ((len > 0) && ((x[len - 1] == ']') || (x[len - 1] == ' '))) { x[len - 1] = '\0'; len--; }
-                                if (len > 0) {
-                                    for (; itr != m_on.end(); itr++) {
-                                        itr->second(this, x);
-                                    }
-                                }
-                            }
-                        }
-                        break;
-                    case SIO_MSG_CONNECT:
-                        cl_sio_debug("join (%d)", lData);
-                        if (this->m_ccb) this->m_ccb(this, true);
-                        return;
-                    case SIO_MSG_DISCONNECT:
-                    case SIO_MSG_ACK:
-                    case SIO_MSG_ERROR:
-                    case SIO_MSG_BINARY_EV:
-                    case SIO_MSG_BINARY_ACK:
-                    default:
-                        cl_sio_debug("[wsIOc] Socket.IO Message Type %c (%02X) is not implemented", ioType, ioType);
-                        break;
+                if (m_parser) decodePacket(payload + 1, length - 1);
+                else onPacket(payload[1], &payload[2], length - 2);
+                break;
+        }
+    });
+}
+
+/*!
+ * \brief Socket.IO packet arrived.
+ * \param ioType - packet type (SIO_MSG_xxx),
+ * \param data - packet body (modified),
+ * \param lData - body length.
+ */
+void SocketIoClient::onPacket(char ioType, char* data, int lData)
+{
+    switch (ioType) {
+        case SIO_MSG_EVENT: {
+            cl_sio_debug("get event (%d)", lData);
+            m_stats.events_rx++;
+            /* Server asks for acknowledgement (event id before the array) */
+            m_rxAck = -1;
+            if ((lData > 0) && (*data >= '0') && (*data <= '9')) {
+                m_rxAck = 0;
+                while ((lData > 0) && (*data >= '0') && (*data <= '9')) { m_rxAck = m_rxAck * 10 + (*data - '0'); data++; lData--; }
+            }
+            if (m_pid.length()) {
+                /* Connection state recovery - server appends offset as the last argument */
+                sio_last_string(data, lData, m_offset);
+            }
+            if (m_disp) {
+                /* Handlers run on the worker selected by event name */
+                std::string key;
+                sio_event_name(data, lData, key);
+                WsMsg* m = ws_msg_new(data, lData);
+                if (m) {
+                    m->owner = this;
+                    m->kind = WS_MSG_SIO_EVENT;
+                    m->id = m_rxAck;
+                    m_disp->post(key.c_str(), key.length(), m, &SocketIoClient::dispatchMsg);
                 }
+            } else {
+                dispatchEvent(data, lData);
             }
+            m_rxAck = -1;
+        } break;
+        case SIO_MSG_ACK:
+            cl_sio_debug("get ack (%d)", lData);
+            onAck(data, lData);
+            break;
+        case SIO_MSG_CONNECT: {
+            char pid[64];
+            cl_sio_debug("join (%d)", lData);
+            sio_json_field(data, lData, "pid", pid, sizeof(pid));
+            m_recovered = (pid[0] != '\0') && (m_pid == pid);
+            if (m_pid != pid) m_offset.clear();
+            m_pid = pid;
+            cl_sio_debug("pid = <%s>, recovered = %d", pid, m_recovered ? 1 : 0);
+            phaseDone(WS_PHASE_JOIN);
+            m_stats.joins++;
+            if (m_recovered) m_stats.recovered++;
+            /* Under the lock - wait() either sees the join or is woken below */
+            xSemaphoreTake(m_waitLock, portMAX_DELAY);
+            m_joined = true;
+            xSemaphoreGive(m_waitLock);
+            /* Replay events emitted while offline */
+            flushQueue();
+            flushLatest();
+            if (this->m_ccb) this->m_ccb(this, true);
+            wake(NULL, NULL);
+        } break;
+        case SIO_MSG_BINARY_EV:
+            cl_sio_debug("get binary event (%d)", lData);
+            onBinaryEvent(data, lData);
+            break;
+        case SIO_MSG_DISCONNECT:
+        case SIO_MSG_ERROR:
+        case SIO_MSG_BINARY_ACK:
+        default:
+            cl_sio_debug("[wsIOc] Socket.IO Message Type %c (%02X) is not implemented", ioType, ioType);
+            break;
+    }
+}
+
+/*!
+ * \brief Binary event arrived (attachments follow as binary messages).
+ * \param data - "<attachments>-[<ack id>][...]" (modified),
+ * \param lData - data length.
+ */
+void SocketIoClient::onBinaryEvent(char* data, int lData)
+{
+    std::string key;
+    WsSink* sink = NULL;
+    int n = 0, i = 0, a;
+
+    while ((i < lData) && (data[i] >= '0') && (data[i] <= '9')) n = n * 10 + (data[i++] - '0');
+    if ((i >= lData) || (data[i] != '-') || (n <= 0)) return;
+    data += i + 1;
+    lData -= i + 1;
+    for (a = 0; (a < lData) && (data[a] >= '0') && (data[a] <= '9'); a++);
+    sio_event_name(&data[a], lData - a, key);
+    xSemaphoreTake(m_sinkLock, portMAX_DELAY);
+    for (auto& s : m_sinks) {
+        if (s.event == key) {
+            sink = s.sink;
+            break;
         }
-    });
+    }
+    xSemaphoreGive(m_sinkLock);
+    if (!sink) {
+        /* Attachments are dropped (binary message callback) */
+        cl_sio_debug("binary event %s without sink ignored", key.c_str());
+        return;
+    }
+    if (m_binSink) attachmentDone(WS_SINK_ABORTED);
+    /* Attachments go to the sink straight from the receive buffer, the event waits for them */
+    m_binEvent.assign(data, lData);
+    m_binSink = sink;
+    m_binLeft = n;
+    ws_sink_begin(sink, 0, esp_timer_get_time());
+    ws_sink_init(&m_attSink, [this](const char* d, uint32_t len) {
+        if (m_attFirst) {
+            uint64_t size = m_attSink.expected;
+            if ((m_ws->m_sio_v < 4) && (len > 0)) {
+                /* Engine.IO v3 prefixes binary messages with 4 */
+                d++;
+                len--;
+                if (size) size--;
+            }
+            /* Size of a single attachment in one frame is known */
+            if ((m_binLeft == 1) && (!m_binSink->expected)) m_binSink->expected = size;
+            m_attFirst = false;
+        }
+        return ws_sink_write(m_binSink, d, len, esp_timer_get_time());
+    }, [this](WsSink*, int status) { attachmentDone(status); });
+    m_attFirst = true;
+    m_ws->setSink(&m_attSink);
+}
+
+/*!
+ * \brief Attachment is in the sink (or failed) - wait for the next one or run the event handlers.
+ */
+void SocketIoClient::attachmentDone(int status)
+{
+    WsSink* sink = m_binSink;
+
+    if ((status == WS_SINK_OK) && (--m_binLeft > 0)) {
+        m_attSink.expected = 0;
+        m_attFirst = true;
+        m_ws->setSink(&m_attSink);
+        return;
+    }
+    m_binSink = NULL;
+    m_binLeft = 0;
+    m_ws->setSink(NULL);
+    ws_sink_end(sink, status);
+    if (status != WS_SINK_OK) {
+        m_stats.sink_failures++;
+        return;
+    }
+    m_stats.sink_events++;
+    onPacket(SIO_MSG_EVENT, &m_binEvent[0], m_binEvent.length());
+}
+
+/*!
+ * \brief Stream binary attachments of event into sink (NULL - remove).
+ */
+void SocketIoClient::setSink(const char* event, WsSink* sink)
+{
+    xSemaphoreTake(m_sinkLock, portMAX_DELAY);
+    auto itr = m_sinks.begin();
+    while ((itr != m_sinks.end()) && (itr->event != event)) itr++;
+    if (!sink) {
+        if (itr != m_sinks.end()) m_sinks.erase(itr);
+    } else if (itr == m_sinks.end()) {
+        m_sinks.push_back({ event, sink });
+    } else {
+        itr->sink = sink;
+    }
+    xSemaphoreGive(m_sinkLock);
+}
+
+/*!
+ * \brief Decode packet with the parser (into the decode buffer).
+ */
+void SocketIoClient::decodePacket(const char* in, int len)
+{
+    char type;
+    int n = m_parser->decode(in, len, &type, m_decBuf, m_parserBuf);
+    if (n < 0) {
+        cl_sio_error("Invalid packet (%d) - dropped", len);
+        m_stats.parse_errors++;
+        return;
+    }
+    onPacket(type, m_decBuf, n);
+}
+
+/*!
+ * \brief Call event handlers (on the network task, or on a worker with dispatcher).
+ * \param data - event JSON array (modified),
+ * \param lData - data length.
+ */
+void SocketIoClient::dispatchEvent(char* data, int lData)
+{
+    WS_TRACE_T0(tDisp);
+    int nDisp = 0;
+    if (this->m_cb) { this->m_cb(this, data, lData, SIO_MSG_EVENT); nDisp++; }
+    /* Analize and execute on callbacks */
+    if ((!m_on.empty()) || (!m_onAny.empty()) || m_waiters) {
+        char* k = data, * x;
+        bool lev = false;
+        int len = lData;
+        /* Get first string from array */
+        while ((len > 0) && ((*k == '[') || (*k == '"') || (*k == ' '))) { if (*k == '"') lev = true; k++;len--; }
+        x = k + 1;len--;
+        while ((len > 0) && (*x != '"') && (*x != ',') && ((lev) || (*x != ' '))) { x++; len--; }
+        uint32_t kLen = x - k;
+        cl_sio_debug("key (%.*s)", (int)kLen, k);
+        if (len > 1) {
+            x++;len--;
+            x[len - 1] = '\0'; len--;
+            while ((len > 0) && (*x == ',') && (*x != ' ')) { x++; len--; }
+            while ((len > 0) && ((x[len - 1] == ']') || (x[len - 1] == ' '))) { x[len - 1] = '\0'; len--; }
+            /* Terminate event name (closing quote or comma, already skipped) */
+            k[kLen] = '\0';
+            if (len > 0) {
+                /* Every handler of the event (the snapshot does not change while they run) */
+                if (!m_on.empty()) {
+                    WsHandlerTable<RVSIOON>::Reader r(&m_on);
+                    const WsHandlerTable<RVSIOON>::Entry* e, * eEnd;
+                    for (e = r.find(k, kLen, &eEnd); e && (e != eEnd); e++) {
+                        e->h(this, x);
+                        nDisp++;
+                    }
+                }
+                /* Pattern handlers - catch-all and shortest prefix first, exact name last */
+                if (!m_onAny.empty()) {
+                    WsHandlerTable<RVSIOANY>::Reader r(&m_onAny);
+                    nDisp += r.match(k, kLen, [&](const WsHandlerTable<RVSIOANY>::Entry* e) { e->h(this, k, x); });
+                }
+                /* Tasks waiting for the event */
+                if (m_waiters) wake(k, x);
+            }
+        }
+    }
+    WS_TRACE(WST_DISPATCH, nDisp, WS_TRACE_US(tDisp));
+    (void)nDisp;
+}
+
+/*!
+ * \brief Add waiter, woken once on the next join (event = NULL) or the next event with its name.
+ * \return false - join waiter while joined (not added).
+ */
+bool SocketIoClient::wait(SioWaiter* w)
+{
+    xSemaphoreTake(m_waitLock, portMAX_DELAY);
+    /* Join is set under the lock and wake() runs after it, so no join is missed */
+    if ((!w->event) && m_joined) {
+        xSemaphoreGive(m_waitLock);
+        return false;
+    }
+    /* Append - waiters of one event are woken in order */
+    SioWaiter* head = m_waiters, ** p = &head;
+    while (*p) p = &(*p)->next;
+    w->next = NULL;
+    *p = w;
+    m_waiters = head;
+    xSemaphoreGive(m_waitLock);
+    return true;
+}
+
+/*!
+ * \brief Wake waiters of the join (event = NULL) or of the event.
+ * \param event - event name (NUL terminated),
+ * \param msg - event arguments.
+ */
+void SocketIoClient::wake(const char* event, char* msg)
+{
+    SioWaiter* w, ** p, * head, * run = NULL, ** last = &run;
+
+    /* Take the waiters out first - a resumed task may wait again */
+    xSemaphoreTake(m_waitLock, portMAX_DELAY);
+    head = m_waiters;
+    for (p = &head; (w = *p) != NULL;) {
+        if (event ? (w->event && (!strcmp(w->event, event))) : (!w->event)) {
+            *p = w->next;
+            *last = w;
+            last = &w->next;
+        } else {
+            p = &w->next;
+        }
+    }
+    *last = NULL;
+    m_waiters = head;
+    xSemaphoreGive(m_waitLock);
+    while (run) {
+        w = run;
+        run = w->next;
+        w->msg = msg;
+        w->resume(w);
+    }
+}
+
+/*!
+ * \brief Worker side of the dispatcher.
+ */
+void SocketIoClient::dispatchMsg(WsMsg* m)
+{
+    SocketIoClient* c = (SocketIoClient*)m->owner;
+
+    switch (m->kind) {
+        case WS_MSG_SIO_EVENT:
+            c->dispatchEvent(m->data, m->len);
+            break;
+        case WS_MSG_SIO_ACK: {
+            RVSIOACK* cb = (RVSIOACK*)m->user;
+            if (m->id < 0) (*cb)(c, NULL, 0);
+            else (*cb)(c, m->data, m->len);
+        } break;
+        default: break;
+    }
+}
+
+/*!
+ * \brief Run ack callback (on a worker with dispatcher).
+ * \param cb - callback,
+ * \param data - ack arguments (NULL - connection lost),
+ * \param len - arguments length.
+ */
+void SocketIoClient::callAck(RVSIOACK& cb, const char* data, int len)
+{
+    if (!m_disp) {
+        cb(this, data, len);
+        return;
+    }
+    if (!data) len = 0;
+    /* Callback is stored in the message, after the arguments */
+    WsMsg* m = ws_msg_alloc(len + 1 + alignof(RVSIOACK) + sizeof(RVSIOACK));
+    if (!m) return;
+    if (len) memcpy(m->data, data, len);
+    m->data[len] = '\0';
+    m->len = len;
+    m->owner = this;
+    m->kind = WS_MSG_SIO_ACK;
+    m->id = data ? 0 : -1;
+    uintptr_t cbp = ((uintptr_t)&m->data[len + 1] + alignof(RVSIOACK) - 1) & ~(uintptr_t)(alignof(RVSIOACK) - 1);
+    m->user = new ((void*)cbp) RVSIOACK(cb);
+    m->release = [](WsMsg* m) { ((RVSIOACK*)m->user)->~RVSIOACK(); };
+    /* Acks keep their order on one worker */
+    m_disp->post("", 0, m, &SocketIoClient::dispatchMsg);
+}
+
+/*!
+ * \brief Ack id requested by the server for the event being dispatched (-1 none).
+ */
+int SocketIoClient::ackId() const
+{
+    WsMsg* m = m_disp ? m_disp->current() : NULL;
+    if (m) return m->id;
+    return m_rxAck;
 }
 
 /*!
@@ -128,8 +565,339 @@ SocketIoClient::SocketIoClient(const char* url, const char* token, int pingInter
 SocketIoClient::~SocketIoClient()
 {
     if (m_ws) delete m_ws;
+    if (m_queue) delete m_queue;
+    vSemaphoreDelete(m_flushLock);
+    vSemaphoreDelete(m_latestLock);
+    vSemaphoreDelete(m_latestFlush);
+    vSemaphoreDelete(m_shapeLock);
+    vSemaphoreDelete(m_ackLock);
+    vSemaphoreDelete(m_waitLock);
+    vSemaphoreDelete(m_sinkLock);
+    vSemaphoreDelete(m_encLock[0]);
+    vSemaphoreDelete(m_encLock[1]);
+    free(m_encBuf[0]);
+    free(m_encBuf[1]);
+    free(m_decBuf);
 }
 
+/*!
+ * \brief Set packet encoding (NULL - default text encoding), set before start().
+ * \param p - parser (SioMsgPackParser, ...), not owned,
+ * \param bufSize - size of encode/decode buffers = maximum packet size (0 - 2x RX/TX buffer size).
+ */
+void SocketIoClient::setParser(SioParser* p, uint32_t bufSize)
+{
+    free(m_encBuf[0]);
+    free(m_encBuf[1]);
+    free(m_decBuf);
+    m_encBuf[0] = m_encBuf[1] = m_decBuf = NULL;
+    m_parser = NULL;
+    if (!p) return;
+    if (!bufSize) bufSize = 2 * m_ws->m_txBuf;
+    /* Buffers are allocated once - packets are encoded/decoded without heap allocation */
+    m_encBuf[0] = (char*)malloc(bufSize);
+    m_encBuf[1] = (char*)malloc(bufSize);
+    m_decBuf = (char*)malloc(bufSize);
+    if ((!m_encBuf[0]) || (!m_encBuf[1]) || (!m_decBuf)) {
+        cl_sio_error("Unable to allocate parser buffers (%u)", bufSize);
+        return;
+    }
+    m_parserBuf = bufSize;
+    m_parser = p;
+}
+
+/*!
+ * \brief Hold emits in a bounded queue while disconnected, replay them in order after (re)connect.
+ * \param store - backing store (SioRamStore, SioFileStore, ...) owned by the client,
+ * \param maxBytes - byte budget (event names + packet data),
+ * \param policy - default drop policy (SIO_DROP_OLDEST, SIO_DROP_NEWEST, SIO_KEEP_LATEST).
+ */
+void SocketIoClient::setOfflineQueue(SioEmitStore* store, uint32_t maxBytes, int policy)
+{
+    if (m_queue) delete m_queue;
+    m_queue = (store) ? new SioEmitQueue(store, maxBytes, policy) : NULL;
+}
+
+/*!
+ * \brief Join namespace (with pid/offset when the previous session may be recovered).
+ */
+int SocketIoClient::sendConnect()
+{
+    if (m_recover && m_pid.length()) {
+        std::string auth = "{\"pid\":\"" + m_pid + "\"";
+        if (m_offset.length()) auth += ",\"offset\":\"" + m_offset + "\"";
+        auth += "}";
+        cl_sio_debug("recover session (%s)", auth.c_str());
+        return sendPacket(SIO_MSG_CONNECT, auth.c_str(), auth.length());
+    }
+    return sendPacket(SIO_MSG_CONNECT, "/", 1);
+}
+
+/*!
+ * \brief Send queued events (in order) while joined.
+ * \return number of sent events.
+ */
+int SocketIoClient::flushQueue()
+{
+    std::string key, data;
+    uint32_t seq;
+    int n = 0;
+
+    if (!m_queue) return 0;
+    /* One flusher at a time, recheck after release so nothing is left behind */
+    while (m_joined && m_queue->count() && (xSemaphoreTake(m_flushLock, 0) == pdTRUE)) {
+        bool ok = true;
+        while (m_joined && m_queue->front(key, data, seq)) {
+            /* Network task must not sleep on the shaper - replay repays the tokens later */
+            if (!sendPacket(SIO_MSG_EVENT, data.c_str(), data.length(), SIO_FR_DEBT)) { ok = false; break; }
+            /* emit() may have dropped the sent record meanwhile - never remove the next one unsent */
+            m_queue->popIf(seq);
+            m_stats.replayed++;
+            n++;
+        }
+        xSemaphoreGive(m_flushLock);
+        if (!ok) break;
+    }
+    if (n) {
+        cl_sio_debug("replayed %d events", n);
+    }
+    return n;
+}
+
+/*!
+ * \brief Send waiting topic values (in order) without waiting for the link, values which
+ * would block stay for the next try.
+ * \return number of sent values.
+ */
+int SocketIoClient::flushLatest()
+{
+    std::string frame;
+    int n = 0, r = 1;
+
+    /* One flusher at a time, recheck after release so nothing is left behind */
+    while ((r != WS_WOULD_BLOCK) && m_joined && m_latestCount && (xSemaphoreTake(m_latestFlush, 0) == pdTRUE)) {
+        while (m_joined) {
+            /* Only the flusher removes entries - the front stays in place while it is sent */
+            xSemaphoreTake(m_latestLock, portMAX_DELAY);
+            if (m_latest.empty()) {
+                xSemaphoreGive(m_latestLock);
+                break;
+            }
+            frame.clear();
+            frame.swap(m_latest.front().frame);
+            xSemaphoreGive(m_latestLock);
+            r = sendPacket(SIO_MSG_EVENT, frame.data(), frame.length(), WS_FR_NOWAIT);
+            xSemaphoreTake(m_latestLock, portMAX_DELAY);
+            SioLatest& s = m_latest.front();
+            if (r != WS_WOULD_BLOCK) {
+                /* Sent (or failed for good) - a newer value which arrived meanwhile stays */
+                if (s.frame.empty()) m_latest.pop_front();
+                if (r > 0) n++;
+            } else if (s.frame.empty()) {
+                s.frame.swap(frame);
+            } else {
+                m_stats.conflated++;
+            }
+            m_latestCount = m_latest.size();
+            xSemaphoreGive(m_latestLock);
+            if (r == WS_WOULD_BLOCK) break;
+        }
+        xSemaphoreGive(m_latestFlush);
+    }
+    /* Link busy - network task retries */
+    m_ws->setTxWanted(m_joined && m_latestCount);
+    return n;
+}
+
+
+/*!
+ * \brief Send SocketIO packet (no queueing).
+ * \param type - message type.
+ * \param payload - pointer to message data,
+ * \param length - message size in bytes,
+ * \param flags - WebSocket send flags (WS_FR_URGENT).
+ */
+int SocketIoClient::sendPacket(char type, const char* payload, uint32_t length, int flags)
+{
+    int r;
+
+    if ((type == SIO_MSG_EVENT) && m_shaping) {
+        r = shape(payload, length, flags);
+        if (r != 1) return r;
+    }
+    flags &= ~SIO_FR_DEBT;
+    if (m_parser) {
+        /* Urgent packets do not wait for the encode buffer of a bulk send */
+        int lane = (flags & WS_FR_URGENT) ? 1 : 0;
+        if (xSemaphoreTake(m_encLock[lane], (flags & WS_FR_NOWAIT) ? 0 : portMAX_DELAY) != pdTRUE) return WS_WOULD_BLOCK;
+        int n = m_parser->encode(type, payload, length, m_encBuf[lane], m_parserBuf);
+        if (n < 0) {
+            xSemaphoreGive(m_encLock[lane]);
+            cl_sio_error("Unable to encode packet %c (%u)", type, length);
+            m_stats.parse_errors++;
+            return 0;
+        }
+        if (m_parser->opcode() == WS_FR_OP_TXT) {
+            r = m_ws->send2("4", 1, m_encBuf[lane], n, WS_FR_OP_TXT | flags);
+        } else if (m_ws->m_sio_v < 4) {
+            r = m_ws->send2("\x04", 1, m_encBuf[lane], n, WS_FR_OP_BIN | flags);
+        } else {
+            r = m_ws->send2(m_encBuf[lane], n, NULL, 0, WS_FR_OP_BIN | flags);
+        }
+        xSemaphoreGive(m_encLock[lane]);
+    } else {
+        uint8_t buf[2] = { SIO_IO_MESSAGE, (uint8_t)type };
+        r = m_ws->send2((const char*)buf, 2, payload, length, WS_FR_OP_TXT | flags);
+    }
+    if ((r > 0) && (type == SIO_MSG_EVENT)) m_stats.events_tx++;
+    return r;
+}
+
+/*!
+ * \brief Take rate shaper tokens for an event packet, wait for them when needed.
+ * \param payload - packet data ([ack id]JSON array),
+ * \param length - packet data size in bytes,
+ * \param flags - WS_FR_NOWAIT (do not wait), WS_FR_URGENT/SIO_FR_DEBT (take with debt).
+ * \return 1 - send, WS_WOULD_BLOCK - no tokens (WS_FR_NOWAIT).
+ */
+int SocketIoClient::shape(const char* payload, uint32_t length, int flags)
+{
+    std::string key;
+    int64_t now, t0 = 0;
+    uint32_t w, we, a;
+
+    /* Event name (after ack id - digits of the name itself stay) */
+    for (a = 0; (a < length) && (payload[a] >= '0') && (payload[a] <= '9'); a++);
+    sio_event_name(&payload[a], length - a, key);
+    while (true) {
+        WsTokenBucket* e = NULL;
+        xSemaphoreTake(m_shapeLock, portMAX_DELAY);
+        now = esp_timer_get_time();
+        for (auto& s : m_eventBuckets) {
+            if (s.event == key) { e = &s.b; break; }
+        }
+        w = ws_bucket_wait(&m_bucket, length, now);
+        we = e ? ws_bucket_wait(e, length, now) : 0;
+        if (we > w) w = we;
+        if ((w == 0) || (flags & (WS_FR_URGENT | SIO_FR_DEBT)) || (t0 && (!m_joined))) {
+            ws_bucket_take(&m_bucket, length);
+            if (e) ws_bucket_take(e, length);
+            xSemaphoreGive(m_shapeLock);
+            break;
+        }
+        xSemaphoreGive(m_shapeLock);
+        if (flags & WS_FR_NOWAIT) {
+            m_stats.shaped_would_block++;
+            return WS_WOULD_BLOCK;
+        }
+        if (!t0) {
+            /* Waiting for tokens counts as buffered */
+            t0 = now;
+            m_stats.shaped++;
+            m_shapeWaiting += length;
+        }
+        vTaskDelay(w / 1000 / portTICK_PERIOD_MS + 1);
+    }
+    if (t0) {
+        m_shapeWaiting -= length;
+        m_stats.shaped_wait_us += now - t0;
+    }
+    return 1;
+}
+
+/*!
+ * \brief Shape outgoing events with a token bucket (rate = 0 - off).
+ * \param rate - bytes per second,
+ * \param burst - bucket size in bytes.
+ */
+void SocketIoClient::setRateLimit(uint32_t rate, uint32_t burst)
+{
+    xSemaphoreTake(m_shapeLock, portMAX_DELAY);
+    ws_bucket_init(&m_bucket, rate, burst, esp_timer_get_time());
+    m_shaping = (rate > 0) || (!m_eventBuckets.empty());
+    xSemaphoreGive(m_shapeLock);
+}
+
+/*!
+ * \brief Shape one event (in addition to the client limit, rate = 0 - remove).
+ */
+void SocketIoClient::setRateLimit(const char* event, uint32_t rate, uint32_t burst)
+{
+    xSemaphoreTake(m_shapeLock, portMAX_DELAY);
+    auto itr = m_eventBuckets.begin();
+    while ((itr != m_eventBuckets.end()) && (itr->event != event)) itr++;
+    if (rate == 0) {
+        if (itr != m_eventBuckets.end()) m_eventBuckets.erase(itr);
+    } else {
+        if (itr == m_eventBuckets.end()) itr = m_eventBuckets.insert(itr, { event, WsTokenBucket() });
+        ws_bucket_init(&itr->b, rate, burst, esp_timer_get_time());
+    }
+    m_shaping = (m_bucket.rate > 0) || (!m_eventBuckets.empty());
+    xSemaphoreGive(m_shapeLock);
+}
+
+/*!
+ * \brief Connection phase finished - store its duration, start the next one.
+ */
+void SocketIoClient::phaseDone(int phase)
+{
+    int64_t t = esp_timer_get_time();
+    m_ws->m_stats.handshake_us[phase] = t - m_tPhase;
+    m_ws->m_stats.handshake_total_us += t - m_tPhase;
+    WS_TRACE(WST_PHASE, phase, t - m_tPhase);
+    m_tPhase = t;
+}
+
+/*!
+ * \brief Get snapshot of performance counters.
+ */
+void SocketIoClient::getStats(SocketIoStats* s) const
+{
+    memcpy(s, &m_stats, sizeof(SocketIoStats));
+    m_ws->getStats(&s->ws);
+    if (m_queue) s->queue_dropped = m_queue->dropped();
+}
+
+/*!
+ * \brief Clear performance counters.
+ */
+void SocketIoClient::resetStats()
+{
+    memset(&m_stats, 0, sizeof(SocketIoStats));
+    m_ws->resetStats();
+}
+
+/*!
+ * \brief Get current and peak memory footprint (SocketIO + WebSocket).
+ */
+void SocketIoClient::getMemStats(WsMemStats* m) const
+{
+    uint32_t own = sizeof(SocketIoClient) + 3 * m_parserBuf;
+
+    m_ws->getMemStats(m);
+    m->fixed += own;
+    m->total += own;
+    m->total_peak += own;
+}
+
+/*!
+ * \brief Send event, or queue it while offline (or while older events wait in the queue).
+ * \param key - event name,
+ * \param frame - event packet data (JSON array),
+ * \param length - packet data size in bytes.
+ */
+int SocketIoClient::emit(const char* key, const char* frame, uint32_t length)
+{
+    int r;
+
+    if ((!m_queue) || (m_joined && (!m_queue->count()))) {
+        return sendPacket(SIO_MSG_EVENT, frame, length);
+    }
+    r = m_queue->push(key, frame, length);
+    if (r) m_stats.queued++;
+    if (m_joined) flushQueue();
+    return r;
+}
 
 /*!
  * \brief Send SocketIO frame.
@@ -139,11 +907,15 @@ SocketIoClient::~SocketIoClient()
  */
 int SocketIoClient::send(char type, const char* payload, uint32_t length)
 {
-    uint8_t buf[2] = { SIO_IO_MESSAGE, type };
     if (length == 0) {
         length = strlen((const char*)payload);
     }
-    return m_ws->send2((const char*)buf, 2, payload, length, WS_FR_OP_TXT);
+    if ((type == SIO_MSG_EVENT) && (m_queue)) {
+        std::string key;
+        sio_event_name(payload, length, key);
+        return emit(key.c_str(), payload, length);
+    }
+    return sendPacket(type, payload, length);
 }
 
 /*!
@@ -154,7 +926,151 @@ int SocketIoClient::send(char type, const char* payload, uint32_t length)
 int SocketIoClient::send(const char* key, const char* val)
 {
     std::string frame = "[\"" + std::string(key) + "\"," + std::string(val) + "]";
-    uint8_t buf[2] = { SIO_IO_MESSAGE, SIO_MSG_EVENT };
-    return m_ws->send2((const char*)buf, 2, frame.c_str(), frame.length(), WS_FR_OP_TXT);
+    return emit(key, frame.c_str(), frame.length());
+}
+
+/*!
+ * \brief Send SocketIO event on the urgent lane (before waiting bulk messages, not queued while joined).
+ * \param key - message key.
+ * \param val - message value,
+ */
+int SocketIoClient::sendUrgent(const char* key, const char* val)
+{
+    std::string frame = "[\"" + std::string(key) + "\"," + std::string(val) + "]";
+    if (!m_joined) return emit(key, frame.c_str(), frame.length());
+    return sendPacket(SIO_MSG_EVENT, frame.c_str(), frame.length(), WS_FR_URGENT);
+}
+
+/*!
+ * \brief Send SocketIO event without waiting (queued instead while offline, when the offline queue is set).
+ * \param key - message key.
+ * \param val - message value,
+ * \return 1 - sent, WS_WOULD_BLOCK - try again later (drop or downsample), <= 0 - error.
+ */
+int SocketIoClient::trySend(const char* key, const char* val)
+{
+    std::string frame = "[\"" + std::string(key) + "\"," + std::string(val) + "]";
+    if ((m_queue) && ((!m_joined) || m_queue->count())) return emit(key, frame.c_str(), frame.length());
+    return sendPacket(SIO_MSG_EVENT, frame.c_str(), frame.length(), WS_FR_NOWAIT);
+}
+
+/*!
+ * \brief Send the newest value of a state topic without waiting (see header).
+ * \param key - message key (event name),
+ * \param val - message value,
+ * \param sub - optional topic key within the event (NULL - event name only).
+ */
+int SocketIoClient::sendLatest(const char* key, const char* val, const char* sub)
+{
+    std::string frame = "[\"" + std::string(key) + "\"," + std::string(val) + "]";
+    std::string topic(key);
+    int r;
+
+    if (m_joined && (!m_latestCount)) {
+        /* Nothing waits - try the wire first */
+        r = sendPacket(SIO_MSG_EVENT, frame.c_str(), frame.length(), WS_FR_NOWAIT);
+        if (r != WS_WOULD_BLOCK) return r;
+    }
+    if (sub) {
+        topic += '\0';
+        topic += sub;
+    }
+    xSemaphoreTake(m_latestLock, portMAX_DELAY);
+    for (r = 0; r < (int)m_latest.size(); r++) {
+        if (m_latest[r].topic == topic) break;
+    }
+    if (r < (int)m_latest.size()) {
+        /* Replace in place (empty - the older value is being sent) */
+        if (!m_latest[r].frame.empty()) m_stats.conflated++;
+        m_latest[r].frame.swap(frame);
+    } else {
+        m_latest.push_back({ topic, frame });
+    }
+    m_latestCount = m_latest.size();
+    xSemaphoreGive(m_latestLock);
+    flushLatest();
+    return 1;
 }
 
+/*!
+ * \brief Send SocketIO event and wait for server acknowledgement.
+ * \param key - message key,
+ * \param val - message value,
+ * \param cb - called with ack arguments (JSON array), or with NULL when connection is lost.
+ * \return 0 when not joined or send failed (cb is not called).
+ */
+int SocketIoClient::sendWithAck(const char* key, const char* val, RVSIOACK cb)
+{
+    uint32_t id;
+    int r;
+
+    if (!m_joined) return 0;
+    xSemaphoreTake(m_ackLock, portMAX_DELAY);
+    id = m_ackId++;
+    m_acks[id] = { cb, esp_timer_get_time() };
+    xSemaphoreGive(m_ackLock);
+    std::string frame = std::to_string(id) + "[\"" + std::string(key) + "\"," + std::string(val) + "]";
+    r = sendPacket(SIO_MSG_EVENT, frame.c_str(), frame.length());
+    if (r <= 0) {
+        xSemaphoreTake(m_ackLock, portMAX_DELAY);
+        /* Connection lost meanwhile - failAcks() took the ack and calls cb with NULL */
+        if (m_acks.erase(id) == 0) r = 1;
+        xSemaphoreGive(m_ackLock);
+    }
+    return r;
+}
+
+/*!
+ * \brief Answer server event acknowledgement request.
+ * \param id - ack id (from ackId()),
+ * \param val - ack arguments (JSON values, without brackets).
+ */
+int SocketIoClient::sendAck(int id, const char* val)
+{
+    std::string frame = std::to_string(id) + "[" + std::string(val) + "]";
+    return sendPacket(SIO_MSG_ACK, frame.c_str(), frame.length());
+}
+
+/*!
+ * \brief Acknowledgement arrived ("<id>[args]").
+ */
+void SocketIoClient::onAck(char* data, int len)
+{
+    uint32_t id = 0;
+    RVSIOACK cb;
+    int64_t t0 = 0;
+    bool found = false;
+
+    if ((len < 1) || (*data < '0') || (*data > '9')) return;
+    while ((len > 0) && (*data >= '0') && (*data <= '9')) { id = id * 10 + (*data - '0'); data++; len--; }
+    xSemaphoreTake(m_ackLock, portMAX_DELAY);
+    auto itr = m_acks.find(id);
+    if (itr != m_acks.end()) {
+        cb = itr->second.cb;
+        t0 = itr->second.t0;
+        m_acks.erase(itr);
+        found = true;
+    }
+    xSemaphoreGive(m_ackLock);
+    if (!found) {
+        cl_sio_debug("unknown ack %u", id);
+        return;
+    }
+    m_ws->rttSample(WS_RTT_ACK, (uint32_t)(esp_timer_get_time() - t0));
+    if (cb) callAck(cb, data, len);
+}
+
+/*!
+ * \brief Connection lost - acks will never arrive.
+ */
+void SocketIoClient::failAcks()
+{
+    std::map<uint32_t, SioAck> l;
+
+    xSemaphoreTake(m_ackLock, portMAX_DELAY);
+    l.swap(m_acks);
+    xSemaphoreGive(m_ackLock);
+    for (auto& a : l) {
+        if (a.second.cb) callAck(a.second.cb, NULL, 0);
+    }
+}
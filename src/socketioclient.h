@@ -10,17 +10,29 @@
 #ifndef __RV_SOCKETIOCLIENT__
 #define __RV_SOCKETIOCLIENT__
 
-#include <functional>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/timers.h>
 #include "websocketclient.h"
+#include "sioqueue.h"
+#include "wsdispatch.h"
+#include "sioparser.h"
+#include "wsdelegate.h"
+#include "wsshaper.h"
+#include <atomic>
+#include <deque>
 #include <map>
 #include <string>
-#include <list>
 
 class SocketIoClient;
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define SIO_COROUTINES                     ///< C++20 coroutine API available (sioco.h)
+class SioJoinAwait;
+class SioEventAwait;
+class SioAckAwait;
+#endif
+
 #define SIO_IO_OPEN         '0'    ///< Sent from the server when a new transport is opened (recheck)
 #define SIO_IO_CLOSE        '1'    ///< Request the close of this transport but does not shutdown the connection itself.
 #define SIO_IO_PING         '2'    ///< Sent by the client. Server should answer with a pong packet containing the same data
@@ -37,16 +49,22 @@ class SocketIoClient;
 #define SIO_MSG_BINARY_EV   '5'
 #define SIO_MSG_BINARY_ACK  '6'
 
-typedef std::function<void(SocketIoClient* c, const char* msg, int len, int type)> RVSIOCB;
-typedef std::function<void(SocketIoClient* c, bool connected)> RVSIOConnectedCB;
-typedef std::function<void(SocketIoClient* c, char* msg)> RVSIOON;
+typedef WsDelegate<void(SocketIoClient* c, const char* msg, int len, int type)> RVSIOCB;
+typedef WsDelegate<void(SocketIoClient* c, bool connected)> RVSIOConnectedCB;
+typedef WsDelegate<void(SocketIoClient* c, char* msg)> RVSIOON;
+typedef WsDelegate<void(SocketIoClient* c, const char* event, char* msg)> RVSIOANY;
+typedef WsDelegate<void(SocketIoClient* c, const char* msg, int len)> RVSIOACK;
 
-template<typename T, typename... U>
-size_t getAddress(std::function<T(U...)> f) {
-    typedef T(fnType)(U...);
-    fnType** fnPointer = f.template target<fnType*>();
-    return (size_t)*fnPointer;
-}
+/*!
+ * \brief Task waiting for the namespace join or for an event (lives in the waiting coroutine frame).
+ */
+struct SioWaiter {
+    SioWaiter*  next;
+    const char* event;                     /*!< Event name (NULL - join)              */
+    char*       msg;                       /*!< Event arguments (set before resume)   */
+    void      (*resume)(SioWaiter* w);     /*!< Continue the waiting task             */
+    void*       h;                         /*!< Coroutine handle address              */
+};
 
 
 class SocketIoClient {
@@ -78,6 +96,155 @@ public:
      */
     int send(const char* key, const char* val);
 
+    /*!
+     * \brief Send SocketIO event on the urgent lane (before waiting bulk messages, not queued while joined).
+     * \param key - message key.
+     * \param val - message value,
+     */
+    int sendUrgent(const char* key, const char* val);
+
+    /*!
+     * \brief Send SocketIO event without waiting (queued instead while offline, when the offline queue is set).
+     * \param key - message key.
+     * \param val - message value,
+     * \return 1 - sent, WS_WOULD_BLOCK - try again later (drop or downsample), <= 0 - error.
+     */
+    int trySend(const char* key, const char* val);
+
+    /*!
+     * \brief Send the newest value of a state topic (position, temperature) without waiting.
+     * A value of the topic which is not sent yet is replaced in place, so at most one value per
+     * topic waits for the link (also while disconnected - sent after join).
+     * \param key - message key (event name),
+     * \param val - message value,
+     * \param sub - optional topic key within the event (i.e. sensor id, NULL - event name only),
+     * \return 1 - sent or waiting, <= 0 - error.
+     */
+    int sendLatest(const char* key, const char* val, const char* sub = NULL);
+
+    /*!
+     * \brief Topics with a value waiting to be sent (sendLatest).
+     */
+    uint32_t latestPending() const { return m_latestCount; }
+
+    /*!
+     * \brief Bytes waiting to be sent (WebSocket TX, rate shaper and offline queue).
+     */
+    uint32_t getBufferedAmount() const { return m_ws->getBufferedAmount() + m_shapeWaiting + (m_queue ? m_queue->bytes() : 0); }
+
+    /*!
+     * \brief Shape outgoing events with a token bucket (rate = 0 - off).
+     * Blocking sends wait for tokens, trySend()/sendLatest() get WS_WOULD_BLOCK, urgent events
+     * and the offline queue replay go out at once and repay the tokens from later events.
+     * \param rate - bytes per second,
+     * \param burst - bucket size in bytes (sent at full speed after an idle period).
+     */
+    void setRateLimit(uint32_t rate, uint32_t burst);
+
+    /*!
+     * \brief Shape one event (in addition to the client limit, rate = 0 - remove).
+     */
+    void setRateLimit(const char* event, uint32_t rate, uint32_t burst);
+
+    /*!
+     * \brief Stream binary attachments of event into sink (NULL - remove).
+     *
+     * Attachments of a binary event with this name (451-["ota",{...},{"_placeholder":true,"num":0}])
+     * go to the sink one after another as they arrive, without collecting them in memory. Event
+     * handlers run after the last attachment, sink->status tells the result. Default encoding only.
+     */
+    void setSink(const char* event, WsSink* sink);
+
+    /*!
+     * \brief Send SocketIO event and wait for server acknowledgement.
+     * \param key - message key,
+     * \param val - message value,
+     * \param cb - called with ack arguments (JSON array), or with NULL when connection is lost.
+     * \return 0 when not joined or send failed (cb is not called).
+     */
+    int sendWithAck(const char* key, const char* val, RVSIOACK cb);
+
+    /*!
+     * \brief Ack id requested by the server for the event being dispatched (-1 none).
+     */
+    int ackId() const;
+
+    /*!
+     * \brief Answer server event acknowledgement request.
+     * \param id - ack id (from ackId()),
+     * \param val - ack arguments (JSON values, without brackets).
+     */
+    int sendAck(int id, const char* val);
+
+    /*!
+     * \brief Hold emits in a bounded queue while disconnected, replay them in order after (re)connect.
+     * \param store - backing store (SioRamStore, SioFileStore, ...) owned by the client,
+     * \param maxBytes - byte budget (event names + packet data),
+     * \param policy - default drop policy (SIO_DROP_OLDEST, SIO_DROP_NEWEST, SIO_KEEP_LATEST).
+     */
+    void setOfflineQueue(SioEmitStore* store, uint32_t maxBytes, int policy = SIO_DROP_OLDEST);
+
+    /*!
+     * \brief Set drop policy of the event (offline queue).
+     */
+    void setDropPolicy(const char* event, int policy) { if (m_queue) m_queue->setPolicy(event, policy); }
+
+    SioEmitQueue* getQueue() const { return m_queue; }
+
+    /*!
+     * \brief Socket.IO v4 connection state recovery (send pid/offset on reconnect, default on).
+     */
+    void setConnectionStateRecovery(bool b) { m_recover = b; }
+
+    /*!
+     * \brief Namespace joined (events can be sent).
+     */
+    bool isJoined() const { return m_joined; }
+
+    /*!
+     * \brief Add waiter, woken once on the next join (event = NULL) or the next event with its name.
+     * Waiters run on the task which dispatches events (network task or dispatcher worker).
+     * \return false - join waiter while joined (not added).
+     */
+    bool wait(SioWaiter* w);
+
+#ifdef SIO_COROUTINES
+    /*!
+     * \brief co_await client.connected() - continue when the namespace is joined.
+     */
+    SioJoinAwait connected();
+
+    /*!
+     * \brief co_await client.emitWithAck(key, val) - send event, continue with the ack arguments.
+     */
+    SioAckAwait emitWithAck(const char* key, const char* val);
+
+    /*!
+     * \brief co_await client.next(event) - continue with the arguments of the next event (name must stay valid).
+     */
+    SioEventAwait next(const char* event);
+#endif
+
+    /*!
+     * \brief Last join recovered the previous session (missed events are resent by the server).
+     */
+    bool isRecovered() const { return m_recovered; }
+
+    /*!
+     * \brief Get snapshot of performance counters (SocketIO + WebSocket).
+     */
+    void getStats(SocketIoStats* s) const;
+
+    /*!
+     * \brief Clear performance counters.
+     */
+    void resetStats();
+
+    /*!
+     * \brief Get current and peak memory footprint (SocketIO + WebSocket).
+     */
+    void getMemStats(WsMemStats* m) const;
+
     /*!
      * \brief Set on message callback.
      */
@@ -88,34 +255,157 @@ public:
      */
     void setConnectCB(RVSIOConnectedCB ccb) { m_ccb = ccb; }
 
+    /*!
+     * \brief Run event handlers and ack callbacks on dispatcher workers instead of the network task
+     * (NULL - network task). Dispatcher is not owned, set before start().
+     */
+    void setDispatcher(WsDispatcher* d) { m_disp = d; }
+
+    /*!
+     * \brief Set packet encoding (NULL - default text encoding), set before start().
+     * \param p - parser (SioMsgPackParser, ...), not owned,
+     * \param bufSize - size of encode/decode buffers = maximum packet size (0 - 2x RX/TX buffer size).
+     */
+    void setParser(SioParser* p, uint32_t bufSize = 0);
+
     void start() { m_ws->start(); }
 
+    /*!
+     * \brief Connect with WebSocket transport directly (skip HTTP long-polling and probe).
+     */
+    void setWebSocketOnly(bool b) { m_ws->setWebSocketOnly(b); }
+    bool isWebSocketOnly() const { return m_ws->isWebSocketOnly(); }
+
+    /*!
+     * \brief Add event handler (events may have many handlers, safe while running).
+     */
     void on(std::string what, RVSIOON cb) {
-        m_on.insert({ what, cb });
+        m_on.add(what.c_str(), what.length(), cb, false);
     }
 
+    /*!
+     * \brief Remove all handlers of event (safe while running).
+     */
     void off(std::string what) {
-        std::multimap<std::string, RVSIOON>::iterator itr;
-        std::list<std::multimap<std::string, RVSIOON>::iterator> l;
-        for (itr = m_on.find(what); itr != m_on.end(); itr++) {
-            // if (getAddress(itr->second) == getAddress(cb)) {
-            l.push_back(itr);
-            // }
-        }
-        for (auto i = l.begin(); i != l.end(); i++) {
-            m_on.erase(*i);
-        }
+        m_on.remove(what.c_str(), what.length());
     }
 
+    /*!
+     * \brief Add handler of events matching pattern: ending with '*' - events starting with the
+     *        part before it (prefix), "*" - every event, other - exact name. The handler gets the event name.
+     */
+    void onMatch(std::string pattern, RVSIOANY cb) {
+        bool prefix = pattern.length() && (pattern[pattern.length() - 1] == '*');
+        m_onAny.add(pattern.c_str(), pattern.length() - (prefix ? 1 : 0), cb, false, prefix);
+    }
+
+    /*!
+     * \brief Add handler of every event (same as onMatch("*")).
+     */
+    void onAny(RVSIOANY cb) { onMatch("*", cb); }
+
+    /*!
+     * \brief Remove all handlers of pattern.
+     */
+    void offMatch(std::string pattern) {
+        bool prefix = pattern.length() && (pattern[pattern.length() - 1] == '*');
+        m_onAny.remove(pattern.c_str(), pattern.length() - (prefix ? 1 : 0), prefix);
+    }
 
 private:
+    int sendPacket(char type, const char* payload, uint32_t length, int flags = 0);
+    int emit(const char* key, const char* frame, uint32_t length);
+    int sendConnect();
+    int flushQueue();
+    int flushLatest();
+    int shape(const char* payload, uint32_t length, int flags);
+    void phaseDone(int phase);
+    void onAck(char* data, int len);
+    void failAcks();
+    void callAck(RVSIOACK& cb, const char* data, int len);
+    void dispatchEvent(char* data, int lData);
+    static void dispatchMsg(WsMsg* m);
+    void onPacket(char ioType, char* data, int lData);
+    void decodePacket(const char* in, int len);
+    void wake(const char* event, char* msg);
+    void onBinaryEvent(char* data, int lData);
+    void attachmentDone(int status);
 
 public:
     WebSocketClient* m_ws;
     RVSIOCB                        m_cb;
     RVSIOConnectedCB               m_ccb;
-    std::multimap<std::string, RVSIOON> m_on;
+    WsHandlerTable<RVSIOON>        m_on;        /*!< Event handlers (copy-on-write) */
+    WsHandlerTable<RVSIOANY>       m_onAny;     /*!< Pattern handlers (copy-on-write) */
+    /* Offline queue */
+    SioEmitQueue*                  m_queue;
+    SemaphoreHandle_t              m_flushLock;
+    std::atomic<bool>              m_joined;
+    /* Conflation (newest value per topic) */
+    struct SioLatest {
+        std::string topic;                      /*!< Event name + '\0' + sub key */
+        std::string frame;                      /*!< Packet data (empty - being sent) */
+    };
+    std::deque<SioLatest>          m_latest;    /*!< Topics waiting to be sent, in order */
+    std::atomic<uint32_t>          m_latestCount;
+    SemaphoreHandle_t              m_latestLock;
+    SemaphoreHandle_t              m_latestFlush; /*!< One flusher at a time */
+    /* Rate shaping */
+    struct SioShaper {
+        std::string   event;
+        WsTokenBucket b;
+    };
+    bool                           m_shaping;   /*!< Any bucket set */
+    WsTokenBucket                  m_bucket;    /*!< Client bucket (rate 0 - off) */
+    std::deque<SioShaper>          m_eventBuckets;
+    SemaphoreHandle_t              m_shapeLock;
+    std::atomic<uint32_t>          m_shapeWaiting; /*!< Bytes waiting for tokens */
+    /* Connection state recovery */
+    bool                           m_recover;
+    bool                           m_recovered;
+    std::string                    m_pid;
+    std::string                    m_offset;
+    /* Acknowledgements */
+    struct SioAck {
+        RVSIOACK cb;
+        int64_t  t0;                            /*!< Send time [us] */
+    };
+    std::map<uint32_t, SioAck>     m_acks;      /*!< Acks waiting for the server */
+    uint32_t                       m_ackId;
+    SemaphoreHandle_t              m_ackLock;
+    int                            m_rxAck;     /*!< Ack id of the event being dispatched (-1 none) */
+    /* Waiters (coroutines) */
+    std::atomic<SioWaiter*>        m_waiters;
+    SemaphoreHandle_t              m_waitLock;
+    /* Dispatch */
+    WsDispatcher*                  m_disp;      /*!< Handler workers (NULL - network task) */
+    /* Packet encoding */
+    SioParser*                     m_parser;    /*!< NULL - default text encoding */
+    uint32_t                       m_parserBuf; /*!< Encode/decode buffer size */
+    char*                          m_encBuf[2]; /*!< Encode buffers (normal, urgent lane) */
+    SemaphoreHandle_t              m_encLock[2];
+    char*                          m_decBuf;    /*!< Decode buffer (network task) */
+    /* Fragmented message */
+    std::string                    m_frag;
+    int                            m_fragType;  /*!< Opcode of the message being collected (-1 none) */
+    /* Binary attachments */
+    struct SioSink {
+        std::string event;
+        WsSink*     sink;
+    };
+    std::deque<SioSink>            m_sinks;     /*!< Attachment sinks per event */
+    SemaphoreHandle_t              m_sinkLock;
+    WsSink*                        m_binSink;   /*!< Sink of the event being received (NULL none) */
+    WsSink                         m_attSink;   /*!< One attachment -> m_binSink */
+    std::string                    m_binEvent;  /*!< Event waiting for its attachments */
+    int                            m_binLeft;   /*!< Attachments still to arrive */
+    bool                           m_attFirst;  /*!< Next byte starts an attachment */
+    /* Counters */
+    SocketIoStats                  m_stats;
+    int64_t                        m_tPhase;    /*!< Start of the current connection phase [us] */
 };
 
+#include "sioco.h"
+
 #endif
 
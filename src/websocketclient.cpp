@@ -8,11 +8,16 @@
  * published by the Free Software Foundation.
  */
 #include "websocketclient.h"
+#include "wstrace.h"
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/timers.h>
+#include <esp_timer.h>
 #include <string.h>
+#if !defined(WS_TRANSPORT_NO_TLS) && defined(CONFIG_MBEDTLS_CERTIFICATE_BUNDLE)
+#include <esp_crt_bundle.h>
+#endif
 
 static char tag[] = "WSC";
 
@@ -29,6 +34,10 @@ static char tag[] = "WSC";
 #define WS_FIN  128
 #define WS_MASK 128
 
+#define WS_LOCK_TIMEOUT 1000
+#define WS_TX_IDLE_MS   1000
+#define WS_PROBE_FAILED 0xFFFFFFFF
+
 #define directClose() esp_transport_close(m_tr)
 #define directSend(data, len, timeout_ms) esp_transport_write(m_tr, data, len, timeout_ms)
 #define directRecv(data, len, timeout_ms) esp_transport_read(m_tr, data, len, timeout_ms)
@@ -51,24 +60,89 @@ WebSocketClient::WebSocketClient(const char* url, const char* token, int pingInt
 	m_coreId    = coreID;
 	m_connected = false;
 	m_ping_interval = pingInterval_ms;
-	m_url = strdup(url);
 	m_token = NULL;
 	if (token) m_token = strdup(token);
-	m_maxBuf = maxBufSize;
-	m_maxBufC = maxBufSize - 1;
-	/* Allocate RX/TX buffers */
-	rx_buf = (char*)malloc(maxBufSize);
-	tx_buf = (char*)malloc(maxBufSize);
+	m_maxBufLimit = maxBufSize;
+	/* RX/TX buffers are allocated on first use (connect, feed, large frame) */
+	m_rxSize = maxBufSize;
+	m_rxWant = 0;
+	m_maxBuf = 0;
+	m_maxBufC = 0;
+	rx_buf = NULL;
+	tx_buf = NULL;
+	m_txBuf = maxBufSize;
+	m_lowMemMs = 0;
+	m_rxUsedMs = 0;
+	m_txUsedMs = 0;
+	m_memBuf = 0;
+	m_memPeak = 0;
+	m_memReleases = 0;
 	/* Mutex */
 	vSemaphoreCreateBinary(m_lock);
+	vSemaphoreCreateBinary(m_dataLock);
+	m_ctlWaiting = 0;
+	m_urgentWaiting = 0;
+	m_pending = 0;
+	m_wmHigh = 0;
+	m_wmLow = 0;
+	m_wmAbove = false;
+	m_txWanted = false;
+	m_duplex = false;
+	for (int i = 0; i < WS_TX_LANES; i++) m_txq[i].cell = NULL;
+	m_linkLost = false;
+	m_txPingMs = 0;
+	m_handle = NULL;
+	m_txHandle = NULL;
+	m_txPriority = pr;
+	m_txCoreId = tskNO_AFFINITY;
+	m_epCount = 0;
+	m_ep = -1;
+	m_epLast = -1;
+	m_probeMs = 0;
+	for (int i = 0; i < WS_ENDPOINTS_MAX; i++) m_probeUs[i] = 0;
+	m_probeDone = false;
+	m_probeTr = NULL;
+	m_probeHandle = NULL;
 	/* Default parameters */
+	memset(&m_stats, 0, sizeof(m_stats));
 	m_sio_v = 4;
+	m_sioWsOnly = false;
+	m_hbEnabled = false;
+	m_eioPingInterval = 0;
+	m_eioPingTimeout = 0;
+	m_eioMaxPayload = 0;
+	m_pingUs = 0;
+	m_hbSent = 0;
+	m_hbPingUs = 0;
+	m_hbLastUs = 0;
+	m_capture = NULL;
+	m_disp = NULL;
+	m_utf8Check = true;
+	/* Frame parser (feed() works before the first connect) */
+	line_begin = 0;
+	line_end = 0;
+	ws_frame_size = 0;
+	m_rxText = false;
+	m_sink = NULL;
+	m_sinkCur = NULL;
+	m_sinkMsg = false;
+	m_sinkFin = false;
+	m_sinkLeft = 0;
 	m_reconnectInterval = 5000;
 	m_connectTimeout = 10000;
 	m_writeTimeout = 10000;
 	m_readTimeout = 5000;
 	/* Parse url */
-	parseURL();
+	addEndpoint(url);
+	/* Create transport (TCP, or TLS keeping the session between connections) */
+	m_transport = new WsTransport(m_eps[0].ssl);
+	m_sslTr = NULL;
+#ifndef WS_TRANSPORT_NO_TLS
+	/* wss:// uses esp_transport_ssl unless TLS session resume is enabled */
+	if (m_eps[0].ssl) m_sslTr = esp_transport_ssl_init();
+#endif
+	m_tr = (m_sslTr) ? m_sslTr : m_transport->handle();
+	useEndpoint(0);
 }
 
 /*!
@@ -77,46 +151,123 @@ WebSocketClient::WebSocketClient(const char* url, const char* token, int pingInt
 WebSocketClient::~WebSocketClient()
 {
 	m_connected = false;
-	if (m_url)   free(m_url);
+	for (int i = 0; i < m_epCount; i++) free(m_eps[i].url);
 	if (m_token) free(m_token);
 	if (rx_buf)  free(rx_buf);
 	if (tx_buf)  free(tx_buf);
 	vSemaphoreDelete(m_lock);
-	esp_transport_destroy(m_tr);
+	vSemaphoreDelete(m_dataLock);
+	for (int i = 0; i < WS_TX_LANES; i++) {
+		WsMsg* m;
+		if (!m_txq[i].cell) continue;
+		while ((m = (WsMsg*)ws_ring_pop(&m_txq[i])) != NULL) ws_msg_unref(m);
+		ws_ring_free(&m_txq[i]);
+	}
+	if (m_sslTr) {
+		esp_transport_close(m_sslTr);
+		esp_transport_destroy(m_sslTr);
+	}
+	delete m_transport;
+	if (m_probeTr) delete m_probeTr;
+}
+
+/*!
+ * \brief TLS: server CA certificate (PEM, NULL terminated, must stay valid).
+ */
+void WebSocketClient::setCACert(const char* pem)
+{
+	m_transport->setCACert(pem);
+#ifndef WS_TRANSPORT_NO_TLS
+	if (m_sslTr) esp_transport_ssl_set_cert_data(m_sslTr, pem, strlen(pem));
+#endif
+}
+
+/*!
+ * \brief TLS: verify server with ESP-IDF certificate bundle.
+ */
+void WebSocketClient::setCrtBundle(bool b)
+{
+	m_transport->setCrtBundle(b);
+#if !defined(WS_TRANSPORT_NO_TLS) && defined(CONFIG_MBEDTLS_CERTIFICATE_BUNDLE)
+	if (m_sslTr && b) esp_transport_ssl_crt_bundle_attach(m_sslTr, esp_crt_bundle_attach);
+#endif
+}
+
+/*!
+ * \brief TLS: offer session from the previous connection on reconnect (set before start()).
+ */
+void WebSocketClient::setTlsSessionResume(bool b)
+{
+	m_transport->setSessionResume(b);
+	selectTransport();
+}
+
+/*!
+ * \brief Pick transport of the connection: WsTransport for ws:// and for wss:// with session resume,
+ * esp_transport_ssl for other wss:// connections.
+ */
+void WebSocketClient::selectTransport()
+{
+	m_tr = (m_sslTr && (!m_transport->getSessionResume())) ? m_sslTr : m_transport->handle();
+	esp_transport_set_default_port(m_tr, m_port);
+}
+
+/*!
+ * \brief Full-duplex mode (call before start()).
+ * \param on - enable,
+ * \param coreID - TX task CPU core,
+ * \param pr - TX task priority (0 - same as the network task),
+ * \param queueLen - messages waiting per lane.
+ */
+void WebSocketClient::setFullDuplex(bool on, BaseType_t coreID, uint8_t pr, uint32_t queueLen)
+{
+	if (m_handle) return;
+	m_txCoreId = coreID;
+	m_txPriority = pr ? pr : m_priority;
+	for (int i = 0; i < WS_TX_LANES; i++) {
+		ws_ring_free(&m_txq[i]);
+		if (on && !ws_ring_init(&m_txq[i], queueLen)) {
+			cl_ws_error("No memory for TX queue");
+			on = false;
+		}
+	}
+	m_duplex = on;
 }
 
 
 /*!
- * \brief Parse URL.
+ * \brief Parse URL (in place).
+ * \param url - writable url copy,
+ * \param e - endpoint to fill.
  */
-void WebSocketClient::parseURL()
+void WebSocketClient::parseURL(char* url, WsEndpoint* e)
 {
-	char ch, * c = m_url, * port = NULL;
-	m_port = 80;
-	m_ssl = false;
-	m_sio = false;
-	m_path = "";
-	m_host = "";
+	char ch, * c = url, * port = NULL;
+	e->port = 80;
+	e->ssl = false;
+	e->sio = false;
+	e->path = "";
+	e->host = "";
 
 	/* Parse protocol */
 	if (!strncmp(c, "wss://", 6)) {
-		m_port = 443;
-		m_ssl = true;
+		e->port = 443;
+		e->ssl = true;
 		c += 6;
-		m_host = c;
+		e->host = c;
 	} else if (!strncmp(c, "ws://", 5)) {
 		c += 5;
-		m_host = c;
+		e->host = c;
 	} else if (!strncmp(c, "https://", 8)) {
-		m_port = 443;
-		m_ssl = true;
-		m_sio = true;
+		e->port = 443;
+		e->ssl = true;
+		e->sio = true;
 		c += 8;
-		m_host = c;
+		e->host = c;
 	} else if (!strncmp(c, "http://", 7)) {
-		m_sio = true;
+		e->sio = true;
 		c += 7;
-		m_host = c;
+		e->host = c;
 	}
 	/* Parse host */
 	while (*c != '\0') {
@@ -127,25 +278,413 @@ void WebSocketClient::parseURL()
 			port = c + 1;
 		} else if (ch == '/') {
 			*c = '\0';
-			m_path = c + 1;
+			e->path = c + 1;
 			break;
 		}
 		c++;
 	}
 	if (port) {
-		m_port = atoi(port);
+		e->port = atoi(port);
+	}
+	cl_ws_debug("URL parse (host = %s, path = %s, port = %d, ssl = %d, sio = %d )", e->host, e->path, e->port, e->ssl ? 1 : 0, e->sio ? 1 : 0);
+}
+
+/*!
+ * \brief Add server endpoint (call before start()).
+ * \param url - url with the same scheme as the constructor url (ws, wss, http or https).
+ * \return endpoint index or -1 (list full, other scheme, task running).
+ */
+int WebSocketClient::addEndpoint(const char* url)
+{
+	WsEndpoint* e;
+
+	if (m_handle || (m_epCount >= WS_ENDPOINTS_MAX)) return -1;
+	e = &m_eps[m_epCount];
+	memset(e, 0, sizeof(*e));
+	e->url = strdup(url);
+	if (!e->url) return -1;
+	parseURL(e->url, e);
+	/* One transport (plain or TLS) serves all endpoints */
+	if (m_epCount && ((e->sio != m_eps[0].sio) || (e->ssl != m_eps[0].ssl))) {
+		cl_ws_error("Endpoint %s: other scheme than %s", url, m_url);
+		free(e->url);
+		return -1;
+	}
+	return m_epCount++;
+}
+
+/*!
+ * \brief Connect to endpoint i from now on.
+ */
+void WebSocketClient::useEndpoint(int i)
+{
+	WsEndpoint* e = &m_eps[i];
+
+	if (i == m_ep) return;
+	/* TLS session belongs to the previous server */
+	if (m_ep >= 0) m_transport->clearSession();
+	m_ep = i;
+	m_url = e->url;
+	m_host = e->host;
+	m_path = e->path;
+	m_port = e->port;
+	m_ssl = e->ssl;
+	m_sio = e->sio;
+	m_transport->m_ssl = m_ssl;
+	selectTransport();
+}
+
+/*!
+ * \brief Select endpoint for the next connect.
+ *
+ * Healthy endpoint with the lowest TCP connect time, endpoints not measured yet in list order,
+ * the current endpoint keeps its place unless another one is faster by WS_ENDPOINT_MARGIN_US.
+ * When all endpoints are held back - the one which is free first.
+ */
+int WebSocketClient::pickEndpoint()
+{
+	int64_t now = esp_timer_get_time();
+	int best = -1, soonest = 0;
+	uint32_t bestRtt = 0, rtt;
+
+	for (int i = 0; i < m_epCount; i++) {
+		WsEndpoint* e = &m_eps[i];
+		if (e->down_us > now) {
+			if (e->down_us < m_eps[soonest].down_us) soonest = i;
+			continue;
+		}
+		rtt = e->rtt_us ? e->rtt_us : WS_PROBE_FAILED;
+		if ((i == m_ep) && (rtt != WS_PROBE_FAILED)) rtt = (rtt > WS_ENDPOINT_MARGIN_US) ? rtt - WS_ENDPOINT_MARGIN_US : 0;
+		if ((best < 0) || (rtt < bestRtt)) {
+			best = i;
+			bestRtt = rtt;
+		}
+	}
+	return (best < 0) ? soonest : best;
+}
+
+/*!
+ * \brief Connect to endpoint i failed - hold it back (reconnect interval doubled per failure).
+ */
+void WebSocketClient::endpointFailed(int i)
+{
+	WsEndpoint* e = &m_eps[i];
+	int64_t hold = (int64_t)m_reconnectInterval << ((e->failures < 5) ? e->failures : 5);
+
+	if (hold > WS_ENDPOINT_HOLD_MS) hold = WS_ENDPOINT_HOLD_MS;
+	e->failures++;
+	e->down_us = esp_timer_get_time() + hold * 1000;
+	cl_ws_debug("Endpoint %d (%s) failed %u times, hold %d ms", i, e->host, e->failures, (int)hold);
+}
+
+/*!
+ * \brief Endpoint i answered in us (TCP connect) - healthy again, update its latency.
+ */
+void WebSocketClient::endpointRtt(int i, uint32_t us)
+{
+	WsEndpoint* e = &m_eps[i];
+
+	if (!us) us = 1;
+	e->rtt_us = e->rtt_us ? (e->rtt_us * 3 + us) / 4 : us;
+	e->failures = 0;
+	e->down_us = 0;
+}
+
+/*!
+ * \brief Apply probe results (network task).
+ * \return true when the connection should move to a faster endpoint.
+ */
+bool WebSocketClient::probeResults()
+{
+	for (int i = 0; i < m_epCount; i++) {
+		uint32_t us = m_probeUs[i].exchange(0);
+		if (!us) continue;
+		if (us != WS_PROBE_FAILED) endpointRtt(i, us);
+		else if (i != m_ep) endpointFailed(i);
+	}
+	return pickEndpoint() != m_ep;
+}
+
+/*!
+ * \brief Probe task function (setEndpointProbe()).
+ */
+void WebSocketClient::runProbe()
+{
+	if (!m_probeTr) m_probeTr = new WsTransport(false);
+	while (true) {
+		vTaskDelay(m_probeMs / portTICK_PERIOD_MS);
+		if (!m_connected || m_probeDone) continue;
+		for (int i = 0; i < m_epCount; i++) {
+			const WsEndpoint* e = &m_eps[i];
+			if (m_probeTr->connect(e->host, e->port, WS_PROBE_TIMEOUT_MS) < 0) {
+				m_probeUs[i] = WS_PROBE_FAILED;
+			} else {
+				uint32_t us = m_probeTr->m_tcpUs - m_probeTr->m_dnsUs;
+				m_probeUs[i] = us ? us : 1;
+				m_probeTr->close();
+			}
+		}
+		m_probeDone = true;
+	}
+}
+
+/*!
+ * \brief Get raw value of the top level JSON field (quotes and spaces stripped).
+ * \param json - JSON object text (does not have to be NULL terminated),
+ * \param len - JSON text length in bytes,
+ * \param key - field name,
+ * \param out - output buffer,
+ * \param outLen - output buffer size in bytes.
+ * \return value length or -1 when field is missing.
+ */
+int sio_json_field(const char* json, int len, const char* key, char* out, int outLen)
+{
+	int kl = strlen(key), i, j = 0;
+
+	for (i = 0; i + kl + 3 <= len; ++i) {
+		if ((json[i] == '"') && (!strncmp(&json[i + 1], key, kl)) && (json[i + kl + 1] == '"') && (json[i + kl + 2] == ':')) {
+			for (i += kl + 3; (i < len) && (j < outLen - 1); ++i) {
+				if ((json[i] == ',') || (json[i] == '}')) break;
+				if ((json[i] != '"') && (json[i] != ' ')) out[j++] = json[i];
+			}
+			out[j] = '\0';
+			return j;
+		}
+	}
+	if (outLen > 0) out[0] = '\0';
+	return -1;
+}
+
+/*!
+ * \brief Parse Engine.IO open packet and enable server driven heartbeat.
+ * \param json - open packet JSON ({"sid":...,"pingInterval":...,"pingTimeout":...,"maxPayload":...}),
+ * \param len - JSON length in bytes.
+ */
+int WebSocketClient::parseOpenPacket(const char* json, int len)
+{
+	char v[32];
+
+	if (sio_json_field(json, len, "pingInterval", v, sizeof(v)) > 0) m_eioPingInterval = atoi(v);
+	if (sio_json_field(json, len, "pingTimeout", v, sizeof(v)) > 0) m_eioPingTimeout = atoi(v);
+	if (sio_json_field(json, len, "maxPayload", v, sizeof(v)) > 0) m_eioMaxPayload = atoi(v);
+	cl_ws_debug("Engine.IO open (pingInterval = %d, pingTimeout = %d, maxPayload = %d)", m_eioPingInterval, m_eioPingTimeout, m_eioMaxPayload);
+	/* Grow RX buffer up to the limit, so the largest allowed message fits */
+	if ((m_eioMaxPayload > 0) && (m_rxSize < m_maxBufLimit) && (m_eioMaxPayload + 14 > m_rxSize)) {
+		int size = m_eioMaxPayload + 14;
+		if (size > m_maxBufLimit) size = m_maxBufLimit;
+		/* Low-memory mode: allocated by the first frame which needs it. Else grown before the next
+		 * frame - the open packet may come from a frame callback which still uses rx_buf */
+		if (m_lowMemMs) m_rxSize = size;
+		else m_rxWant = size;
+	}
+	if (m_eioPingInterval <= 0) return 0;
+	/* Server heartbeat replaces WebSocket pings */
+	m_hbLast = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	m_hbSent = m_hbLast;
+	m_hbLastUs = esp_timer_get_time();
+	m_hbPingUs = 0;
+	m_hbEnabled = true;
+	return 1;
+}
+
+/*!
+ * \brief Engine.IO heartbeat arrived (ping from v4 server or pong from v3 server).
+ * \param pong - pong (answer to our ping) arrived.
+ */
+void WebSocketClient::heartbeat(bool pong)
+{
+	int64_t t = esp_timer_get_time();
+
+	m_hbLast = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	if (pong) {
+		/* Read and reset at once - TX task may send the next ping meanwhile */
+		int64_t sent = m_hbPingUs.exchange(0);
+		if (sent) rttSample(WS_RTT_EIO, (uint32_t)(t - sent));
+		WS_TRACE(WST_HEARTBEAT, 1, sent ? t - sent : 0);
+	} else {
+		/* Server ping should arrive every pingInterval - anything more is server/network delay */
+		int64_t late = t - m_hbLastUs - (int64_t)m_eioPingInterval * 1000;
+		rttSample(WS_RTT_EIO_LAG, (late > 0) ? (uint32_t)late : 0);
+		WS_TRACE(WST_HEARTBEAT, 0, (late > 0) ? late : 0);
+		m_hbLastUs = t;
+	}
+}
+
+/*!
+ * \brief Add round-trip time sample.
+ * \param src - sample source (WS_RTT_xxx),
+ * \param us - round-trip time in [us].
+ */
+void WebSocketClient::rttSample(int src, uint32_t us)
+{
+	if ((src < 0) || (src >= WS_RTT_MAX)) return;
+	ws_hist_add(&m_stats.rtt[src], us);
+	if (m_rttcb) m_rttcb(this, src, us);
+}
+
+/*!
+ * \brief Check Engine.IO heartbeat, send v3 ping when due.
+ * \param wait - time to the next heartbeat event in [ms] (output).
+ * \return 0 when server is gone.
+ */
+int WebSocketClient::checkHeartbeat(int* wait)
+{
+	uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	int left = (int)(m_hbLast + m_eioPingInterval + m_eioPingTimeout - now);
+
+	if (left <= 0) return 0;
+	if ((m_sio_v < 4) && (!m_duplex)) {
+		/* Engine.IO v3 - client pings, server answers with pong (TX task pings in full-duplex mode) */
+		int next = eioPing(now);
+		if (next < left) left = next;
+	}
+	*wait = left;
+	return 1;
+}
+
+/*!
+ * \brief Send Engine.IO v3 ping when due.
+ * \param now - current time in [ms].
+ * \return time to the next ping in [ms].
+ */
+int WebSocketClient::eioPing(uint32_t now)
+{
+	int next = (int)(m_hbSent + m_eioPingInterval - now);
+
+	if (next <= 0) {
+		cl_ws_debug("Send Engine.IO ping");
+		m_hbPingUs = esp_timer_get_time();
+		if (m_duplex) txFrame("2", 1, WS_FR_OP_TXT);
+		else send("2", 1, WS_FR_OP_TXT | WS_FR_URGENT);
+		m_hbSent = now;
+		next = m_eioPingInterval;
 	}
-	cl_ws_debug("URL parse (host = %s, path = %s, port = %d, ssl = %d, sio = %d )", m_host, m_path, m_port, m_ssl ? 1 : 0, m_sio ? 1 : 0);
+	return next;
+}
+
+/*!
+ * \brief Resize RX buffer (0 - free), keeps received data.
+ * \return false - out of memory (buffer unchanged).
+ */
+bool WebSocketClient::rxResize(int size)
+{
+	char* b = NULL;
 
-	/* Create transport */
-	if (m_ssl) {
-		/* Transport is SSL */
-		m_tr = esp_transport_ssl_init();
+	if (size == m_maxBuf) return true;
+	if (size > 0) {
+		b = (char*)realloc(rx_buf, size);
+		if (!b) {
+			cl_ws_error("No memory for RX buffer (%d)", size);
+			return false;
+		}
 	} else {
-		/* Transport is TCP */
-		m_tr = esp_transport_tcp_init();
+		free(rx_buf);
 	}
-	esp_transport_set_default_port(m_tr, m_port);
+	cl_ws_debug("RX buffer resized (%d -> %d)", m_maxBuf, size);
+	if (size < m_maxBuf) m_memReleases++; else m_rxUsedMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	memAdd(size - m_maxBuf);
+	rx_buf = b;
+	m_maxBuf = size;
+	m_maxBufC = (size > 0) ? size - 1 : 0;
+	return true;
+}
+
+/*!
+ * \brief Allocate TX buffer, caller holds m_lock.
+ */
+bool WebSocketClient::txAlloc()
+{
+	tx_buf = (char*)malloc(m_txBuf);
+	if (!tx_buf) {
+		cl_ws_error("No memory for TX buffer (%d)", m_txBuf);
+		return false;
+	}
+	memAdd(m_txBuf);
+	return true;
+}
+
+/*!
+ * \brief Free TX buffer, caller holds m_lock.
+ */
+void WebSocketClient::txFree()
+{
+	if (!tx_buf) return;
+	free(tx_buf);
+	tx_buf = NULL;
+	memAdd(-m_txBuf);
+	m_memReleases++;
+}
+
+/*!
+ * \brief Account buffer bytes, keep the peak.
+ */
+void WebSocketClient::memAdd(int delta)
+{
+	uint32_t cur = m_memBuf.fetch_add(delta) + delta;
+	uint32_t peak = m_memPeak;
+
+	while ((cur > peak) && (!m_memPeak.compare_exchange_weak(peak, cur))) {}
+}
+
+/*!
+ * \brief Low-memory mode: shrink RX buffer and free TX buffer not needed for m_lowMemMs (network task).
+ */
+void WebSocketClient::releaseIdle()
+{
+	uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+
+	/* Between messages only (a sink message keeps its buffer until the end) */
+	if ((m_maxBuf > WS_IDLE_RX_BUF) && (line_end == 0) && (!m_sinkMsg) && ((int32_t)(now - m_rxUsedMs) >= (int32_t)m_lowMemMs)) {
+		rxResize(WS_IDLE_RX_BUF);
+	}
+	/* Another task may be writing - try again on the next wake up */
+	if (tx_buf && ((int32_t)(now - m_txUsedMs) >= (int32_t)m_lowMemMs) && (xSemaphoreTake(m_lock, 0) == pdTRUE)) {
+		txFree();
+		xSemaphoreGive(m_lock);
+	}
+}
+
+/*!
+ * \brief Low-memory mode: free RX and TX buffers (disconnected, network task).
+ */
+void WebSocketClient::releaseAll()
+{
+	line_end = 0;
+	ws_frame_size = 0;
+	rxResize(0);
+	if (tx_buf) {
+		xSemaphoreTake(m_lock, portMAX_DELAY);
+		txFree();
+		xSemaphoreGive(m_lock);
+	}
+}
+
+/*!
+ * \brief Get current and peak memory footprint.
+ */
+void WebSocketClient::getMemStats(WsMemStats* m) const
+{
+	memset(m, 0, sizeof(WsMemStats));
+	m->rx_buf = m_maxBuf;
+	m->tx_buf = (tx_buf) ? m_txBuf : 0;
+	m->buffers_peak = m_memPeak;
+	m->fixed = sizeof(WebSocketClient) + sizeof(WsTransport);
+	for (int i = 0; i < WS_TX_LANES; i++) {
+		if (m_txq[i].cell) m->fixed += (m_txq[i].mask + 1) * sizeof(WsRingCell);
+	}
+	for (int i = 0; i < m_epCount; i++) m->fixed += strlen(m_eps[i].url) + 1;
+	if (m_token) m->fixed += strlen(m_token) + 1;
+	if (m_probeTr) m->fixed += sizeof(WsTransport);
+	if (m_handle) {
+		m->stacks += m_stackSize;
+		/* ESP-IDF reports the high water mark in bytes */
+		m->stack_free = uxTaskGetStackHighWaterMark(m_handle);
+	}
+	if (m_txHandle) m->stacks += m_stackSize;
+	if (m_probeHandle) m->stacks += m_stackSize / 2;
+	m->total = m->fixed + m->stacks + m->rx_buf + m->tx_buf;
+	m->total_peak = m->fixed + m->stacks + m->buffers_peak;
+	m->releases = m_memReleases;
 }
 
 /*!
@@ -154,19 +693,53 @@ void WebSocketClient::parseURL()
  */
 int WebSocketClient::connect(int timeout_ms)
 {
-	int status, i, j, len, r, checked = 0;
+	int status, i, len, r, checked = 0;
+	int64_t t0 = esp_timer_get_time(), t;
+	bool own;
 	char* ch;
 
 	m_connected = false;
+	m_hbEnabled = false;
+	m_eioMaxPayload = 0;
+	memset(m_stats.handshake_us, 0, sizeof(m_stats.handshake_us));
+	/* RX buffer for the handshake (low-memory mode: constructor size, large frames grow it up to m_rxSize) */
+	len = (m_lowMemMs && (m_txBuf < m_rxSize)) ? m_txBuf : m_rxSize;
+	if ((m_maxBuf < len) && (!rxResize(len))) return 0;
 
-	if (esp_transport_connect(m_tr, m_host, m_port, timeout_ms) < 0) {
+	r = esp_transport_connect(m_tr, m_host, m_port, timeout_ms);
+	own = (m_tr == m_transport->handle());
+	if (own) {
+		if (m_transport->m_dnsCached) m_stats.dns_cached++; else if (m_transport->m_dnsUs) m_stats.dns_lookups++;
+	}
+	if (r < 0) {
 		cl_ws_error("Unable to connect to %s:%d", m_host, m_port);
 		return 0;
 	}
+	if (own) {
+		if (m_transport->m_addrIdx > 0) m_stats.connect_fallbacks++;
+		m_stats.handshake_us[WS_PHASE_TCP] = m_transport->m_tcpUs;
+		m_stats.handshake_us[WS_PHASE_TLS] = m_transport->m_tlsUs;
+	} else {
+		/* esp_transport_ssl - DNS, TCP and TLS in one phase */
+		m_stats.handshake_us[WS_PHASE_TCP] = esp_timer_get_time() - t0;
+	}
+	WS_TRACE(WST_PHASE, WS_PHASE_TCP, m_stats.handshake_us[WS_PHASE_TCP]);
+	if (m_ssl && own) {
+		WS_TRACE(WST_PHASE, WS_PHASE_TLS, m_transport->m_tlsUs);
+		cl_ws_debug("TLS %s handshake", m_transport->isResumed() ? "resumed" : "full");
+		if (m_transport->isResumed()) m_stats.tls_resumed++; else m_stats.tls_full++;
+	} else if (m_ssl) {
+		m_stats.tls_full++;
+	}
+	t = esp_timer_get_time();
 	// m_socket.setNoDelay(false);
 	{
-		if (m_sio) {
-			char sid[256];
+		if (m_sio && m_sioWsOnly) {
+			/* Open WebSocket transport directly, Engine.IO open packet arrives in the first frame */
+			cl_ws_debug("/%ssocket.io/?EIO=%d&transport=websocket)", m_path, m_sio_v);
+			r = snprintf(rx_buf, m_maxBufC, "GET /%ssocket.io/?EIO=%d&transport=websocket HTTP/1.1\r\n", m_path, m_sio_v);
+		} else if (m_sio) {
+			char sid[256] = "";
 			/* Ask for session ID */
 			cl_ws_debug("Get session ID (/%ssocket.io/?EIO=%d&transport=polling)", m_path, m_sio_v);
 			r = snprintf(rx_buf, m_maxBufC, "GET /%ssocket.io/?EIO=%d&transport=polling HTTP/1.1\r\n", m_path, m_sio_v);
@@ -213,23 +786,19 @@ int WebSocketClient::connect(int timeout_ms)
 			if (i > 0) {
 				rx_buf[i] = '\0';
 				cl_ws_debug("JSON = <%s>", rx_buf);
-				ch = strstr(rx_buf, "\"sid\":");
+				ch = strchr(rx_buf, '{');
 				if (ch) {
-					ch += 6;
-					j = 0;
-					while (*ch != '\0') {
-						if (*ch == ',') break;
-						if (*ch == '}') break;
-						if ((*ch != '"') && (*ch != ' '))
-							sid[j++] = *ch;
-						ch++;
-					}
-					sid[j] = '\0';
+					/* sid first, then Engine.IO limits */
+					sio_json_field(ch, i - (int)(ch - rx_buf), "sid", sid, sizeof(sid));
+					parseOpenPacket(ch, i - (int)(ch - rx_buf));
 					cl_ws_debug("GOT sid = <%s>", sid);
 				}
 			}
+			m_stats.handshake_us[WS_PHASE_POLLING] = esp_timer_get_time() - t;
+			WS_TRACE(WST_PHASE, WS_PHASE_POLLING, m_stats.handshake_us[WS_PHASE_POLLING]);
+			t = esp_timer_get_time();
 			cl_ws_debug("/%ssocket.io/?EIO=%d&transport=websocket&sid=%s)", m_path, m_sio_v, sid);
-			r = snprintf(rx_buf, m_maxBufC, "GET /%ssocket.io/?EIO=4&transport=websocket&sid=%s HTTP/1.1\r\n", m_path, sid);
+			r = snprintf(rx_buf, m_maxBufC, "GET /%ssocket.io/?EIO=%d&transport=websocket&sid=%s HTTP/1.1\r\n", m_path, m_sio_v, sid);
 		} else {
 			r = snprintf(rx_buf, m_maxBufC, "GET /%s HTTP/1.1\r\n", m_path);
 		}
@@ -278,12 +847,27 @@ int WebSocketClient::connect(int timeout_ms)
 		directClose();
 		return -1;
 	}
+	m_stats.handshake_us[WS_PHASE_UPGRADE] = esp_timer_get_time() - t;
+	m_stats.handshake_total_us = esp_timer_get_time() - t0;
+	WS_TRACE(WST_PHASE, WS_PHASE_UPGRADE, m_stats.handshake_us[WS_PHASE_UPGRADE]);
+	if (m_stats.connects++) m_stats.reconnects++;
+	/* TCP connect time without DNS lookup is the endpoint latency (esp_transport_ssl: whole connect) */
+	endpointRtt(m_ep, own ? m_transport->m_tcpUs - m_transport->m_dnsUs : m_stats.handshake_us[WS_PHASE_TCP]);
+	m_eps[m_ep].connects++;
+	if ((m_epLast >= 0) && (m_ep != m_epLast)) m_stats.failovers++;
+	m_epLast = m_ep;
 	cl_ws_debug("Connect done :-)");
 	ws_ping_cnt = 0;
 	ws_pong_cnt = 0;
+	m_linkLost = false;
+	m_txPingMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
 	line_begin = 0;
 	line_end = 0;
 	ws_frame_size = 0;
+	if (m_capture) {
+		m_capture->begin((m_sio ? WSCAP_FL_SIO : 0) | (m_sioWsOnly ? WSCAP_FL_WS_ONLY : 0), m_sio_v);
+		m_capture->record(WSCAP_CONNECT, NULL, 0);
+	}
 	// m_socket.setNoDelay(true);
 	m_connected = true;
 	if (m_ccb) m_ccb(this, true);
@@ -295,67 +879,57 @@ int WebSocketClient::connect(int timeout_ms)
  * \brief Send WebSocket frame (use tx_buffer).
  * \param msg - pointer to message data,
  * \param size - message size in bytes,
- * \param type - message type.
+ * \param type - message type (| WS_FR_URGENT for the urgent lane).
  */
 int WebSocketClient::send(const char* msg, uint32_t size, int type)
 {
-	unsigned char* response = (unsigned char*)tx_buf;
-	int idx_response, res = 0, allocated = 0;
+	return send2(msg, size, NULL, 0, type);
+}
+
+/*!
+ * \brief Write one frame (or fragment) with part of message0 + message1 data, caller holds m_lock.
+ * \param off - offset of the fragment in message0 + message1,
+ * \param length - fragment size in bytes (fits in tx_buf),
+ * \param opcode - frame opcode,
+ * \param fin - last fragment of the message.
+ */
+int WebSocketClient::writeFrame(const char* msg0, uint32_t size0, const char* msg1, uint32_t length, uint32_t off, int opcode, bool fin)
+{
+	unsigned char small[WS_SMALL_FRAME + 7];
+	unsigned char* response = small;
+	int idx_response, res;
 	uint32_t i;
 	uint8_t idx_header;
-	uint32_t length;
 	uint8_t masks[4];
 
-	int poll_write;
-
-	if ((poll_write = directPollWrite(m_writeTimeout)) <= 0) {
-		// ESP_LOGE(TAG, "Error transport_poll_write");
-		return poll_write;
-	}
-
-
-	if (size + 15 > m_maxBuf) {
-		/* Ups, internal  buffer too long - try to allocate */
-		allocated = 1;
-		response = (unsigned char*)malloc(size + 16);
-		if (!response) return 0;
-	}
-
-	if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return 0;
-
 	/* Generate random mask */
 	masks[0] = rand() & 0xff;
 	masks[1] = rand() & 0xff;
 	masks[2] = rand() & 0xff;
 	masks[3] = rand() & 0xff;
 
+	/* Pings, pongs and short messages do not need tx_buf */
+	if (length > WS_SMALL_FRAME) {
+		if ((!tx_buf) && (!txAlloc())) return 0;
+		response = (unsigned char*)tx_buf;
+		m_txUsedMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	}
+
 	/* Construct header */
-	length = size;
+	response[0] = (fin ? WS_FIN : 0) | opcode;
 	/* Split the size between octets. */
 	if (length <= 125) {
 		idx_header = 6;
-		response[0] = (WS_FIN | type);
 		response[1] = (length & 0x7F) | WS_MASK;
-		response[2] = masks[0];
-		response[3] = masks[1];
-		response[4] = masks[2];
-		response[5] = masks[3];
 	} else if (length >= 126 && length <= 65535) {
 		/* Size between 126 and 65535 bytes. */
 		idx_header = 8;
-		response[0] = (WS_FIN | type);
 		response[1] = 126 | WS_MASK;
 		response[2] = (length >> 8) & 255;
 		response[3] = length & 255;
-		response[4] = masks[0];
-		response[5] = masks[1];
-		response[6] = masks[2];
-		response[7] = masks[3];
 	} else {
 		/* More than 65535 bytes but limited to 4GB. */
-		/* Size between 126 and 65535 bytes. */
 		idx_header = 14;
-		response[0] = (WS_FIN | type);
 		response[1] = 127 | WS_MASK;
 		response[2] = 0;
 		response[3] = 0;
@@ -365,132 +939,386 @@ int WebSocketClient::send(const char* msg, uint32_t size, int type)
 		response[7] = (unsigned char)((length >> 16) & 255);
 		response[8] = (unsigned char)((length >> 8) & 255);
 		response[9] = (unsigned char)(length & 255);
-		response[10] = masks[0];
-		response[11] = masks[1];
-		response[12] = masks[2];
-		response[13] = masks[3];
 	}
+	memcpy(&response[idx_header - 4], masks, 4);
 
 	idx_response = idx_header;
 
 	/* Add data bytes and apply mask. */
-	for (i = 0; i < length; i++) {
-		response[idx_response] = msg[i] ^ masks[i % 4];
+	for (i = 0; (i < length) && (off + i < size0); i++) {
+		response[idx_response] = msg0[off + i] ^ masks[i % 4];
+		idx_response++;
+	}
+	for (; i < length; i++) {
+		response[idx_response] = msg1[off + i - size0] ^ masks[i % 4];
 		idx_response++;
 	}
 	response[idx_response] = '\0';
 
 	res = (directSend((const char*)response, idx_response, m_writeTimeout) == idx_response) ? 1 : 0;
-	/* Free allocated memory */
-	if (allocated) free(response);
+	if (res) {
+		WS_TRACE(WST_TX_FRAME, opcode, length);
+		m_stats.tx_frames[opcode]++;
+		m_stats.tx_bytes[opcode] += length;
+	} else {
+		WS_TRACE(WST_TX_FAIL, opcode, length);
+	}
+	return res;
+}
 
-	xSemaphoreGive(m_lock);
+/*!
+ * \brief Take the data lane (one data message on the wire at a time, urgent messages first).
+ * \param urgent - urgent message,
+ * \param timeout - lock timeout in ticks (0 - do not wait).
+ */
+bool WebSocketClient::takeDataLane(bool urgent, TickType_t timeout)
+{
+	TickType_t t0 = xTaskGetTickCount(), left = timeout;
 
-	return ((int)res);
+	if (urgent) {
+		m_urgentWaiting++;
+		BaseType_t r = xSemaphoreTake(m_dataLock, left);
+		m_urgentWaiting--;
+		return (r == pdTRUE);
+	}
+	while (xSemaphoreTake(m_dataLock, left) == pdTRUE) {
+		if (m_urgentWaiting == 0) return true;
+		/* Urgent message is waiting - let it go first */
+		xSemaphoreGive(m_dataLock);
+		if (timeout == 0) break;
+		vTaskDelay(1);
+		TickType_t dt = xTaskGetTickCount() - t0;
+		if (dt >= timeout) break;
+		left = timeout - dt;
+	}
+	return false;
+}
+
+/*!
+ * \brief Account bytes accepted by send() (delta > 0) or written/dropped (delta < 0), fire watermark callback.
+ */
+void WebSocketClient::pendingAdd(int32_t delta)
+{
+	uint32_t p = (m_pending += delta);
+
+	if ((!m_wmcb) || (m_wmHigh == 0)) return;
+	if ((delta > 0) && (p >= m_wmHigh)) {
+		if (!m_wmAbove.exchange(true)) m_wmcb(this, true, p);
+	} else if ((delta < 0) && (p <= m_wmLow)) {
+		if (m_wmAbove.exchange(false)) m_wmcb(this, false, p);
+	}
+}
+
+/*!
+ * \brief Set buffered bytes watermarks (high = 0 - disabled).
+ * \param high - callback with above = true when buffered bytes reach high,
+ * \param low - callback with above = false when buffered bytes drop to low again,
+ * \param cb - watermark callback (called from the sending task).
+ */
+void WebSocketClient::setWatermarks(uint32_t high, uint32_t low, RVWebSocketWatermarkCB cb)
+{
+	m_wmHigh = high;
+	m_wmLow = (low < high) ? low : high;
+	m_wmcb = cb;
+	m_wmAbove = (high > 0) && (m_pending >= high);
 }
 
 /*!
  * \brief Send WebSocket frame (use tx_buffer).
+ *
+ * Messages larger than tx_buf are sent in fragments, control frames (ping, pong, close)
+ * go out between fragments, urgent messages (WS_FR_URGENT) before other waiting messages.
+ *
  * \param msg0 - pointer to message0 data,
  * \param size0 - message0 size in bytes,
  * \param msg1 - pointer to message0 data,
  * \param size1 - message0 size in bytes,
- * \param type - message type.
+ * \param type - message type (| WS_FR_URGENT for the urgent lane, | WS_FR_NOWAIT - see trySend()).
  */
 int WebSocketClient::send2(const char* msg0, uint32_t size0, const char* msg1, uint32_t size1, int type)
 {
-	unsigned char* response = (unsigned char*)tx_buf;
-	int idx_response, res = 0, allocated = 0, poll_write;
-	uint32_t i;
-	uint8_t idx_header;
-	uint32_t length;
-	uint8_t masks[4];
+	int opcode = type & 0x0F, res = 1, poll_write;
+	uint32_t length = size0 + size1, off = 0, chunk = m_txBuf - 15;
+	bool nowait = (type & WS_FR_NOWAIT) != 0;
 
-	length = size0 + size1;
+	if ((m_eioMaxPayload > 0) && (length > (uint32_t)m_eioMaxPayload)) {
+		cl_ws_error("Message too long (%u > maxPayload %d)", length, m_eioMaxPayload);
+		m_stats.send_failures++;
+		return 0;
+	}
+	if (m_duplex) return queueMsg(msg0, size0, msg1, size1, type);
 
-	if ((poll_write = directPollWrite(m_writeTimeout)) <= 0) {
+	if ((poll_write = directPollWrite(nowait ? 0 : m_writeTimeout)) <= 0) {
 		// ESP_LOGE(TAG, "Error transport_poll_write");
+		if (nowait && (poll_write == 0)) {
+			m_stats.tx_would_block++;
+			return WS_WOULD_BLOCK;
+		}
+		m_stats.send_failures++;
 		return poll_write;
 	}
 
+	if (opcode & 0x08) {
+		/* Control frame - waits only for the fragment on the wire */
+		if (length > 125) {
+			m_stats.send_failures++;
+			return 0;
+		}
+		WS_TRACE_T0(tLock);
+		m_ctlWaiting++;
+		BaseType_t r = xSemaphoreTake(m_lock, nowait ? 0 : WS_LOCK_TIMEOUT);
+		m_ctlWaiting--;
+		WS_TRACE(WST_LOCK_WAIT, WS_TRACE_US(tLock), r);
+		if (r == pdFALSE) {
+			if (nowait) {
+				m_stats.tx_would_block++;
+				return WS_WOULD_BLOCK;
+			}
+			m_stats.lock_timeouts++;
+			m_stats.send_failures++;
+			return 0;
+		}
+		pendingAdd(length);
+		res = writeFrame(msg0, size0, msg1, length, 0, opcode, true);
+		xSemaphoreGive(m_lock);
+		pendingAdd(-(int32_t)length);
+		if (!res) m_stats.send_failures++;
+		return res;
+	}
 
-	if (length + 15 > m_maxBuf) {
-		/* Ups, internal  buffer too long - try to allocate */
-		allocated = 1;
-		response = (unsigned char*)malloc(length + 16);
-		if (!response) return 0;
+	/* Data message */
+	WS_TRACE_T0(tLock);
+	if (nowait) {
+		if (!takeDataLane((type & WS_FR_URGENT) != 0, 0)) {
+			m_stats.tx_would_block++;
+			return WS_WOULD_BLOCK;
+		}
+		pendingAdd(length);
+	} else {
+		/* Waiting for the lane counts as buffered */
+		pendingAdd(length);
+		if (!takeDataLane((type & WS_FR_URGENT) != 0, WS_LOCK_TIMEOUT)) {
+			WS_TRACE(WST_LOCK_WAIT, WS_TRACE_US(tLock), 0);
+			pendingAdd(-(int32_t)length);
+			m_stats.lock_timeouts++;
+			m_stats.send_failures++;
+			return 0;
+		}
+	}
+	WS_TRACE(WST_LOCK_WAIT, WS_TRACE_US(tLock), 1);
+	if (length > chunk) m_stats.tx_fragmented++;
+	do {
+		uint32_t n = (length - off > chunk) ? chunk : length - off;
+		if (m_ctlWaiting) {
+			/* Control frame is waiting - let it go between fragments */
+			taskYIELD();
+			if (m_ctlWaiting) vTaskDelay(1);
+		}
+		if (xSemaphoreTake(m_lock, WS_LOCK_TIMEOUT) == pdFALSE) {
+			m_stats.lock_timeouts++;
+			res = 0;
+			break;
+		}
+		res = writeFrame(msg0, size0, msg1, n, off, (off == 0) ? opcode : WS_FR_OP_CONT, off + n == length);
+		xSemaphoreGive(m_lock);
+		if (res) {
+			off += n;
+			pendingAdd(-(int32_t)n);
+		}
+	} while (res && (off < length));
+	xSemaphoreGive(m_dataLock);
+	if (!res) {
+		pendingAdd(-(int32_t)(length - off));
+		m_stats.send_failures++;
+	} else if (m_txWanted && m_txcb) {
+		/* Lane is free - let waiting data go */
+		m_txcb(this);
 	}
 
-	if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return 0;
+	return ((int)res);
+}
 
-	/* Generate random mask */
-	masks[0] = rand() & 0xff;
-	masks[1] = rand() & 0xff;
-	masks[2] = rand() & 0xff;
-	masks[3] = rand() & 0xff;
+/*!
+ * \brief Send WebSocket frame without waiting (socket not writable or another message on the wire).
+ * \param msg - pointer to message data,
+ * \param size - message size in bytes,
+ * \param type - message type (| WS_FR_URGENT for the urgent lane).
+ * \return 1 - sent, WS_WOULD_BLOCK - try again later, <= 0 - error.
+ */
+int WebSocketClient::trySend(const char* msg, uint32_t size, int type)
+{
+	return send2(msg, size, NULL, 0, type | WS_FR_NOWAIT);
+}
 
-	/* Construct header */
+/*!
+ * \brief Full-duplex: copy message to the TX queue of its lane and wake up the TX task.
+ */
+int WebSocketClient::queueMsg(const char* msg0, uint32_t size0, const char* msg1, uint32_t size1, int type)
+{
+	int opcode = type & 0x0F, lane = WS_TX_LANE_DATA;
+	uint32_t length = size0 + size1;
+	bool nowait = (type & WS_FR_NOWAIT) != 0;
+	TickType_t t0 = xTaskGetTickCount();
+	WsMsg* m;
 
-	/* Split the size between octets. */
-	if (length <= 125) {
-		idx_header = 6;
-		response[0] = (WS_FIN | type);
-		response[1] = (length & 0x7F) | WS_MASK;
-		response[2] = masks[0];
-		response[3] = masks[1];
-		response[4] = masks[2];
-		response[5] = masks[3];
-	} else if (length >= 126 && length <= 65535) {
-		/* Size between 126 and 65535 bytes. */
-		idx_header = 8;
-		response[0] = (WS_FIN | type);
-		response[1] = 126 | WS_MASK;
-		response[2] = (length >> 8) & 255;
-		response[3] = length & 255;
-		response[4] = masks[0];
-		response[5] = masks[1];
-		response[6] = masks[2];
-		response[7] = masks[3];
-	} else {
-		/* More than 65535 bytes but limited to 4GB. */
-		/* Size between 126 and 65535 bytes. */
-		idx_header = 14;
-		response[0] = (WS_FIN | type);
-		response[1] = 127 | WS_MASK;
-		response[2] = 0;
-		response[3] = 0;
-		response[4] = 0;
-		response[5] = 0;
-		response[6] = (unsigned char)((length >> 24) & 255);
-		response[7] = (unsigned char)((length >> 16) & 255);
-		response[8] = (unsigned char)((length >> 8) & 255);
-		response[9] = (unsigned char)(length & 255);
-		response[10] = masks[0];
-		response[11] = masks[1];
-		response[12] = masks[2];
-		response[13] = masks[3];
+	if (!m_connected) {
+		m_stats.send_failures++;
+		return 0;
+	}
+	if (opcode & 0x08) {
+		if (length > 125) {
+			m_stats.send_failures++;
+			return 0;
+		}
+		lane = WS_TX_LANE_CTL;
+	} else if (type & WS_FR_URGENT) {
+		lane = WS_TX_LANE_URGENT;
+	}
+	m = ws_msg_alloc(length);
+	if (!m) {
+		m_stats.send_failures++;
+		return 0;
+	}
+	if (size0) memcpy(m->data, msg0, size0);
+	if (size1) memcpy(&m->data[size0], msg1, size1);
+	m->owner = this;
+	m->kind = WS_MSG_WS_TX;
+	m->id = opcode;
+	pendingAdd(length);
+	while (!ws_ring_push(&m_txq[lane], m)) {
+		/* Queue full - the TX task is behind the link */
+		if (nowait || (!m_connected) || (xTaskGetTickCount() - t0 >= WS_LOCK_TIMEOUT)) {
+			m_stats.tx_queue_full++;
+			pendingAdd(-(int32_t)length);
+			ws_msg_unref(m);
+			if (nowait && m_connected) {
+				m_stats.tx_would_block++;
+				return WS_WOULD_BLOCK;
+			}
+			m_stats.send_failures++;
+			return 0;
+		}
+		vTaskDelay(1);
 	}
+	m_stats.tx_queued++;
+	xTaskNotifyGive(m_txHandle);
+	return 1;
+}
 
-	idx_response = idx_header;
+/*!
+ * \brief Full-duplex: write one unfragmented frame (TX task).
+ */
+int WebSocketClient::txFrame(const char* msg, uint32_t size, int opcode)
+{
+	int res;
 
-	/* Add data bytes and apply mask. */
-	for (i = 0; i < size0; i++) {
-		response[idx_response] = msg0[i] ^ masks[i % 4];
-		idx_response++;
+	xSemaphoreTake(m_lock, portMAX_DELAY);
+	res = m_connected ? writeFrame(msg, size, NULL, size, 0, opcode, true) : 0;
+	xSemaphoreGive(m_lock);
+	if (!res) m_stats.send_failures++;
+	return res;
+}
+
+/*!
+ * \brief Full-duplex: write queued message (TX task), control frames go out between fragments.
+ */
+void WebSocketClient::txWrite(WsMsg* m)
+{
+	uint32_t off = 0, chunk = m_txBuf - 15;
+	int opcode = m->id, res = 1;
+	WsMsg* c;
+
+	if (m->len > chunk) m_stats.tx_fragmented++;
+	do {
+		uint32_t n = (m->len - off > chunk) ? chunk : m->len - off;
+		if ((off > 0) && (!(opcode & 0x08))) {
+			while ((c = (WsMsg*)ws_ring_pop(&m_txq[WS_TX_LANE_CTL])) != NULL) {
+				txWrite(c);
+				ws_msg_unref(c);
+			}
+		}
+		xSemaphoreTake(m_lock, portMAX_DELAY);
+		res = m_connected ? writeFrame(m->data, m->len, NULL, n, off, (off == 0) ? opcode : WS_FR_OP_CONT, off + n == m->len) : 0;
+		xSemaphoreGive(m_lock);
+		if (res) {
+			off += n;
+			pendingAdd(-(int32_t)n);
+		}
+	} while (res && (off < m->len));
+	if (!res) {
+		pendingAdd(-(int32_t)(m->len - off));
+		m_stats.send_failures++;
+	} else if ((!(opcode & 0x08)) && m_txWanted && m_txcb) {
+		/* Lane is free - let waiting data go */
+		m_txcb(this);
 	}
-	for (i = 0; i < size1; i++) {
-		response[idx_response] = msg1[i] ^ masks[(size0 + i) % 4];
-		idx_response++;
+}
+
+/*!
+ * \brief Full-duplex: drop queued messages (connection lost).
+ */
+void WebSocketClient::txDrop()
+{
+	WsMsg* m;
+
+	for (int i = 0; i < WS_TX_LANES; i++) {
+		while ((m = (WsMsg*)ws_ring_pop(&m_txq[i])) != NULL) {
+			pendingAdd(-(int32_t)m->len);
+			m_stats.send_failures++;
+			ws_msg_unref(m);
+		}
 	}
-	response[idx_response] = '\0';
+}
 
-	res = (directSend((const char*)response, idx_response, m_writeTimeout) == idx_response) ? 1 : 0;
-	/* Free allocated memory */
-	if (allocated) free(response);
+/*!
+ * \brief Full-duplex: send heartbeat when due (TX task).
+ * \return time to the next heartbeat in [ms].
+ */
+int WebSocketClient::txHeartbeat()
+{
+	uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	int next = WS_TX_IDLE_MS;
 
-	xSemaphoreGive(m_lock);
+	if (m_hbEnabled) {
+		/* Engine.IO v3 ping (network task checks the answer) */
+		if (m_sio_v < 4) next = eioPing(now);
+	} else if (m_ping_interval) {
+		next = (int)(m_txPingMs + m_ping_interval - now);
+		if (next <= 0) {
+			/* Network task drops the link when it goes idle with the ping unanswered */
+			m_linkLost = !sendPing();
+			m_txPingMs = now;
+			next = m_ping_interval;
+		}
+	}
+	return next;
+}
 
-	return ((int)res);
+/*!
+ * \brief TX task function (full-duplex mode).
+ */
+void WebSocketClient::runTx()
+{
+	WsMsg* m;
+	int wait, i;
+
+	cl_ws_debug("TX task ready");
+	while (true) {
+		if (!m_connected) {
+			txDrop();
+			ulTaskNotifyTake(pdTRUE, WS_TX_IDLE_MS / portTICK_PERIOD_MS);
+			continue;
+		}
+		wait = txHeartbeat();
+		/* Control frames, then urgent, then data messages */
+		for (i = 0, m = NULL; (i < WS_TX_LANES) && (!m); i++) m = (WsMsg*)ws_ring_pop(&m_txq[i]);
+		if (m) {
+			txWrite(m);
+			ws_msg_unref(m);
+			continue;
+		}
+		ulTaskNotifyTake(pdTRUE, wait / portTICK_PERIOD_MS + 1);
+	}
 }
 
 /*!
@@ -534,17 +1362,26 @@ int WebSocketClient::onWsFrame()
 	switch (ws_frame_type) {
 		case WS_FR_OP_CONT: {
 			cl_ws_debug("Got CONT frame (size = %d)", cnt);
+			if (m_rxText) {
+				if (!checkUtf8(cnt)) return 0;
+				if (ws_is_fin) m_rxText = false;
+			}
 			if (m_cb) {
 				m_cb(this, ws_msg, cnt, WS_FR_OP_CONT);
 			}
 		} break;
 		case WS_FR_OP_TXT: {
 			cl_ws_debug("Got TXT frame (size = %d)", cnt);
+			if (m_utf8Check) {
+				ws_utf8_reset(&m_utf8);
+				if (!checkUtf8(cnt)) return 0;
+				m_rxText = !ws_is_fin;
+			}
 			if (m_cb) {
 				m_cb(this, ws_msg, cnt, WS_FR_OP_TXT);
 			}
 			/* Analize and execute on callbacks */
-			if (m_on.size()) {
+			if (!m_on.empty()) {
 				char* k = ws_msg, *x;
 				int len = cnt;
 				bool lev = false;
@@ -552,16 +1389,30 @@ int WebSocketClient::onWsFrame()
 				while ((len > 0) && ((*k == '[') || (*k == '"') || (*k == ' '))) { if (*k == '"') lev = true; k++;len--; }
 				x = k + 1;len--;
 				while ((len > 0) && (*x != '"') && (*x != ',') && ((lev) || (*x != ' '))) { x++; len--; }
-				std::string key(k, (int)(x - k));
-				cl_ws_debug("key (%s)", key.c_str());
-				auto itr = m_on.find(key);
-				if ((len > 1) && (itr != m_on.end())) {
+				int kLen = x - k;
+				cl_ws_debug("key (%.*s)", kLen, k);
+				WsHandlerTable<RVWebSocketON>::Reader r(&m_on);
+				const WsHandlerTable<RVWebSocketON>::Entry* e, * eEnd;
+				e = r.find(k, kLen, &eEnd);
+				if ((len > 1) && e) {
 					x++;len--;
 					while ((len > 0) && ((*x == ',') || (*x == ' '))) { x++; len--; }
 					while ((len > 0) && ((x[len - 1] == ']') || (x[len - 1] == ' '))) { x[len - 1] = '\0'; len--; }
 					if (len > 0) {
-						if (itr != m_on.end()) {
-							itr->second(this, x, len);
+						if (m_disp) {
+							/* Handler runs on the worker selected by key (key + '\0' + arguments in one copy) */
+							WsMsg* m = ws_msg_alloc(kLen + 1 + len);
+							if (m) {
+								memcpy(m->data, e->key, kLen + 1);
+								memcpy(&m->data[kLen + 1], x, len);
+								m->owner = this;
+								m->kind = WS_MSG_WS_ON;
+								m->off = kLen + 1;
+								m->len = len;
+								m_disp->post(e->key, kLen, m, &WebSocketClient::dispatchMsg);
+							}
+						} else {
+							e->h(this, x, len);
 						}
 					}
 				}
@@ -569,6 +1420,7 @@ int WebSocketClient::onWsFrame()
 		} break;
 		case WS_FR_OP_BIN: {
 			cl_ws_debug("Got BIN frame (size = %d)", cnt);
+			m_rxText = false;
 			if (m_cb) {
 				m_cb(this, ws_msg, cnt, WS_FR_OP_BIN);
 			}
@@ -589,6 +1441,7 @@ int WebSocketClient::onWsFrame()
 						cl_ws_debug("Bad PONG counter!");
 						return 0;
 					}
+					rttSample(WS_RTT_PING, (uint32_t)(esp_timer_get_time() - m_pingUs));
 				}
 			}
 		} break;
@@ -596,6 +1449,34 @@ int WebSocketClient::onWsFrame()
 	}
 	return 1;
 }
+/*!
+ * \brief Validate text message data (ws_msg), fail the connection with close code 1007 on invalid UTF-8.
+ */
+bool WebSocketClient::checkUtf8(int cnt)
+{
+	if (ws_utf8_feed(&m_utf8, ws_msg, cnt) && ((!ws_is_fin) || ws_utf8_complete(&m_utf8))) return true;
+	cl_ws_error("Invalid UTF-8 in text message");
+	m_stats.utf8_errors++;
+	m_rxText = false;
+	/* Close code 1007 - invalid frame payload data (full-duplex: written now, the link is closed
+	 * before the TX task would take it from the queue) */
+	if (m_duplex) txFrame("\x03\xEF", 2, WS_FR_OP_CLOSE);
+	else send("\x03\xEF", 2, WS_FR_OP_CLOSE);
+	return false;
+}
+
+/*!
+ * \brief Worker side of the dispatcher (on() handlers).
+ */
+void WebSocketClient::dispatchMsg(WsMsg* m)
+{
+	WebSocketClient* c = (WebSocketClient*)m->owner;
+	WsHandlerTable<RVWebSocketON>::Reader r(&c->m_on);
+	const WsHandlerTable<RVWebSocketON>::Entry* e, * eEnd;
+	/* Handler may have been removed meanwhile */
+	e = r.find(m->data, m->off - 1, &eEnd);
+	if (e) e->h(c, &m->data[m->off], m->len);
+}
 //===========================================================================
 
 /*!
@@ -605,11 +1486,20 @@ int WebSocketClient::feedWsFrame()
 {
 	uint8_t opcode;
 	int i, cur_byte, cnt;
+	uint64_t len;
 
 	cl_ws_debug("WS (total = %d)", line_end);
 
+	/* Payload of a sink frame */
+	if (m_sinkLeft) return feedSink();
 	if (ws_frame_size == 0) {
-		unsigned char* b = (unsigned char*)rx_buf;
+		unsigned char* b;
+		/* Grow RX buffer requested by the open packet (previous frame is done with rx_buf) */
+		if (m_rxWant) {
+			if (rxResize(m_rxWant)) m_rxSize = m_rxWant;
+			m_rxWant = 0;
+		}
+		b = (unsigned char*)rx_buf;
 		/* Check for frame size */
 		ws_header_size = 2;
 		if (line_end < 2) return 0;
@@ -622,24 +1512,45 @@ int WebSocketClient::feedWsFrame()
 			return -1;
 		}
 		cur_byte = *b++;
-		cnt = cur_byte & 0x7F;
+		len = cur_byte & 0x7F;
 		ws_is_mask = (cur_byte & 0xFF) >> 7;
 		if (ws_is_mask) {
 			cl_ws_debug("Frame masked! (opcode = %d)", opcode);
 			return -1;
 		}
-		if (cnt == 126) {
+		if (len == 126) {
 			ws_header_size += 2;
 			if (line_end < ws_header_size) return 0;
 			cur_byte = *b++;
-			cnt = (((uint64_t)cur_byte) << 8);
+			len = (((uint64_t)cur_byte) << 8);
 			cur_byte = *b++;
-			cnt |= cur_byte;
-		} else if (cnt == 127) {
-			/* Unsupported :-( */
-			cl_ws_debug("Frame too long!");
-			return -1;
+			len |= cur_byte;
+		} else if (len == 127) {
+			ws_header_size += 8;
+			if (line_end < ws_header_size) return 0;
+			for (len = 0, i = 0; i < 8; ++i) len = (len << 8) | *b++;
+			/* RFC 6455 5.2: most significant bit must be 0 */
+			if (len >> 63) {
+				cl_ws_debug("Frame length MSB set!");
+				return -1;
+			}
+		}
+		/* Binary message for the sink - streamed, may be larger than the buffer */
+		if ((opcode == WS_FR_OP_BIN) ? (m_sink && !m_sinkMsg) : ((opcode == WS_FR_OP_CONT) && m_sinkMsg)) {
+			return sinkFrame(len);
 		}
+		/* Compare without adding the header to len (no wrap around) */
+		if (len > (uint64_t)(m_maxBuf - ws_header_size)) {
+			if (len > (uint64_t)(m_rxSize - ws_header_size)) {
+				cl_ws_debug("Frame too long!");
+				return -1;
+			}
+			/* Low-memory mode: RX buffer grows to the frame (1 KB steps) */
+			cnt = ((int)len + ws_header_size + 1023) & ~1023;
+			if (!rxResize((cnt < m_rxSize) ? cnt : m_rxSize)) return -1;
+		}
+		if (len + ws_header_size > WS_IDLE_RX_BUF) m_rxUsedMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+		cnt = (int)len;
 		ws_frame_size = ws_header_size + cnt;
 		cl_ws_debug("Got frame header (size = %d, opcode = %d, fin = %d, header = %d)", ws_frame_size, opcode, ws_is_fin, ws_header_size);
 	}
@@ -649,6 +1560,9 @@ int WebSocketClient::feedWsFrame()
 		if (line_end < ws_frame_size) return 0;
 		cnt = ws_frame_size - ws_header_size;
 		ws_msg = (char*)b;
+		WS_TRACE(WST_RX_FRAME, ws_frame_type, cnt);
+		m_stats.rx_frames[ws_frame_type]++;
+		m_stats.rx_bytes[ws_frame_type] += cnt;
 		/* Do something with the frame */
 		if (onWsFrame() == 0) return -1;
 		/* Copy next message */
@@ -680,14 +1594,32 @@ int WebSocketClient::sendPing()
 		/* Send ping */
 		snprintf(b, 15, "%04d", ws_ping_cnt);
 		cl_ws_debug("Send PING (%d)", ws_ping_cnt);
-		send(b, 4, WS_FR_OP_PING);
+		m_pingUs = esp_timer_get_time();
+		if (m_duplex) txFrame(b, 4, WS_FR_OP_PING);
+		else send(b, 4, WS_FR_OP_PING);
 
 	}
 	return 1;
 }
 
+/*!
+ * \brief Close the socket (full-duplex: after the frame the TX task is writing).
+ */
+void WebSocketClient::closeLink()
+{
+	if (!m_duplex) {
+		directClose();
+		m_connected = false;
+		return;
+	}
+	m_connected = false;
+	xSemaphoreTake(m_lock, portMAX_DELAY);
+	directClose();
+	xSemaphoreGive(m_lock);
+	/* Wake up the TX task to drop queued messages */
+	xTaskNotifyGive(m_txHandle);
+}
 
-#define MAX_MEMORY_BUFF (1024)
 
 /*!
  * \brief Task function (MAIN).
@@ -704,56 +1636,204 @@ void WebSocketClient::run()
 	while (true) {
 		/* ReConnect*/
 		if (!m_connected) {
+			if (m_stats.connects) {
+				m_stats.disconnects++;
+				WS_TRACE(WST_DISCONNECT, m_stats.connects, 0);
+				if (m_capture) m_capture->record(WSCAP_DISCONNECT, NULL, 0);
+			}
+			if (m_sinkMsg) sinkEnd(WS_SINK_ABORTED);
 			if (m_ccb) m_ccb(this, false);
+			if (m_lowMemMs) releaseAll();
 			while (!m_connected) {
+				int prev = m_ep;
 				line_begin = 0;
 				line_end = 0;
 				ws_frame_size = 0;
-				vTaskDelay(m_reconnectInterval / portTICK_PERIOD_MS);
-				this->connect(m_connectTimeout);
+				/* Another healthy endpoint is tried at once, the same one after the reconnect interval */
+				useEndpoint(pickEndpoint());
+				if ((m_ep == prev) || (m_eps[m_ep].down_us > esp_timer_get_time())) vTaskDelay(m_reconnectInterval / portTICK_PERIOD_MS);
+				if (this->connect(m_connectTimeout) != 1) {
+					m_stats.connect_failures++;
+					endpointFailed(m_ep);
+					if (m_lowMemMs) releaseAll();
+				}
+				WS_TRACE(WST_CONNECT, m_connected ? 1 : 0, m_stats.handshake_total_us);
 			}
 		}
+		/* Probe results - reconnect when a faster endpoint answers */
+		if (m_probeDone) {
+			m_probeDone = false;
+			if (probeResults()) {
+				cl_ws_info("Faster endpoint found - reconnect");
+				m_stats.endpoint_switches++;
+				closeLink();
+				continue;
+			}
+		}
+		if (m_lowMemMs) releaseIdle();
 		/* Poll */
-		if (m_ping_interval) {
+		if (m_hbEnabled) {
+			/* Engine.IO heartbeat - server ping cadence + pingTimeout */
+			if (!checkHeartbeat(&idx)) {
+				cl_ws_error("No heartbeat received! - remove socket");
+				closeLink();
+				continue;
+			}
+			if (m_txWanted && m_txcb) {
+				/* Upper layer waits for the link - retry often */
+				m_txcb(this);
+				if (idx > WS_TX_RETRY_MS) idx = WS_TX_RETRY_MS;
+			}
+			idx = directPollRead(idx);
+			if (idx == 0) {
+				continue;
+			} else if (idx < 0) {
+				cl_ws_debug("Remove socket");
+				closeLink();
+				continue;
+			}
+		} else if (m_ping_interval) {
 			idx = directPollRead(m_ping_interval);
 			if (idx == 0) {
-				/* Ping time */
-				if (!sendPing()) {
+				/* Ping time (TX task pings in full-duplex mode) */
+				if (m_duplex ? (bool)m_linkLost : !sendPing()) {
 					cl_ws_error("No PONG received! - remove socket");
-					directClose();
-					m_connected = false;
+					closeLink();
 				}
 				continue;
 			} else if (idx < 0) {
 				cl_ws_debug("Remove socket");
-				directClose();
-				m_connected = false;
+				closeLink();
 				continue;
 			}
 		}
 		/* Receive */
-		idx = directRecv(&rx_buf[line_end], (MAX_MEMORY_BUFF - line_end), -1);
+		idx = directRecv(&rx_buf[line_end], (m_maxBuf - line_end), -1);
 		/* Parse */
 		if (idx <= 0) {
 			cl_ws_debug("Remove socket");
-			directClose();
-			m_connected = false;
+			closeLink();
 			continue;
 		}
-		line_end += idx;
-		/* Parse websocket message */
-		while (idx > 0) {
-			idx = feedWsFrame();
-		}
-		if (idx < 0) {
+		if (parseRx(idx) < 0) {
 			cl_ws_debug("Remove socket");
-			directClose();
-			m_connected = false;
+			closeLink();
 			continue;
 		}
 	}
 }
 
+/*!
+ * \brief Parse n new bytes received at rx_buf[line_end].
+ * \return -1 on protocol error.
+ */
+int WebSocketClient::parseRx(int n)
+{
+	int r = 1;
+
+	if (m_capture) m_capture->record(WSCAP_DATA, &rx_buf[line_end], n);
+	line_end += n;
+	/* Parse websocket message */
+	while (r > 0) {
+		r = feedWsFrame();
+	}
+	return r;
+}
+
+/*!
+ * \brief Feed received bytes to the frame parser (capture replay, tests).
+ * \param data - bytes as returned by the socket,
+ * \param len - number of bytes.
+ * \return -1 on protocol error (or frame larger than RX buffer).
+ */
+int WebSocketClient::feed(const char* data, int len)
+{
+	if ((!rx_buf) && (!rxResize(m_rxSize))) return -1;
+	while (len > 0) {
+		int n = m_maxBuf - line_end;
+		if (n <= 0) return -1;
+		if (n > len) n = len;
+		memcpy(&rx_buf[line_end], data, n);
+		if (parseRx(n) < 0) return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Sink frame header arrived (and is still in rx_buf), payload follows.
+ * \param len - payload length.
+ */
+int WebSocketClient::sinkFrame(uint64_t len)
+{
+	WS_TRACE(WST_RX_FRAME, ws_frame_type, len);
+	m_stats.rx_frames[ws_frame_type]++;
+	m_stats.rx_bytes[ws_frame_type] += len;
+	if (ws_frame_type == WS_FR_OP_BIN) {
+		cl_ws_debug("Binary message to the sink (frame size = %llu)", (unsigned long long)len);
+		/* Sink is taken by this message, done() may arm it again for the next one */
+		m_sinkCur = m_sink;
+		m_sink = NULL;
+		m_sinkMsg = true;
+		m_rxText = false;
+		ws_sink_begin(m_sinkCur, ws_is_fin ? len : 0, esp_timer_get_time());
+	}
+	m_sinkFin = ws_is_fin;
+	m_sinkLeft = len;
+	/* Payload goes to the sink from the start of the buffer */
+	line_end -= ws_header_size;
+	memmove(rx_buf, &rx_buf[ws_header_size], line_end);
+	if ((!len) && m_sinkFin) sinkEnd(WS_SINK_OK);
+	return 1;
+}
+
+/*!
+ * \brief Pass received sink frame payload to the sink.
+ */
+int WebSocketClient::feedSink()
+{
+	int n = (line_end < m_sinkLeft) ? line_end : (int)m_sinkLeft;
+
+	if (n <= 0) return 0;
+	if (m_sinkCur && (ws_sink_write(m_sinkCur, rx_buf, n, esp_timer_get_time()) < 0)) {
+		cl_ws_error("Sink write failed - rest of the message dropped");
+		sinkEnd(WS_SINK_FAILED);
+	}
+	m_sinkLeft -= n;
+	line_end -= n;
+	if (line_end) memmove(rx_buf, &rx_buf[n], line_end);
+	if ((!m_sinkLeft) && m_sinkFin) sinkEnd(WS_SINK_OK);
+	return n;
+}
+
+/*!
+ * \brief Sink message ended (WS_SINK_FAILED - drop the rest of the message).
+ */
+void WebSocketClient::sinkEnd(int status)
+{
+	WsSink* s = m_sinkCur;
+
+	m_sinkCur = NULL;
+	if (status != WS_SINK_FAILED) {
+		m_sinkMsg = false;
+		m_sinkLeft = 0;
+	}
+	if (s) ws_sink_end(s, status);
+}
+
+/*!
+ * \brief Drop partially received frame (start of a new connection).
+ */
+void WebSocketClient::resetRx()
+{
+	line_begin = 0;
+	line_end = 0;
+	ws_frame_size = 0;
+	m_rxText = false;
+	if (m_sinkMsg) sinkEnd(WS_SINK_ABORTED);
+}
+
 static void WebSocketClientRunTask(void* arg) 
 {
 	WebSocketClient* p = (WebSocketClient*) arg;
@@ -761,12 +1841,32 @@ static void WebSocketClientRunTask(void* arg)
 	p->stop();
 }
 
+static void WebSocketClientTxTask(void* arg)
+{
+	WebSocketClient* p = (WebSocketClient*) arg;
+	p->runTx();
+}
+
+static void WebSocketClientProbeTask(void* arg)
+{
+	WebSocketClient* p = (WebSocketClient*) arg;
+	p->runProbe();
+}
+
 /*!
  * \brief Stop WebSocketClient task.
  */
 void WebSocketClient::stop() 
 {
 	if (m_handle == nullptr) return;
+	if (m_txHandle) {
+		::vTaskDelete(m_txHandle);
+		m_txHandle = NULL;
+	}
+	if (m_probeHandle) {
+		::vTaskDelete(m_probeHandle);
+		m_probeHandle = NULL;
+	}
 	::vTaskDelete(m_handle);
 	m_handle = NULL;
 }
@@ -776,6 +1876,8 @@ void WebSocketClient::stop()
  */
 void WebSocketClient::start() 
 {
+	if (m_duplex) ::xTaskCreatePinnedToCore(&WebSocketClientTxTask, "WebSocketTx", m_stackSize, this, m_txPriority, &m_txHandle, m_txCoreId);
+	if (m_probeMs && (m_epCount > 1)) ::xTaskCreatePinnedToCore(&WebSocketClientProbeTask, "WebSocketProbe", m_stackSize / 2, this, m_priority, &m_probeHandle, tskNO_AFFINITY);
 	::xTaskCreatePinnedToCore(&WebSocketClientRunTask, "WebSocketClient", m_stackSize, this, m_priority, &m_handle, m_coreId);
 }
 
@@ -10,15 +10,25 @@
 #ifndef __RV_WEBSOCKETCLIENT__
 #define __RV_WEBSOCKETCLIENT__
 
-#include <functional>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/timers.h>
 #include <esp_transport.h>
 #include <esp_transport_tcp.h>
 #include <esp_transport_ssl.h>
+#include "wstransport.h"
+#include "wsstats.h"
+#include "wscapture.h"
+#include "wsdispatch.h"
+#include "wsutf8.h"
+#include "wsdelegate.h"
+#include "wshandlers.h"
+#include "wsring.h"
+#include "wssink.h"
+#include <atomic>
 #include <map>
 #include <string>
+#include <string.h>
 
 #define WS_FR_OP_CONT  (0)
 #define WS_FR_OP_TXT   (1)
@@ -27,11 +37,68 @@
 #define WS_FR_OP_PING  (0x9)
 #define WS_FR_OP_PONG  (0xA)
 
+#define WS_FR_URGENT   (0x100)  ///< send() flag: urgent lane, sent before waiting data messages
+#define WS_FR_NOWAIT   (0x200)  ///< send() flag: return WS_WOULD_BLOCK instead of waiting
+
+#define WS_WOULD_BLOCK (-2)     ///< trySend(): socket not writable or TX lane busy
+
+#define WS_TX_RETRY_MS (10)     ///< Network task poll period while the upper layer waits to send
+
+#ifndef WS_TX_QUEUE_LEN
+#define WS_TX_QUEUE_LEN (32)    ///< Full-duplex: messages waiting per TX lane
+#endif
+
+/* Full-duplex TX lanes (TX task empties them in this order) */
+#define WS_TX_LANE_CTL    (0)   ///< Control frames (also between fragments)
+#define WS_TX_LANE_URGENT (1)   ///< Urgent messages
+#define WS_TX_LANE_DATA   (2)   ///< Data messages
+#define WS_TX_LANES       (3)
+
+#define WS_ENDPOINTS_MAX      (4)       ///< Server endpoints (constructor url + addEndpoint())
+#define WS_ENDPOINT_HOLD_MS   (60000)   ///< Longest time a failing endpoint is skipped
+#define WS_ENDPOINT_MARGIN_US (20000)   ///< Another endpoint must be faster by this much to replace the current one
+#define WS_PROBE_TIMEOUT_MS   (3000)    ///< Background probe connect timeout
+
+#ifndef WS_IDLE_RX_BUF
+#define WS_IDLE_RX_BUF        (256)     ///< Low-memory mode: RX buffer size between large messages
+#endif
+#define WS_SMALL_FRAME        (125)     ///< Frames up to this payload are built on the stack, not in tx_buf
+
+/*!
+ * \brief Server endpoint - parsed url, health and latency.
+ */
+typedef struct {
+    char*       url;                     /*!< Copy of the url (parsed in place)        */
+    const char* host;
+    const char* path;
+    int         port;
+    bool        ssl;
+    bool        sio;
+    uint32_t    rtt_us;                  /*!< Smoothed TCP connect time (0 - unknown)  */
+    uint32_t    failures;                /*!< Failed connects in a row                 */
+    int64_t     down_us;                 /*!< Skipped until this time [us]             */
+    uint32_t    connects;                /*!< Successful connects                      */
+} WsEndpoint;
+
 class WebSocketClient;
 
-typedef std::function<void(WebSocketClient* c, char* msg, int len, int type)> RVWebSocketCB;
-typedef std::function<void(WebSocketClient* c, bool connected)> RVWebSocketConnectedCB;
-typedef std::function<void(WebSocketClient* c, char* msg, int len)> RVWebSocketON;
+/*!
+ * \brief Get raw value of the top level JSON field (quotes and spaces stripped).
+ * \param json - JSON object text (does not have to be NULL terminated),
+ * \param len - JSON text length in bytes,
+ * \param key - field name,
+ * \param out - output buffer,
+ * \param outLen - output buffer size in bytes.
+ * \return value length or -1 when field is missing.
+ */
+int sio_json_field(const char* json, int len, const char* key, char* out, int outLen);
+
+typedef WsDelegate<void(WebSocketClient* c, char* msg, int len, int type)> RVWebSocketCB;
+typedef WsDelegate<void(WebSocketClient* c, bool connected)> RVWebSocketConnectedCB;
+typedef WsDelegate<void(WebSocketClient* c, char* msg, int len)> RVWebSocketON;
+typedef WsDelegate<void(WebSocketClient* c, int src, uint32_t rtt_us)> RVWebSocketRttCB;
+typedef WsDelegate<void(WebSocketClient* c, bool above, uint32_t buffered)> RVWebSocketWatermarkCB;
+typedef WsDelegate<void(WebSocketClient* c)> RVWebSocketTxReadyCB;
 
 class WebSocketClient {
 public:
@@ -51,20 +118,104 @@ public:
      * \brief Send WebSocket frame (use tx_buffer).
      * \param msg - pointer to message data,
      * \param size - message size in bytes,
-     * \param type - message type.
+     * \param type - message type (| WS_FR_URGENT for the urgent lane).
      */
     int send(const char* msg, uint32_t size, int type = WS_FR_OP_TXT);
 
     /*!
      * \brief Send WebSocket frame (use tx_buffer).
+     *
+     * Messages larger than tx_buf are sent in fragments, control frames (ping, pong, close)
+     * go out between fragments, urgent messages (WS_FR_URGENT) before other waiting messages.
+     *
      * \param msg0 - pointer to message0 data,
      * \param size0 - message0 size in bytes,
      * \param msg1 - pointer to message0 data,
      * \param size1 - message0 size in bytes,
-     * \param type - message type.
+     * \param type - message type (| WS_FR_URGENT for the urgent lane).
      */
     int send2(const char* msg0, uint32_t size0, const char* msg1, uint32_t size1, int type = WS_FR_OP_TXT);
 
+    /*!
+     * \brief Send WebSocket frame without waiting (socket not writable or another message on the wire).
+     * \param msg - pointer to message data,
+     * \param size - message size in bytes,
+     * \param type - message type (| WS_FR_URGENT for the urgent lane).
+     * \return 1 - sent, WS_WOULD_BLOCK - try again later, <= 0 - error.
+     */
+    int trySend(const char* msg, uint32_t size, int type = WS_FR_OP_TXT);
+
+    /*!
+     * \brief Bytes accepted by send() and not yet written to the socket (waiting for the TX lane or in progress).
+     */
+    uint32_t getBufferedAmount() const { return m_pending; }
+
+    /*!
+     * \brief Set buffered bytes watermarks (high = 0 - disabled).
+     * \param high - callback with above = true when buffered bytes reach high,
+     * \param low - callback with above = false when buffered bytes drop to low again,
+     * \param cb - watermark callback (called from the sending task).
+     */
+    void setWatermarks(uint32_t high, uint32_t low, RVWebSocketWatermarkCB cb);
+
+    /*!
+     * \brief Set TX ready callback - while data waits (setTxWanted(true)) it is called after every
+     * data message (by the sending task) and every WS_TX_RETRY_MS by the network task, so data
+     * which could not be sent without waiting goes out as soon as the link allows.
+     */
+    void setTxReadyCB(RVWebSocketTxReadyCB cb) { m_txcb = cb; }
+    void setTxWanted(bool b) { m_txWanted = b; }
+
+    /*!
+     * \brief Full-duplex mode (call before start()).
+     *
+     * A TX task writes all frames and sends the heartbeats, the network task only reads and parses.
+     * send() copies the message to a lock-free queue of its lane (control, urgent, data) and returns
+     * without touching the socket, so a slow link never stalls the receive path or the sender.
+     *
+     * \param on - enable,
+     * \param coreID - TX task CPU core (network task keeps coreID from the constructor),
+     * \param pr - TX task priority (0 - same as the network task),
+     * \param queueLen - messages waiting per lane (send() waits or returns WS_WOULD_BLOCK when full).
+     */
+    void setFullDuplex(bool on, BaseType_t coreID = tskNO_AFFINITY, uint8_t pr = 0, uint32_t queueLen = WS_TX_QUEUE_LEN);
+    bool isFullDuplex() const { return m_duplex; }
+
+    /*!
+     * \brief Add server endpoint (call before start()).
+     *
+     * The client connects to the healthy endpoint with the lowest TCP connect time (endpoints not
+     * measured yet in list order). A failed connect holds the endpoint back (reconnect interval
+     * doubled per failure, up to WS_ENDPOINT_HOLD_MS) and the next healthy endpoint is tried at once.
+     *
+     * \param url - url with the same scheme as the constructor url (ws, wss, http or https).
+     * \return endpoint index or -1 (list full, other scheme, task running).
+     */
+    int addEndpoint(const char* url);
+    int getEndpointCount() const { return m_epCount; }
+
+    /*!
+     * \brief Endpoint of the current (or last) connection.
+     */
+    int getEndpoint() const { return m_ep; }
+    const WsEndpoint* getEndpointInfo(int i) const { return ((i >= 0) && (i < m_epCount)) ? &m_eps[i] : NULL; }
+
+    /*!
+     * \brief Probe all endpoints (TCP connect) every ms while connected and move the connection to
+     * an endpoint faster by WS_ENDPOINT_MARGIN_US (0 - off, call before start()).
+     */
+    void setEndpointProbe(uint32_t ms) { if (!m_handle) m_probeMs = ms; }
+    uint32_t getEndpointProbe() const { return m_probeMs; }
+
+    /*!
+     * \brief Stream the next binary message into sink (NULL - disarm).
+     *
+     * Frames of the message go to the sink as they arrive instead of the message callback, so they
+     * may be larger than the RX buffer (64-bit frame length). The sink is used for one message -
+     * arm it again from sink->done for the next one. Call from a callback or before the message.
+     */
+    void setSink(WsSink* sink) { m_sink = sink; }
+    WsSink* getSink() const { return m_sink; }
 
     /*!
      * \brief Set on message callback.
@@ -91,6 +242,16 @@ public:
      */
     void run();
 
+    /*!
+     * \brief TX task function (full-duplex mode).
+     */
+    void runTx();
+
+    /*!
+     * \brief Probe task function (setEndpointProbe()).
+     */
+    void runProbe();
+
 
     /* Parameters */
     void setPingInterval(int ms) { m_ping_interval = ms; }
@@ -108,15 +269,157 @@ public:
     void setReadTimeout(int ms) { m_readTimeout = ms; }
     int  getReadTimeout() const { return m_readTimeout; }
 
+    /*!
+     * \brief Socket.IO: open WebSocket transport directly (skip HTTP long-polling and probe).
+     */
+    void setWebSocketOnly(bool b) { m_sioWsOnly = b; }
+    bool isWebSocketOnly() const { return m_sioWsOnly; }
+
+    /*!
+     * \brief TLS: server CA certificate (PEM, NULL terminated, must stay valid).
+     */
+    void setCACert(const char* pem);
+
+    /*!
+     * \brief TLS: verify server with ESP-IDF certificate bundle.
+     */
+    void setCrtBundle(bool b);
+
+    /*!
+     * \brief TLS: offer session from the previous connection on reconnect (default off, set before start()).
+     * Off - wss:// goes through esp_transport_ssl (m_tr), on - through WsTransport which keeps the session.
+     */
+    void setTlsSessionResume(bool b);
+    bool getTlsSessionResume() const { return m_transport->getSessionResume(); }
+
+    /*!
+     * \brief TLS: last (re)connect resumed session instead of full handshake.
+     */
+    bool isTlsResumed() const { return m_transport->isResumed(); }
+
+    /*!
+     * \brief Keep resolved server addresses for ms (default WS_DNS_CACHE_MS, 0 - resolve on every connect).
+     */
+    void setDnsCacheTime(uint32_t ms) { m_transport->setDnsCacheTime(ms); }
+    uint32_t getDnsCacheTime() const { return m_transport->getDnsCacheTime(); }
+
+    /*!
+     * \brief Upper limit for RX buffer growth when server advertises larger maxPayload.
+     */
+    void setMaxBufLimit(int size) { m_maxBufLimit = size; }
+    int  getMaxBufLimit() const { return m_maxBufLimit; }
+
+    /*!
+     * \brief Low-memory mode: free RX/TX buffers while disconnected, shrink RX buffer to WS_IDLE_RX_BUF
+     * and free TX buffer when not needed for idleMs (0 - off, buffers stay allocated once used).
+     * RX buffer grows to the size of large frames (up to the limit), TX buffer comes back with the next
+     * frame longer than WS_SMALL_FRAME. Idle time is checked whenever the network task wakes up.
+     */
+    void setLowMemory(uint32_t idleMs) { m_lowMemMs = idleMs; }
+    uint32_t getLowMemory() const { return m_lowMemMs; }
+
+    /*!
+     * \brief Task stack size in bytes (default 10000), set before start().
+     * Check getMemStats() stack_free under the real load before going lower.
+     */
+    void setStackSize(uint16_t size) { m_stackSize = size; }
+    uint16_t getStackSize() const { return m_stackSize; }
+
+    /*!
+     * \brief Get current and peak memory footprint.
+     */
+    void getMemStats(WsMemStats* m) const;
+
+    /* Engine.IO parameters (from open packet) */
+    int  getEioPingInterval() const { return m_eioPingInterval; }
+    int  getEioPingTimeout() const { return m_eioPingTimeout; }
+    int  getEioMaxPayload() const { return m_eioMaxPayload; }
+
+    /*!
+     * \brief Parse Engine.IO open packet and enable server driven heartbeat.
+     * \param json - open packet JSON ({"sid":...,"pingInterval":...,"pingTimeout":...,"maxPayload":...}),
+     * \param len - JSON length in bytes.
+     */
+    int parseOpenPacket(const char* json, int len);
+
+    /*!
+     * \brief Engine.IO heartbeat arrived (ping from v4 server or pong from v3 server).
+     * \param pong - pong (answer to our ping) arrived.
+     */
+    void heartbeat(bool pong = false);
+
+    /*!
+     * \brief Add round-trip time sample.
+     * \param src - sample source (WS_RTT_xxx),
+     * \param us - round-trip time in [us].
+     */
+    void rttSample(int src, uint32_t us);
+
+    /*!
+     * \brief Set callback called on every round-trip time sample (network task context).
+     */
+    void setRttCB(RVWebSocketRttCB cb) { m_rttcb = cb; }
+
+    /*!
+     * \brief Get round-trip time histogram of the source (WS_RTT_xxx).
+     */
+    void getRtt(int src, WsLatencyHist* h) const { memcpy(h, &m_stats.rtt[src], sizeof(WsLatencyHist)); }
+
     bool isConnected() const { return m_connected; }
 
+    /*!
+     * \brief Record received bytes into capture (NULL - stop, capture is not owned).
+     */
+    void setCapture(WsCapture* cap) { m_capture = cap; }
+
+    /*!
+     * \brief Run on() handlers on dispatcher workers instead of the network task (NULL - network task).
+     * The frame callback (setCB) stays on the network task. Dispatcher is not owned.
+     */
+    void setDispatcher(WsDispatcher* d) { m_disp = d; }
+
+    /*!
+     * \brief Check UTF-8 of received text messages, close the connection (1007) on invalid data (default on).
+     */
+    void setUtf8Check(bool b) { m_utf8Check = b; }
+    bool getUtf8Check() const { return m_utf8Check; }
+
+    /*!
+     * \brief Feed received bytes to the frame parser (capture replay, tests).
+     * \param data - bytes as returned by the socket,
+     * \param len - number of bytes.
+     * \return -1 on protocol error (or frame larger than RX buffer).
+     */
+    int feed(const char* data, int len);
 
+    /*!
+     * \brief Drop partially received frame (start of a new connection).
+     */
+    void resetRx();
+
+    /*!
+     * \brief Get snapshot of performance counters.
+     */
+    void getStats(WebSocketStats* s) const { memcpy(s, &m_stats, sizeof(WebSocketStats)); }
+
+    /*!
+     * \brief Clear performance counters.
+     */
+    void resetStats() { memset(&m_stats, 0, sizeof(WebSocketStats)); }
+
+
+    /*!
+     * \brief Set handler of messages with key (replaces the previous one, safe while running).
+     */
     void on(std::string what, RVWebSocketON cb) {
-        m_on.insert({ what, cb });
+        m_on.add(what.c_str(), what.length(), cb, true);
     }
 
+    /*!
+     * \brief Remove handler of key (safe while running).
+     */
     void off(std::string what) {
-        m_on.erase(what);
+        m_on.remove(what.c_str(), what.length());
     }
 
 private:
@@ -125,20 +428,52 @@ private:
      * \param timeout_ms - timeout in [ms].
      */
     int connect(int timeout_ms = 10000);
-    void parseURL();
+    void selectTransport();
+    bool rxResize(int size);
+    bool txAlloc();
+    void txFree();
+    void memAdd(int delta);
+    void releaseIdle();
+    void releaseAll();
+    void parseURL(char* url, WsEndpoint* e);
+    void useEndpoint(int i);
+    int pickEndpoint();
+    void endpointFailed(int i);
+    void endpointRtt(int i, uint32_t us);
+    bool probeResults();
     int feedWsFrame();
     int onWsFrame();
     int sendPing();
+    int checkHeartbeat(int* wait);
+    int eioPing(uint32_t now);
+    void closeLink();
+    int parseRx(int n);
+    int sinkFrame(uint64_t len);
+    int feedSink();
+    void sinkEnd(int status);
+    static void dispatchMsg(WsMsg* m);
+    bool checkUtf8(int cnt);
+    int writeFrame(const char* msg0, uint32_t size0, const char* msg1, uint32_t length, uint32_t off, int opcode, bool fin);
+    bool takeDataLane(bool urgent, TickType_t timeout);
+    void pendingAdd(int32_t delta);
+    int queueMsg(const char* msg0, uint32_t size0, const char* msg1, uint32_t size1, int type);
+    int txFrame(const char* msg, uint32_t size, int opcode);
+    void txWrite(WsMsg* m);
+    int txHeartbeat();
+    void txDrop();
 
 public:
+    WsTransport*      m_transport;          /*!< TCP/TLS transport (TLS with session resume) */
+    esp_transport_handle_t m_sslTr;         /*!< esp_transport_ssl (wss://, NULL - ws://) */
     esp_transport_handle_t m_tr; /* Transport */
     /* Parameters from link */
-    char* m_url;
+    char* m_url;                            /*!< Current endpoint url                */
     char* m_token;
     int               m_port;
     bool              m_ssl;
     bool              m_sio;
     int               m_sio_v;
+    bool              m_sioWsOnly;          /*!< Socket.IO without polling handshake */
     const char* m_path;
     const char* m_host;
     /* Parameters */
@@ -149,11 +484,22 @@ public:
     /* RX/TX buffers */
     int               m_maxBuf;
     int               m_maxBufC;
+    int               m_maxBufLimit;        /*!< RX buffer growth limit              */
+    int               m_rxSize;             /*!< RX buffer size for the connection (m_maxBuf - allocated now) */
+    int               m_rxWant;             /*!< RX buffer size from the open packet (applied between frames) */
     char             *rx_buf;
     int               line_begin;           /*!< next line start pointer             */
     int               line_pos;             /*!< current position in buffer          */
     int               line_end;             /*!< End of arrived data in the buffer   */
     char             *tx_buf;
+    int               m_txBuf;              /*!< TX buffer size (max. frame size)    */
+    /* Memory */
+    uint32_t          m_lowMemMs;           /*!< Release buffers idle for ms (0 - off) */
+    uint32_t          m_rxUsedMs;           /*!< Last frame larger than WS_IDLE_RX_BUF [ms] */
+    uint32_t          m_txUsedMs;           /*!< Last frame built in tx_buf [ms]     */
+    std::atomic<uint32_t> m_memBuf;         /*!< RX + TX buffer bytes                */
+    std::atomic<uint32_t> m_memPeak;        /*!< Largest m_memBuf                    */
+    uint32_t          m_memReleases;        /*!< Buffers freed or shrunk             */
     /* Current frame info */
     uint8_t           ws_frame_type;        /*!< Websocket frame type                */
     uint8_t           ws_is_fin;            /*!< Websocket frame is final            */
@@ -162,16 +508,69 @@ public:
     int               ws_header_size;       /*!< Websocket frame header size         */
     int               ws_frame_size;        /*!< Websocket frame size                */
     char             *ws_msg;               /*!< Websocket frame message pointer     */
+    bool              m_utf8Check;          /*!< Validate UTF-8 of text messages     */
+    bool              m_rxText;             /*!< Text message being validated        */
+    WsUtf8            m_utf8;               /*!< UTF-8 validator state               */
+    /* Binary sink */
+    WsSink*           m_sink;               /*!< Sink for the next binary message    */
+    WsSink*           m_sinkCur;            /*!< Sink of the current message (NULL - drop) */
+    bool              m_sinkMsg;            /*!< Binary message goes to m_sinkCur    */
+    bool              m_sinkFin;            /*!< Current sink frame ends the message */
+    uint64_t          m_sinkLeft;           /*!< Payload left in the current sink frame */
     /* Ping/Pong */
     int               m_ping_interval;
     int               ws_ping_cnt;          /*!< Websocket ping counter              */
     int               ws_pong_cnt;          /*!< Websocket pong counter              */
+    int64_t           m_pingUs;             /*!< Last WS ping time in [us]           */
+    /* Engine.IO heartbeat */
+    std::atomic<bool> m_hbEnabled;          /*!< Server heartbeat replaces WS pings  */
+    int               m_eioPingInterval;    /*!< Engine.IO pingInterval in [ms]      */
+    int               m_eioPingTimeout;     /*!< Engine.IO pingTimeout in [ms]       */
+    int               m_eioMaxPayload;      /*!< Engine.IO maxPayload in bytes       */
+    uint32_t          m_hbLast;             /*!< Last heartbeat time in [ms]         */
+    /* Written by the TX task in full-duplex mode */
+    std::atomic<uint32_t> m_hbSent;         /*!< Last Engine.IO v3 ping time in [ms] */
+    std::atomic<int64_t>  m_hbPingUs;       /*!< Unanswered v3 ping time in [us]     */
+    int64_t           m_hbLastUs;           /*!< Last v4 server ping time in [us]    */
     /* misc */
+    WebSocketStats    m_stats;              /*!< Performance counters                */
     bool              m_connected;
     RVWebSocketCB     m_cb;
     RVWebSocketConnectedCB m_ccb;
-    std::map<std::string, RVWebSocketON> m_on;
-    SemaphoreHandle_t m_lock;
+    RVWebSocketRttCB  m_rttcb;
+    WsCapture*        m_capture;            /*!< RX capture (optional)               */
+    WsDispatcher*     m_disp;               /*!< on() handler workers (NULL - network task) */
+    WsHandlerTable<RVWebSocketON> m_on;     /*!< on() handlers (copy-on-write)       */
+    SemaphoreHandle_t m_lock;               /*!< Wire lock (one frame at a time)     */
+    SemaphoreHandle_t m_dataLock;           /*!< Data lane (one message at a time)   */
+    std::atomic<int>  m_ctlWaiting;         /*!< Control frames waiting for the wire */
+    std::atomic<int>  m_urgentWaiting;      /*!< Urgent messages waiting for the lane*/
+    /* Backpressure */
+    std::atomic<uint32_t> m_pending;        /*!< Buffered bytes (accepted, not written) */
+    uint32_t          m_wmHigh;             /*!< High watermark in bytes (0 - off)   */
+    uint32_t          m_wmLow;              /*!< Low watermark in bytes              */
+    std::atomic<bool> m_wmAbove;            /*!< Above high watermark                */
+    RVWebSocketWatermarkCB m_wmcb;
+    RVWebSocketTxReadyCB m_txcb;
+    std::atomic<bool> m_txWanted;           /*!< Upper layer has data to send (TX ready callback) */
+    /* Full-duplex */
+    bool              m_duplex;             /*!< TX task writes, network task reads  */
+    WsRing            m_txq[WS_TX_LANES];   /*!< TX queues of WsMsg (per lane)       */
+    std::atomic<bool> m_linkLost;           /*!< TX task: last WS ping not answered  */
+    uint32_t          m_txPingMs;           /*!< Last WS ping time (TX task) in [ms] */
+    xTaskHandle       m_txHandle;
+    uint8_t           m_txPriority;
+    BaseType_t        m_txCoreId;
+    /* Endpoints */
+    WsEndpoint        m_eps[WS_ENDPOINTS_MAX]; /*!< Server endpoints                   */
+    int               m_epCount;
+    int               m_ep;                 /*!< Current endpoint                    */
+    int               m_epLast;             /*!< Endpoint of the last connection (-1 none) */
+    uint32_t          m_probeMs;            /*!< Probe period in [ms] (0 - off)      */
+    std::atomic<uint32_t> m_probeUs[WS_ENDPOINTS_MAX]; /*!< Probe results (0 - none) */
+    std::atomic<bool> m_probeDone;          /*!< Probe results waiting               */
+    WsTransport*      m_probeTr;            /*!< Probe transport (TCP only)          */
+    xTaskHandle       m_probeHandle;
     /* task */
     xTaskHandle       m_handle;
     uint16_t          m_stackSize;
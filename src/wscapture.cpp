@@ -0,0 +1,171 @@
+/*
+ * Capture of received WebSocket bytes (for replay on the host).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wscapture.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+
+static char tag[] = "WSCAP";
+
+#ifdef DEBUG
+#define cl_cap_debug(fmt, args...)  ESP_LOGI(tag, fmt, ## args);
+#define cl_cap_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#else
+#define cl_cap_debug(fmt, args...)
+#define cl_cap_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#endif
+
+#define WSCAP_HDR           (8)
+
+//==========================================================================================
+// Writer
+//==========================================================================================
+
+/*!
+ * \brief Construct a new WsCapture object.
+ * \param path - capture file path (i.e. "/sdcard/rx.wscp"),
+ * \param maxBytes - stop recording when file reaches this size (0 - no limit).
+ */
+WsCapture::WsCapture(const char* path, uint32_t maxBytes)
+{
+    m_maxBytes = maxBytes;
+    m_size = 0;
+    m_last = 0;
+    m_header = false;
+    m_f = fopen(path, "wb");
+    if (!m_f) cl_cap_error("Unable to create %s", path);
+}
+
+WsCapture::~WsCapture()
+{
+    if (m_f) fclose(m_f);
+}
+
+void WsCapture::putVarint(uint32_t v)
+{
+    uint8_t b[5];
+    int n = 0;
+
+    do {
+        b[n] = v & 0x7F;
+        v >>= 7;
+        if (v) b[n] |= 0x80;
+        n++;
+    } while (v);
+    fwrite(b, 1, n, m_f);
+    m_size += n;
+}
+
+/*!
+ * \brief Write file header (once, on first connection).
+ */
+void WsCapture::begin(uint8_t flags, uint8_t eioVersion)
+{
+    uint8_t hdr[WSCAP_HDR] = { 'W', 'S', 'C', 'P', WSCAP_VERSION, flags, eioVersion, 0 };
+
+    if (!m_f || m_header) return;
+    fwrite(hdr, 1, WSCAP_HDR, m_f);
+    m_size = WSCAP_HDR;
+    m_last = esp_timer_get_time();
+    m_header = true;
+}
+
+/*!
+ * \brief Add record.
+ */
+void WsCapture::record(uint8_t type, const char* data, uint32_t len)
+{
+    int64_t t = esp_timer_get_time();
+
+    if (!m_f || !m_header) return;
+    if (m_maxBytes && (m_size + len + 11 > m_maxBytes)) {
+        cl_cap_debug("Capture limit reached (%u bytes)", m_size);
+        fclose(m_f);
+        m_f = NULL;
+        return;
+    }
+    fwrite(&type, 1, 1, m_f);
+    m_size++;
+    putVarint((uint32_t)(t - m_last));
+    putVarint(len);
+    if (len) fwrite(data, 1, len, m_f);
+    m_size += len;
+    m_last = t;
+    if (type != WSCAP_DATA) fflush(m_f);
+}
+
+void WsCapture::flush()
+{
+    if (m_f) fflush(m_f);
+}
+
+//==========================================================================================
+// Reader
+//==========================================================================================
+
+WsCaptureReader::WsCaptureReader(const char* path)
+{
+    uint8_t hdr[WSCAP_HDR];
+
+    m_flags = 0;
+    m_eio = 0;
+    m_f = fopen(path, "rb");
+    if (!m_f) return;
+    if ((fread(hdr, 1, WSCAP_HDR, m_f) != WSCAP_HDR) || memcmp(hdr, "WSCP", 4) || (hdr[4] != WSCAP_VERSION)) {
+        cl_cap_error("%s is not a capture file", path);
+        fclose(m_f);
+        m_f = NULL;
+        return;
+    }
+    m_flags = hdr[5];
+    m_eio = hdr[6];
+}
+
+WsCaptureReader::~WsCaptureReader()
+{
+    if (m_f) fclose(m_f);
+}
+
+int WsCaptureReader::getVarint(uint32_t* v)
+{
+    int c, shift = 0;
+
+    *v = 0;
+    do {
+        if ((c = fgetc(m_f)) == EOF) return 0;
+        *v |= (uint32_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while ((c & 0x80) && (shift < 35));
+    return 1;
+}
+
+/*!
+ * \brief Read next record, return 0 at the end of capture.
+ */
+int WsCaptureReader::next(uint8_t* type, uint32_t* dt_us, std::string& data)
+{
+    uint32_t len;
+    int c;
+
+    if (!m_f || ((c = fgetc(m_f)) == EOF)) return 0;
+    *type = (uint8_t)c;
+    if (!getVarint(dt_us) || !getVarint(&len)) return 0;
+    data.resize(len);
+    if (len && (fread(&data[0], 1, len, m_f) != len)) return 0;
+    return 1;
+}
+
+/*!
+ * \brief Start from the first record again.
+ */
+void WsCaptureReader::rewind()
+{
+    if (m_f) fseek(m_f, WSCAP_HDR, SEEK_SET);
+}
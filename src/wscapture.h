@@ -0,0 +1,99 @@
+/*
+ * Capture of received WebSocket bytes (for replay on the host).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSCAPTURE__
+#define __RV_WSCAPTURE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define WSCAP_VERSION       (1)
+
+/* Record types */
+#define WSCAP_DATA          (0)    ///< Bytes returned by one directRecv() call
+#define WSCAP_CONNECT       (1)    ///< Connection established
+#define WSCAP_DISCONNECT    (2)    ///< Connection lost
+
+/* Header flags */
+#define WSCAP_FL_SIO        (0x01) ///< Socket.IO connection
+#define WSCAP_FL_WS_ONLY    (0x02) ///< Socket.IO websocket-only handshake
+
+/*!
+ * \brief Capture writer.
+ *
+ * File layout: "WSCP", version (u8), flags (u8), Engine.IO version (u8), reserved (u8),
+ * then records: type (u8), time since previous record in [us] (varint), length (varint), data.
+ */
+class WsCapture {
+public:
+    /*!
+     * \brief Construct a new WsCapture object.
+     * \param path - capture file path (i.e. "/sdcard/rx.wscp"),
+     * \param maxBytes - stop recording when file reaches this size (0 - no limit).
+     */
+    WsCapture(const char* path, uint32_t maxBytes = 0);
+    ~WsCapture();
+
+    bool isOpen() const { return m_f != NULL; }
+
+    /*!
+     * \brief Write file header (once, on first connection).
+     */
+    void begin(uint8_t flags, uint8_t eioVersion);
+
+    /*!
+     * \brief Add record.
+     */
+    void record(uint8_t type, const char* data, uint32_t len);
+
+    void flush();
+    uint32_t size() const { return m_size; }
+
+private:
+    void putVarint(uint32_t v);
+
+    FILE*    m_f;
+    uint32_t m_maxBytes;
+    uint32_t m_size;
+    int64_t  m_last;
+    bool     m_header;
+};
+
+/*!
+ * \brief Capture reader (host replay tools).
+ */
+class WsCaptureReader {
+public:
+    WsCaptureReader(const char* path);
+    ~WsCaptureReader();
+
+    bool isOpen() const { return m_f != NULL; }
+    uint8_t flags() const { return m_flags; }
+    uint8_t eioVersion() const { return m_eio; }
+
+    /*!
+     * \brief Read next record, return 0 at the end of capture.
+     */
+    int next(uint8_t* type, uint32_t* dt_us, std::string& data);
+
+    /*!
+     * \brief Start from the first record again.
+     */
+    void rewind();
+
+private:
+    int getVarint(uint32_t* v);
+
+    FILE*   m_f;
+    uint8_t m_flags;
+    uint8_t m_eio;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Fixed-capacity callback storage (std::function replacement without heap allocation).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSDELEGATE__
+#define __RV_WSDELEGATE__
+
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef WS_DELEGATE_SIZE
+#define WS_DELEGATE_SIZE    (4 * sizeof(void*))  ///< Default capture size of handlers in bytes
+#endif
+
+template <typename Sig, size_t Size = WS_DELEGATE_SIZE> class WsDelegate;
+
+/*!
+ * \brief Callable (function pointer, lambda, functor) stored inline.
+ *
+ * Captures up to Size bytes are checked at compile time - a handler which captures more does
+ * not build (capture a pointer to a context, raise WS_DELEGATE_SIZE or use a bigger Size).
+ * Copying, storing and calling never allocate.
+ */
+template <typename R, typename... A, size_t Size>
+class WsDelegate<R(A...), Size> {
+public:
+    WsDelegate() : m_call(NULL), m_ops(NULL) {}
+    WsDelegate(std::nullptr_t) : m_call(NULL), m_ops(NULL) {}
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, WsDelegate>::value>::type>
+    WsDelegate(F&& f) : m_call(NULL), m_ops(NULL) { assign(std::forward<F>(f)); }
+
+    WsDelegate(const WsDelegate& o) : m_call(NULL), m_ops(NULL) { copy(o); }
+    WsDelegate(WsDelegate&& o) : m_call(NULL), m_ops(NULL) { move(o); }
+    ~WsDelegate() { reset(); }
+
+    WsDelegate& operator=(const WsDelegate& o) {
+        if (this != &o) { reset(); copy(o); }
+        return *this;
+    }
+
+    WsDelegate& operator=(WsDelegate&& o) {
+        if (this != &o) { reset(); move(o); }
+        return *this;
+    }
+
+    WsDelegate& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, WsDelegate>::value>::type>
+    WsDelegate& operator=(F&& f) {
+        reset();
+        assign(std::forward<F>(f));
+        return *this;
+    }
+
+    explicit operator bool() const { return m_call != NULL; }
+
+    R operator()(A... a) const { return m_call((void*)m_buf, std::forward<A>(a)...); }
+
+    /*!
+     * \brief Remove callable.
+     */
+    void reset() {
+        if (m_ops) m_ops(OP_DESTROY, m_buf, NULL);
+        m_call = NULL;
+        m_ops = NULL;
+    }
+
+private:
+    enum { OP_COPY, OP_MOVE, OP_DESTROY };
+    typedef R (*CallFn)(void* f, A... a);
+    typedef void (*OpsFn)(int op, void* dst, void* src);
+
+    template <typename F>
+    static R call(void* f, A... a) { return (*(F*)f)(std::forward<A>(a)...); }
+
+    template <typename F>
+    static void ops(int op, void* dst, void* src) {
+        switch (op) {
+            case OP_COPY: new (dst) F(*(const F*)src); break;
+            case OP_MOVE: new (dst) F(std::move(*(F*)src)); ((F*)src)->~F(); break;
+            default: ((F*)dst)->~F(); break;
+        }
+    }
+
+    template <typename F> static bool isNull(const F&) { return false; }
+    template <typename F> static bool isNull(F* f) { return f == NULL; }
+
+    template <typename F>
+    void assign(F&& f) {
+        typedef typename std::decay<F>::type T;
+        static_assert(sizeof(T) <= Size, "Handler capture is too big for WsDelegate (capture a pointer or raise WS_DELEGATE_SIZE)");
+        static_assert(alignof(T) <= 8, "Handler capture alignment is not supported by WsDelegate");
+        if (isNull(f)) return;
+        new (m_buf) T(std::forward<F>(f));
+        m_call = &call<T>;
+        /* Trivially copyable captures are copied as bytes */
+        m_ops = std::is_trivially_copyable<T>::value ? NULL : &ops<T>;
+    }
+
+    void copy(const WsDelegate& o) {
+        if (o.m_ops) o.m_ops(OP_COPY, m_buf, (void*)o.m_buf);
+        else if (o.m_call) memcpy(m_buf, o.m_buf, Size);
+        m_call = o.m_call;
+        m_ops = o.m_ops;
+    }
+
+    void move(WsDelegate& o) {
+        if (o.m_ops) o.m_ops(OP_MOVE, m_buf, o.m_buf);
+        else if (o.m_call) memcpy(m_buf, o.m_buf, Size);
+        m_call = o.m_call;
+        m_ops = o.m_ops;
+        o.m_call = NULL;
+        o.m_ops = NULL;
+    }
+
+    alignas(8) unsigned char m_buf[Size];
+    CallFn m_call;
+    OpsFn  m_ops;
+};
+
+#endif
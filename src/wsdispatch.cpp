@@ -0,0 +1,204 @@
+/*
+ * Handler dispatch on worker tasks (keeps the network task free of slow handlers).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wsdispatch.h"
+#include "wstrace.h"
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+static char tag[] = "WSDISP";
+
+#ifdef DEBUG
+#define cl_disp_debug(fmt, args...)  ESP_LOGI(tag, fmt, ## args);
+#define cl_disp_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#else
+#define cl_disp_debug(fmt, args...)
+#define cl_disp_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#endif
+
+//==========================================================================================
+// Messages
+//==========================================================================================
+
+/*!
+ * \brief Allocate message with room for len bytes of data (ref = 1).
+ */
+WsMsg* ws_msg_alloc(uint32_t len)
+{
+    void* p = malloc(sizeof(WsMsg) + len);
+    if (!p) return NULL;
+    WsMsg* m = (WsMsg*)p;
+    new (&m->ref) std::atomic<int>(1);
+    m->owner = NULL;
+    m->user = NULL;
+    m->release = NULL;
+    m->kind = 0;
+    m->id = -1;
+    m->off = 0;
+    m->len = len;
+    m->data[len] = '\0';
+    return m;
+}
+
+/*!
+ * \brief Allocate message with a copy of data (ref = 1).
+ */
+WsMsg* ws_msg_new(const char* data, uint32_t len)
+{
+    WsMsg* m = ws_msg_alloc(len);
+    if (m) memcpy(m->data, data, len);
+    return m;
+}
+
+/*!
+ * \brief Take a reference.
+ */
+void ws_msg_ref(WsMsg* m)
+{
+    m->ref.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Drop a reference (message is freed with the last one).
+ */
+void ws_msg_unref(WsMsg* m)
+{
+    if (m->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (m->release) m->release(m);
+        free(m);
+    }
+}
+
+//==========================================================================================
+// Worker pool
+//==========================================================================================
+
+/*!
+ * \brief Construct a new WsDispatcher object.
+ * \param workers - number of worker tasks (1 .. WS_DISPATCH_MAX),
+ * \param queueLen - messages waiting per worker,
+ * \param stackSize - worker stack size,
+ * \param pr - worker task priority,
+ * \param coreID - worker task CPU core (setCore() for each worker).
+ */
+WsDispatcher::WsDispatcher(int workers, int queueLen, uint32_t stackSize, uint8_t pr, BaseType_t coreID)
+{
+    if (workers < 1) workers = 1;
+    if (workers > WS_DISPATCH_MAX) workers = WS_DISPATCH_MAX;
+    m_n = workers;
+    m_stackSize = stackSize;
+    m_priority = pr;
+    m_postTimeout = 1000;
+    m_posted = 0;
+    m_dropped = 0;
+    memset(m_w, 0, sizeof(m_w));
+    for (int i = 0; i < m_n; i++) {
+        m_w[i].d = this;
+        m_w[i].q = xQueueCreate(queueLen, sizeof(Item));
+        m_w[i].core = coreID;
+    }
+}
+
+/*!
+ * \brief Destructor (waiting messages are released without calling handlers).
+ */
+WsDispatcher::~WsDispatcher()
+{
+    Item it;
+
+    for (int i = 0; i < m_n; i++) {
+        if (m_w[i].h) vTaskDelete(m_w[i].h);
+        while (xQueueReceive(m_w[i].q, &it, 0) == pdTRUE) ws_msg_unref(it.m);
+        vQueueDelete(m_w[i].q);
+    }
+}
+
+/*!
+ * \brief Pin worker to CPU core (before start()).
+ */
+void WsDispatcher::setCore(int worker, BaseType_t coreID)
+{
+    if ((worker >= 0) && (worker < m_n)) m_w[worker].core = coreID;
+}
+
+/*!
+ * \brief Start worker tasks.
+ */
+void WsDispatcher::start()
+{
+    for (int i = 0; i < m_n; i++) {
+        if (m_w[i].h) continue;
+        ::xTaskCreatePinnedToCore(&WsDispatcher::workerTask, "WsDispatch", m_stackSize, &m_w[i], m_priority, &m_w[i].h, m_w[i].core);
+    }
+}
+
+/*!
+ * \brief FNV-1a hash.
+ */
+uint32_t WsDispatcher::hash(const char* key, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*!
+ * \brief Hand message to the worker selected by key, the reference is passed to the dispatcher.
+ * \return 1 - posted, 0 - dropped (queue full).
+ */
+int WsDispatcher::post(const char* key, int keyLen, WsMsg* m, WsDispatchFn fn)
+{
+    Worker* w = &m_w[hash(key, keyLen) % m_n];
+    Item it = { m, fn };
+
+    if (xQueueSend(w->q, &it, m_postTimeout) != pdTRUE) {
+        cl_disp_error("Worker queue full - message dropped");
+        ws_msg_unref(m);
+        m_dropped++;
+        return 0;
+    }
+    m_posted++;
+    return 1;
+}
+
+/*!
+ * \brief Message handled by the calling worker (NULL when not called from a worker).
+ */
+WsMsg* WsDispatcher::current() const
+{
+    TaskHandle_t t = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < m_n; i++) {
+        if (m_w[i].h == t) return m_w[i].cur;
+    }
+    return NULL;
+}
+
+/*!
+ * \brief Worker task - call handlers in order.
+ */
+void WsDispatcher::workerTask(void* arg)
+{
+    Worker* w = (Worker*)arg;
+    Item it;
+
+    for (;;) {
+        if (xQueueReceive(w->q, &it, portMAX_DELAY) != pdTRUE) continue;
+        WS_TRACE_T0(tDisp);
+        w->cur = it.m;
+        it.fn(it.m);
+        w->cur = NULL;
+        WS_TRACE(WST_WORKER, it.m->kind, WS_TRACE_US(tDisp));
+        ws_msg_unref(it.m);
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ * Handler dispatch on worker tasks (keeps the network task free of slow handlers).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSDISPATCH__
+#define __RV_WSDISPATCH__
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <stdint.h>
+#include <atomic>
+
+#define WS_DISPATCH_MAX     (8)    ///< Maximum number of workers
+
+/* Message kinds */
+#define WS_MSG_WS_ON        (0)    ///< WebSocketClient on() handler (data = key, arguments at off)
+#define WS_MSG_SIO_EVENT    (1)    ///< Socket.IO event (data = JSON array)
+#define WS_MSG_SIO_ACK      (2)    ///< Socket.IO ack callback (data = arguments, id < 0 - connection lost)
+#define WS_MSG_WS_TX        (3)    ///< WebSocketClient message for the TX task (id = opcode)
+
+/*!
+ * \brief Ref-counted message (one copy of the received data, shared by every user).
+ */
+typedef struct WsMsg {
+    std::atomic<int> ref;
+    void*            owner;        /*!< Client which posted the message       */
+    void*            user;         /*!< Kind specific data                    */
+    void           (*release)(struct WsMsg* m); /*!< Frees user data (optional) */
+    uint8_t          kind;         /*!< WS_MSG_xxx                            */
+    int32_t          id;           /*!< Ack id (-1 none)                      */
+    uint32_t         off;          /*!< Payload offset in data                */
+    uint32_t         len;          /*!< Payload length                        */
+    char             data[1];      /*!< Data (NUL terminated)                 */
+} WsMsg;
+
+/*!
+ * \brief Allocate message with room for len bytes of data (ref = 1).
+ */
+WsMsg* ws_msg_alloc(uint32_t len);
+
+/*!
+ * \brief Allocate message with a copy of data (ref = 1).
+ */
+WsMsg* ws_msg_new(const char* data, uint32_t len);
+
+/*!
+ * \brief Take a reference (keep the message after the handler returns, i.e. pass it to another task).
+ */
+void ws_msg_ref(WsMsg* m);
+
+/*!
+ * \brief Drop a reference (message is freed with the last one).
+ */
+void ws_msg_unref(WsMsg* m);
+
+typedef void (*WsDispatchFn)(WsMsg* m);
+
+/*!
+ * \brief Worker pool.
+ *
+ * Messages are assigned to a worker by hash of their key (event name), every worker handles
+ * its messages in order, so the order is kept per key. One dispatcher may serve many clients.
+ */
+class WsDispatcher {
+public:
+    /*!
+     * \brief Construct a new WsDispatcher object.
+     * \param workers - number of worker tasks (1 .. WS_DISPATCH_MAX),
+     * \param queueLen - messages waiting per worker,
+     * \param stackSize - worker stack size,
+     * \param pr - worker task priority,
+     * \param coreID - worker task CPU core (setCore() for each worker).
+     */
+    WsDispatcher(int workers = 1, int queueLen = 32, uint32_t stackSize = 6144, uint8_t pr = 4, BaseType_t coreID = tskNO_AFFINITY);
+    ~WsDispatcher();
+
+    /*!
+     * \brief Pin worker to CPU core (before start()).
+     */
+    void setCore(int worker, BaseType_t coreID);
+
+    /*!
+     * \brief Time to wait for room in a full worker queue in [ticks] (message is dropped after).
+     */
+    void setPostTimeout(TickType_t ticks) { m_postTimeout = ticks; }
+
+    /*!
+     * \brief Start worker tasks.
+     */
+    void start();
+
+    /*!
+     * \brief Hand message to the worker selected by key, the reference is passed to the dispatcher.
+     * \param key - ordering key (event name),
+     * \param keyLen - key length,
+     * \param m - message,
+     * \param fn - handler (called on the worker task, message is released after it returns).
+     * \return 1 - posted, 0 - dropped (queue full).
+     */
+    int post(const char* key, int keyLen, WsMsg* m, WsDispatchFn fn);
+
+    /*!
+     * \brief Message handled by the calling worker (NULL when not called from a worker).
+     */
+    WsMsg* current() const;
+
+    int workers() const { return m_n; }
+    uint32_t posted() const { return m_posted; }
+    uint32_t dropped() const { return m_dropped; }
+
+    /*!
+     * \brief FNV-1a hash.
+     */
+    static uint32_t hash(const char* key, int len);
+
+private:
+    struct Item {
+        WsMsg*       m;
+        WsDispatchFn fn;
+    };
+    struct Worker {
+        WsDispatcher*  d;
+        QueueHandle_t  q;
+        xTaskHandle    h;
+        BaseType_t     core;
+        WsMsg*         cur;        /*!< Message being handled */
+    };
+    static void workerTask(void* arg);
+
+    Worker                m_w[WS_DISPATCH_MAX];
+    int                   m_n;
+    uint32_t              m_stackSize;
+    uint8_t               m_priority;
+    TickType_t            m_postTimeout;
+    std::atomic<uint32_t> m_posted;
+    std::atomic<uint32_t> m_dropped;
+};
+
+#endif
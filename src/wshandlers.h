@@ -0,0 +1,368 @@
+/*
+ * Handler table with copy-on-write updates (lock-free lookup on the RX path).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSHANDLERS__
+#define __RV_WSHANDLERS__
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#define WS_HANDLERS_MAX     (65535)             ///< Max handlers and key bytes in one table
+
+/*!
+ * \brief Handlers by key (event name).
+ *
+ * The table is an immutable snapshot (entries sorted by key, handlers with the same key in
+ * registration order, and a trie of the keys built at registration time) in one allocation.
+ * A lookup costs one trie step per key character, prefix handlers are collected on the way.
+ * Updates build a new snapshot and swap it in, readers
+ * only count themselves in and out - lookups never lock and never wait for registrations.
+ * Replaced snapshots are freed when no reader is left, so handlers may register and remove
+ * handlers (the running dispatch keeps the snapshot it started with).
+ */
+template <typename H>
+class WsHandlerTable {
+public:
+    struct Entry {
+        const char* key;                        /*!< Key (NUL terminated)   */
+        uint32_t    len;                        /*!< Key length             */
+        bool        prefix;                     /*!< Matches keys starting with key */
+        H           h;                          /*!< Handler                */
+    };
+
+    /*!
+     * \brief Trie node (one per key character, children in key order).
+     */
+    struct Node {
+        uint16_t child;                         /*!< First child (0 - none) */
+        uint16_t next;                          /*!< Next sibling (0 - none) */
+        uint16_t lo, hi;                        /*!< Exact entries [lo, hi) */
+        uint16_t plo, phi;                      /*!< Prefix entries [plo, phi) */
+        char     c;                             /*!< Character              */
+    };
+
+    /*!
+     * \brief Table version.
+     */
+    struct Snapshot {
+        Snapshot* next;                         /*!< Retired list           */
+        uint32_t  n;                            /*!< Number of entries      */
+        Entry*    e;                            /*!< Entries (sorted)       */
+        Node*     t;                            /*!< Trie (node 0 - root)   */
+    };
+
+    /*!
+     * \brief Read access - the snapshot stays valid until the reader goes out of scope.
+     */
+    class Reader {
+    public:
+        Reader(WsHandlerTable* t) : m_t(t) { m_s = t->acquire(); }
+        ~Reader() { m_t->release(); }
+
+        uint32_t size() const { return m_s ? m_s->n : 0; }
+        const Entry* begin() const { return m_s ? m_s->e : NULL; }
+        const Entry* end() const { return m_s ? m_s->e + m_s->n : NULL; }
+
+        /*!
+         * \brief Handlers registered for key.
+         * \param end - past the last handler,
+         * \return first handler (NULL - none).
+         */
+        const Entry* find(const char* key, uint32_t len, const Entry** end) const {
+            const Node* n = walk(key, len, [](const Node*) {});
+            if ((!n) || (n->lo == n->hi)) return NULL;
+            *end = m_s->e + n->hi;
+            return m_s->e + n->lo;
+        }
+
+        /*!
+         * \brief Call fn(const Entry*) for every handler matching key: prefix handlers from the
+         *        shortest prefix, then exact handlers.
+         * \return number of handlers.
+         */
+        template <typename F>
+        int match(const char* key, uint32_t len, F fn) const {
+            int cnt = 0;
+            if (!m_s) return 0;
+            const Node* n = walk(key, len, [&](const Node* x) {
+                for (uint32_t i = x->plo; i < x->phi; i++, cnt++) fn(&m_s->e[i]);
+            });
+            if (n) for (uint32_t i = n->lo; i < n->hi; i++, cnt++) fn(&m_s->e[i]);
+            return cnt;
+        }
+
+    private:
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        /*!
+         * \brief Follow key in the trie (one step per character), visit nodes with prefix handlers.
+         * \return node of the whole key (NULL - not in the trie).
+         */
+        template <typename V>
+        const Node* walk(const char* key, uint32_t len, V visit) const {
+            if (!m_s) return NULL;
+            const Node* t = m_s->t, * n = t;
+            for (uint32_t i = 0; ; i++) {
+                if (n->plo != n->phi) visit(n);
+                if (i == len) return n;
+                uint32_t c = n->child;
+                while (c && (t[c].c != key[i])) c = t[c].next;
+                if (!c) return NULL;
+                n = &t[c];
+            }
+        }
+
+        WsHandlerTable* m_t;
+        Snapshot*       m_s;
+    };
+
+    WsHandlerTable() : m_cur(NULL), m_retired(NULL), m_readers(0) { m_lock = xSemaphoreCreateMutex(); }
+
+    ~WsHandlerTable() {
+        destroy(m_cur.exchange(NULL));
+        for (Snapshot* s = m_retired.exchange(NULL); s; ) {
+            Snapshot* n = s->next;
+            destroy(s);
+            s = n;
+        }
+        vSemaphoreDelete(m_lock);
+    }
+
+    /*!
+     * \brief No handlers (hint, without reader accounting).
+     */
+    bool empty() const { return m_cur.load() == NULL; }
+
+    /*!
+     * \brief Add handler.
+     * \param key - key,
+     * \param len - key length,
+     * \param h - handler,
+     * \param unique - replace handlers registered for the key (map), false - add after them (multimap),
+     * \param prefix - match every key starting with key ("" - every key).
+     * \return 1 - added, 0 - out of memory or table full.
+     */
+    int add(const char* key, uint32_t len, const H& h, bool unique, bool prefix = false) {
+        uint32_t lo = 0, hi = 0, on = 0, n, i, keys = len + 1;
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+        Snapshot* o = m_cur.load();
+        if (o) {
+            on = o->n;
+            range(o, key, len, prefix, &lo, &hi);
+            for (i = 0; i < on; i++) keys += o->e[i].len + 1;
+            if (unique) for (i = lo; i < hi; i++) keys -= o->e[i].len + 1;
+        }
+        n = on + 1 - (unique ? hi - lo : 0);
+        Snapshot* s = alloc(n, keys);
+        if (!s) {
+            xSemaphoreGive(m_lock);
+            return 0;
+        }
+        char* kp = (char*)&s->t[keys];
+        n = 0;
+        for (i = 0; i < on; i++) {
+            if (unique && (i >= lo) && (i < hi)) continue;
+            if (i == hi) place(s, n++, key, len, prefix, h, &kp);
+            place(s, n++, o->e[i].key, o->e[i].len, o->e[i].prefix, o->e[i].h, &kp);
+        }
+        if (hi == on) place(s, n++, key, len, prefix, h, &kp);
+        build(s);
+        publish(s);
+        xSemaphoreGive(m_lock);
+        return 1;
+    }
+
+    /*!
+     * \brief Remove all handlers of key (prefix - the prefix handlers).
+     * \return number of removed handlers.
+     */
+    int remove(const char* key, uint32_t len, bool prefix = false) {
+        uint32_t lo, hi, n = 0, i, keys = 0;
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+        Snapshot* o = m_cur.load();
+        if (!o) {
+            xSemaphoreGive(m_lock);
+            return 0;
+        }
+        range(o, key, len, prefix, &lo, &hi);
+        if ((lo == hi) || (o->n == hi - lo)) {
+            if (lo != hi) publish(NULL);
+            xSemaphoreGive(m_lock);
+            return hi - lo;
+        }
+        for (i = 0; i < o->n; i++) if ((i < lo) || (i >= hi)) keys += o->e[i].len + 1;
+        Snapshot* s = alloc(o->n - (hi - lo), keys);
+        if (!s) {
+            xSemaphoreGive(m_lock);
+            return 0;
+        }
+        char* kp = (char*)&s->t[keys];
+        for (i = 0; i < o->n; i++) {
+            if ((i < lo) || (i >= hi)) place(s, n++, o->e[i].key, o->e[i].len, o->e[i].prefix, o->e[i].h, &kp);
+        }
+        build(s);
+        publish(s);
+        xSemaphoreGive(m_lock);
+        return hi - lo;
+    }
+
+    /*!
+     * \brief Remove all handlers.
+     */
+    void clear() {
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+        publish(NULL);
+        xSemaphoreGive(m_lock);
+    }
+
+private:
+    WsHandlerTable(const WsHandlerTable&);
+    WsHandlerTable& operator=(const WsHandlerTable&);
+
+    /*!
+     * \brief Entry order: key, then exact before prefix.
+     */
+    static int cmp(const Entry& e, const char* b, uint32_t bl, bool bp) {
+        int r = memcmp(e.key, b, (e.len < bl) ? e.len : bl);
+        if (r) return r;
+        if (e.len != bl) return (e.len < bl) ? -1 : 1;
+        return (int)e.prefix - (int)bp;
+    }
+
+    /*!
+     * \brief Entries [lo, hi) with key.
+     */
+    static void range(const Snapshot* s, const char* key, uint32_t len, bool prefix, uint32_t* lo, uint32_t* hi) {
+        uint32_t a = 0, b = s->n, m;
+        while (a < b) {
+            m = (a + b) / 2;
+            if (cmp(s->e[m], key, len, prefix) < 0) a = m + 1; else b = m;
+        }
+        *lo = a;
+        b = s->n;
+        while (a < b) {
+            m = (a + b) / 2;
+            if (cmp(s->e[m], key, len, prefix) <= 0) a = m + 1; else b = m;
+        }
+        *hi = a;
+    }
+
+    /*!
+     * \brief Allocate snapshot (header, entries, trie and keys in one block).
+     * The trie needs at most one node per key character plus the root, keys counts the
+     * characters with terminators, so it is a safe node count.
+     */
+    static Snapshot* alloc(uint32_t n, uint32_t keys) {
+        if ((n > WS_HANDLERS_MAX) || (keys > WS_HANDLERS_MAX)) return NULL;
+        size_t hdr = (sizeof(Snapshot) + alignof(Entry) - 1) & ~(alignof(Entry) - 1);
+        char* p = (char*)malloc(hdr + n * sizeof(Entry) + keys * sizeof(Node) + keys);
+        if (!p) return NULL;
+        Snapshot* s = (Snapshot*)p;
+        s->next = NULL;
+        s->n = n;
+        s->e = (Entry*)(p + hdr);
+        s->t = (Node*)&s->e[n];
+        return s;
+    }
+
+    static void place(Snapshot* s, uint32_t i, const char* key, uint32_t len, bool prefix, const H& h, char** kp) {
+        memcpy(*kp, key, len);
+        (*kp)[len] = '\0';
+        new (&s->e[i]) Entry{ *kp, len, prefix, h };
+        *kp += len + 1;
+    }
+
+    /*!
+     * \brief Build trie of the sorted entries (children end up in key order).
+     */
+    static void build(Snapshot* s) {
+        Node* t = s->t;
+        uint32_t nn = 1, i = 0, j, k, c, l;
+        memset(t, 0, sizeof(Node));
+        while (i < s->n) {
+            const Entry* e = &s->e[i];
+            for (j = i + 1; (j < s->n) && (cmp(s->e[j], e->key, e->len, e->prefix) == 0); j++);
+            Node* n = t;
+            for (k = 0; k < e->len; k++) {
+                for (c = n->child, l = 0; c && (t[c].c != e->key[k]); c = t[c].next) l = c;
+                if (!c) {
+                    c = nn++;
+                    memset(&t[c], 0, sizeof(Node));
+                    t[c].c = e->key[k];
+                    if (l) t[l].next = c; else n->child = c;
+                }
+                n = &t[c];
+            }
+            if (e->prefix) {
+                n->plo = i;
+                n->phi = j;
+            } else {
+                n->lo = i;
+                n->hi = j;
+            }
+            i = j;
+        }
+    }
+
+    static void destroy(Snapshot* s) {
+        if (!s) return;
+        for (uint32_t i = 0; i < s->n; i++) s->e[i].~Entry();
+        free(s);
+    }
+
+    Snapshot* acquire() {
+        m_readers.fetch_add(1);
+        return m_cur.load();
+    }
+
+    void release() {
+        /* Last reader frees replaced snapshots (unless an update is running - it does it then) */
+        if ((m_readers.fetch_sub(1) == 1) && m_retired.load(std::memory_order_relaxed) && (xSemaphoreTake(m_lock, 0) == pdTRUE)) {
+            reclaim();
+            xSemaphoreGive(m_lock);
+        }
+    }
+
+    /*!
+     * \brief Swap in new snapshot (writer lock held).
+     */
+    void publish(Snapshot* s) {
+        Snapshot* o = m_cur.exchange(s);
+        if (o) {
+            o->next = m_retired.load();
+            m_retired.store(o);
+        }
+        reclaim();
+    }
+
+    /*!
+     * \brief Free replaced snapshots when no reader can hold them (writer lock held).
+     */
+    void reclaim() {
+        if (m_readers.load() != 0) return;
+        for (Snapshot* s = m_retired.exchange(NULL); s; ) {
+            Snapshot* n = s->next;
+            destroy(s);
+            s = n;
+        }
+    }
+
+    std::atomic<Snapshot*> m_cur;               /*!< Current snapshot (NULL - empty)       */
+    std::atomic<Snapshot*> m_retired;           /*!< Replaced snapshots waiting for readers */
+    std::atomic<int>       m_readers;           /*!< Readers inside the table              */
+    SemaphoreHandle_t      m_lock;              /*!< Writer lock                           */
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Bounded lock-free queue of pointers.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wsring.h"
+#include <stdlib.h>
+#include <new>
+
+/*!
+ * \brief Allocate cells for at least size pointers.
+ */
+bool ws_ring_init(WsRing* r, uint32_t size)
+{
+    uint32_t n = 2, i;
+
+    while (n < size) n <<= 1;
+    r->cell = (WsRingCell*)malloc(n * sizeof(WsRingCell));
+    if (!r->cell) return false;
+    for (i = 0; i < n; i++) {
+        new (&r->cell[i].seq) std::atomic<uint32_t>(i);
+        r->cell[i].p = NULL;
+    }
+    r->mask = n - 1;
+    r->head = 0;
+    r->tail = 0;
+    return true;
+}
+
+/*!
+ * \brief Free cells.
+ */
+void ws_ring_free(WsRing* r)
+{
+    free(r->cell);
+    r->cell = NULL;
+}
+
+/*!
+ * \brief Add pointer at the end.
+ */
+bool ws_ring_push(WsRing* r, void* p)
+{
+    uint32_t pos = r->head.load(std::memory_order_relaxed);
+
+    while (true) {
+        WsRingCell* c = &r->cell[pos & r->mask];
+        int32_t d = (int32_t)(c->seq.load(std::memory_order_acquire) - pos);
+        if (d == 0) {
+            /* Cell is free - claim the position */
+            if (r->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                c->p = p;
+                c->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (d < 0) {
+            /* Cell still holds the pointer from one lap ago */
+            return false;
+        } else {
+            /* Another producer took the position */
+            pos = r->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/*!
+ * \brief Take pointer from the front.
+ */
+void* ws_ring_pop(WsRing* r)
+{
+    uint32_t pos = r->tail.load(std::memory_order_relaxed);
+
+    while (true) {
+        WsRingCell* c = &r->cell[pos & r->mask];
+        int32_t d = (int32_t)(c->seq.load(std::memory_order_acquire) - (pos + 1));
+        if (d == 0) {
+            if (r->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                void* p = c->p;
+                /* Free for the push one lap later */
+                c->seq.store(pos + r->mask + 1, std::memory_order_release);
+                return p;
+            }
+        } else if (d < 0) {
+            /* Empty (or the push at this position is not finished yet) */
+            return NULL;
+        } else {
+            pos = r->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
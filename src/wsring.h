@@ -0,0 +1,60 @@
+/*
+ * Bounded lock-free queue of pointers.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSRING__
+#define __RV_WSRING__
+
+#include <stdint.h>
+#include <atomic>
+
+/*!
+ * \brief Ring cell (seq tells whether the cell is free for the push or full for the pop at a position).
+ */
+typedef struct {
+    std::atomic<uint32_t> seq;
+    void*                 p;
+} WsRingCell;
+
+/*!
+ * \brief Bounded multi-producer queue of pointers.
+ *
+ * Push and pop never lock or allocate: a producer claims a position with one compare-and-swap,
+ * so any number of tasks may push while another task pops. Size is rounded up to a power of two.
+ */
+typedef struct {
+    WsRingCell*           cell;          /*!< Cells (NULL - not initialized)           */
+    uint32_t              mask;          /*!< Size - 1                                 */
+    std::atomic<uint32_t> head;          /*!< Next push position                       */
+    std::atomic<uint32_t> tail;          /*!< Next pop position                        */
+} WsRing;
+
+/*!
+ * \brief Allocate cells for at least size pointers.
+ * \return false - out of memory.
+ */
+bool ws_ring_init(WsRing* r, uint32_t size);
+
+/*!
+ * \brief Free cells (pointers still in the ring are not touched).
+ */
+void ws_ring_free(WsRing* r);
+
+/*!
+ * \brief Add pointer at the end.
+ * \return false - ring is full.
+ */
+bool ws_ring_push(WsRing* r, void* p);
+
+/*!
+ * \brief Take pointer from the front.
+ * \return NULL - ring is empty.
+ */
+void* ws_ring_pop(WsRing* r);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Token bucket rate shaper.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wsshaper.h"
+
+#define WS_BUCKET_SCALE     (1000000LL)    /* Level unit - token per [us] of rate */
+
+/*!
+ * \brief Set rate and burst, start with a full bucket.
+ */
+void ws_bucket_init(WsTokenBucket* b, uint32_t rate, uint32_t burst, int64_t now_us)
+{
+    b->rate = rate;
+    b->burst = burst ? burst : 1;
+    b->level = (int64_t)b->burst * WS_BUCKET_SCALE;
+    b->t_us = now_us;
+}
+
+/*!
+ * \brief Add tokens for the time since the last refill.
+ */
+static void ws_bucket_refill(WsTokenBucket* b, int64_t now_us)
+{
+    int64_t full = (int64_t)b->burst * WS_BUCKET_SCALE;
+
+    if (now_us <= b->t_us) return;
+    if (b->level < full) {
+        /* Level is in tokens x 10^6, so [us] x tokens/s needs no division (long idle time - full) */
+        int64_t dt = now_us - b->t_us;
+        if (dt >= (full - b->level) / b->rate + 1) b->level = full;
+        else b->level += dt * b->rate;
+    }
+    b->t_us = now_us;
+}
+
+/*!
+ * \brief Time until n tokens are available.
+ * \return 0 - available now, else wait time in [us].
+ */
+uint32_t ws_bucket_wait(WsTokenBucket* b, uint32_t n, int64_t now_us)
+{
+    int64_t need;
+
+    if (b->rate == 0) return 0;
+    ws_bucket_refill(b, now_us);
+    /* Larger than the bucket - wait for a full bucket */
+    if (n > b->burst) n = b->burst;
+    need = (int64_t)n * WS_BUCKET_SCALE - b->level;
+    if (need <= 0) return 0;
+    need = (need + b->rate - 1) / b->rate;
+    return (need > 0xFFFFFFFFLL) ? 0xFFFFFFFF : (uint32_t)need;
+}
+
+/*!
+ * \brief Take n tokens (check ws_bucket_wait() first or take with debt).
+ */
+void ws_bucket_take(WsTokenBucket* b, uint32_t n)
+{
+    if (b->rate == 0) return;
+    b->level -= (int64_t)n * WS_BUCKET_SCALE;
+}
+
+/*!
+ * \brief Available tokens (negative - debt).
+ */
+int32_t ws_bucket_tokens(const WsTokenBucket* b)
+{
+    return (int32_t)(b->level / WS_BUCKET_SCALE);
+}
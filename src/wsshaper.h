@@ -0,0 +1,51 @@
+/*
+ * Token bucket rate shaper.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSSHAPER__
+#define __RV_WSSHAPER__
+
+#include <stdint.h>
+
+/*!
+ * \brief Token bucket (one token = one byte).
+ *
+ * The bucket fills with rate tokens per second up to burst tokens. A message takes its size
+ * in tokens; a message larger than the bucket goes out when the bucket is full. Tokens taken
+ * with debt may drive the bucket below zero - later messages wait until the debt is repaid,
+ * so the long-term rate still holds.
+ */
+typedef struct {
+    uint32_t rate;                       /*!< Tokens per second (0 - unlimited)        */
+    uint32_t burst;                      /*!< Bucket size in tokens                    */
+    int64_t  level;                      /*!< Tokens x 1000000 (negative - debt)       */
+    int64_t  t_us;                       /*!< Last refill [us]                         */
+} WsTokenBucket;
+
+/*!
+ * \brief Set rate and burst, start with a full bucket.
+ */
+void ws_bucket_init(WsTokenBucket* b, uint32_t rate, uint32_t burst, int64_t now_us);
+
+/*!
+ * \brief Time until n tokens are available.
+ * \return 0 - available now, else wait time in [us].
+ */
+uint32_t ws_bucket_wait(WsTokenBucket* b, uint32_t n, int64_t now_us);
+
+/*!
+ * \brief Take n tokens (check ws_bucket_wait() first or take with debt).
+ */
+void ws_bucket_take(WsTokenBucket* b, uint32_t n);
+
+/*!
+ * \brief Available tokens (negative - debt).
+ */
+int32_t ws_bucket_tokens(const WsTokenBucket* b);
+
+#endif
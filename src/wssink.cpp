@@ -0,0 +1,99 @@
+/*
+ * Streaming sink for large binary messages (OTA images, files).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wssink.h"
+#include <errno.h>
+#include <unistd.h>
+
+/*!
+ * \brief Set writer and done callback, clear counters.
+ */
+void ws_sink_init(WsSink* s, WsSinkWriteCB write, WsSinkDoneCB done)
+{
+    s->write = write;
+    s->progress = nullptr;
+    s->done = done;
+    s->progress_step = WS_SINK_PROGRESS_STEP;
+    s->expected = 0;
+    s->received = 0;
+    s->next_progress = 0;
+    s->t0_us = 0;
+    s->t_us = 0;
+    s->status = WS_SINK_OK;
+}
+
+/*!
+ * \brief Sink writing to a file descriptor (file, pipe, VFS partition).
+ */
+void ws_sink_init_fd(WsSink* s, int fd, WsSinkDoneCB done)
+{
+    ws_sink_init(s, [fd](const char* data, uint32_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            data += n;
+            len -= n;
+        }
+        return 0;
+    }, done);
+}
+
+/*!
+ * \brief Message starts (expected - size if known and not set by the user, else 0).
+ */
+void ws_sink_begin(WsSink* s, uint64_t expected, int64_t now_us)
+{
+    if (!s->expected) s->expected = expected;
+    s->received = 0;
+    s->next_progress = s->progress_step;
+    s->t0_us = now_us;
+    s->t_us = now_us;
+    s->status = WS_SINK_BUSY;
+}
+
+/*!
+ * \brief Pass message data to the writer, call progress every progress_step bytes.
+ * \return < 0 when the writer failed (end the sink with WS_SINK_FAILED).
+ */
+int ws_sink_write(WsSink* s, const char* data, uint32_t len, int64_t now_us)
+{
+    if (s->status != WS_SINK_BUSY) return -1;
+    if ((len > 0) && (s->write(data, len) < 0)) return -1;
+    s->received += len;
+    s->t_us = now_us;
+    if (s->progress && (s->received >= s->next_progress)) {
+        s->next_progress = s->received + s->progress_step;
+        s->progress(s);
+    }
+    return 0;
+}
+
+/*!
+ * \brief Message ended (WS_SINK_OK), was cut (WS_SINK_ABORTED) or dropped (WS_SINK_FAILED) - call done.
+ */
+void ws_sink_end(WsSink* s, int status)
+{
+    if (s->status != WS_SINK_BUSY) return;
+    s->status = status;
+    if (s->done) s->done(s, status);
+}
+
+/*!
+ * \brief Average throughput of the message in bytes/s.
+ */
+uint32_t ws_sink_rate(const WsSink* s)
+{
+    int64_t dt = s->t_us - s->t0_us;
+
+    if (dt <= 0) return 0;
+    return (uint32_t)(s->received * 1000000 / dt);
+}
@@ -0,0 +1,82 @@
+/*
+ * Streaming sink for large binary messages (OTA images, files).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSSINK__
+#define __RV_WSSINK__
+
+#include <stdint.h>
+#include "wsdelegate.h"
+
+#define WS_SINK_BUSY          (1)        ///< Message in progress
+#define WS_SINK_OK            (0)        ///< Message complete
+#define WS_SINK_ABORTED       (-1)       ///< Connection lost before the end of the message
+#define WS_SINK_FAILED        (-2)       ///< write() failed, rest of the message dropped
+
+#ifndef WS_SINK_PROGRESS_STEP
+#define WS_SINK_PROGRESS_STEP (65536)    ///< Default bytes between progress callbacks
+#endif
+
+struct WsSink;
+
+typedef WsDelegate<int(const char* data, uint32_t len)> WsSinkWriteCB;
+typedef WsDelegate<void(WsSink* s)> WsSinkProgressCB;
+typedef WsDelegate<void(WsSink* s, int status)> WsSinkDoneCB;
+
+/*!
+ * \brief Sink for large binary messages.
+ *
+ * Payload goes to write() from the receive buffer as it arrives (after TLS decryption, before
+ * anything else touches it), so the message does not have to fit in the RX buffer and is never
+ * copied. write() returns < 0 to stop - the rest of the message is dropped.
+ */
+typedef struct WsSink {
+    WsSinkWriteCB    write;              /*!< Data writer                              */
+    WsSinkProgressCB progress;           /*!< Progress callback (optional)             */
+    WsSinkDoneCB     done;               /*!< End of message callback (optional)       */
+    uint32_t progress_step;              /*!< Bytes between progress callbacks         */
+    uint64_t expected;                   /*!< Message size (0 - unknown)               */
+    uint64_t received;                   /*!< Bytes written                            */
+    uint64_t next_progress;              /*!< received value of the next progress call */
+    int64_t  t0_us;                      /*!< Message start time [us]                  */
+    int64_t  t_us;                       /*!< Last data time [us]                      */
+    int      status;                     /*!< WS_SINK_xxx                              */
+} WsSink;
+
+/*!
+ * \brief Set writer and done callback, clear counters.
+ */
+void ws_sink_init(WsSink* s, WsSinkWriteCB write, WsSinkDoneCB done = nullptr);
+
+/*!
+ * \brief Sink writing to a file descriptor (file, pipe, VFS partition).
+ */
+void ws_sink_init_fd(WsSink* s, int fd, WsSinkDoneCB done = nullptr);
+
+/*!
+ * \brief Message starts (expected - size if known and not set by the user, else 0).
+ */
+void ws_sink_begin(WsSink* s, uint64_t expected, int64_t now_us);
+
+/*!
+ * \brief Pass message data to the writer, call progress every progress_step bytes.
+ * \return < 0 when the writer failed (end the sink with WS_SINK_FAILED).
+ */
+int ws_sink_write(WsSink* s, const char* data, uint32_t len, int64_t now_us);
+
+/*!
+ * \brief Message ended (WS_SINK_OK), was cut (WS_SINK_ABORTED) or dropped (WS_SINK_FAILED) - call done.
+ */
+void ws_sink_end(WsSink* s, int status);
+
+/*!
+ * \brief Average throughput of the message in bytes/s.
+ */
+uint32_t ws_sink_rate(const WsSink* s);
+
+#endif
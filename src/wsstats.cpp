@@ -0,0 +1,61 @@
+/*
+ * WebSocket/SocketIO client performance counters.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wsstats.h"
+
+const uint32_t ws_hist_bounds[WS_HIST_BUCKETS] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000,
+    300000, 500000, 750000, 1000000, 2000000, 5000000, 10000000, 0xFFFFFFFF
+};
+
+/*!
+ * \brief Add sample to the histogram.
+ */
+void ws_hist_add(WsLatencyHist* h, uint32_t us)
+{
+    int i = 0;
+
+    while ((i < WS_HIST_BUCKETS - 1) && (us > ws_hist_bounds[i])) i++;
+    h->buckets[i]++;
+    if ((h->count == 0) || (us < h->min_us)) h->min_us = us;
+    if (us > h->max_us) h->max_us = us;
+    h->last_us = us;
+    h->sum_us += us;
+    h->count++;
+}
+
+/*!
+ * \brief Average sample in [us] (0 when empty).
+ */
+uint32_t ws_hist_avg(const WsLatencyHist* h)
+{
+    return h->count ? (uint32_t)(h->sum_us / h->count) : 0;
+}
+
+/*!
+ * \brief Percentile (i.e. 50, 99) in [us], resolution is the bucket width.
+ */
+uint32_t ws_hist_percentile(const WsLatencyHist* h, int pct)
+{
+    uint64_t need = ((uint64_t)h->count * pct + 99) / 100, sum = 0;
+    uint32_t r;
+
+    if (h->count == 0) return 0;
+    for (int i = 0; i < WS_HIST_BUCKETS; i++) {
+        sum += h->buckets[i];
+        if (sum >= need) {
+            /* Bucket upper bound, clamped to the observed range */
+            r = ws_hist_bounds[i];
+            if (r > h->max_us) r = h->max_us;
+            if (r < h->min_us) r = h->min_us;
+            return r;
+        }
+    }
+    return h->max_us;
+}
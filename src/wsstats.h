@@ -0,0 +1,132 @@
+/*
+ * WebSocket/SocketIO client performance counters.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSSTATS__
+#define __RV_WSSTATS__
+
+#include <stdint.h>
+
+/* Connection handshake phases */
+#define WS_PHASE_TCP        (0)    ///< DNS + TCP connect
+#define WS_PHASE_TLS        (1)    ///< TLS handshake
+#define WS_PHASE_POLLING    (2)    ///< Engine.IO polling request (session ID)
+#define WS_PHASE_UPGRADE    (3)    ///< WebSocket upgrade request
+#define WS_PHASE_PROBE      (4)    ///< Engine.IO probe (or open packet in websocket-only mode)
+#define WS_PHASE_JOIN       (5)    ///< Socket.IO namespace CONNECT
+#define WS_PHASE_MAX        (6)
+
+/* Round-trip time sources */
+#define WS_RTT_PING         (0)    ///< WebSocket ping -> pong
+#define WS_RTT_EIO          (1)    ///< Engine.IO v3 ping -> pong
+#define WS_RTT_EIO_LAG      (2)    ///< Engine.IO v4 server ping arrived late (behind pingInterval)
+#define WS_RTT_ACK          (3)    ///< Socket.IO emit -> ack
+#define WS_RTT_MAX          (4)
+
+#define WS_HIST_BUCKETS     (16)
+
+/*!
+ * \brief Fixed bucket latency histogram (bucket upper bounds in ws_hist_bounds).
+ */
+typedef struct {
+    uint32_t count;                      /*!< Number of samples                        */
+    uint32_t min_us;                     /*!< Smallest sample [us]                     */
+    uint32_t max_us;                     /*!< Largest sample [us]                      */
+    uint32_t last_us;                    /*!< Last sample [us]                         */
+    uint64_t sum_us;                     /*!< Sum of all samples [us]                  */
+    uint32_t buckets[WS_HIST_BUCKETS];   /*!< Samples per bucket                       */
+} WsLatencyHist;
+
+/*!
+ * \brief Bucket upper bounds in [us] (last bucket is unbounded).
+ */
+extern const uint32_t ws_hist_bounds[WS_HIST_BUCKETS];
+
+/*!
+ * \brief Add sample to the histogram.
+ */
+void ws_hist_add(WsLatencyHist* h, uint32_t us);
+
+/*!
+ * \brief Average sample in [us] (0 when empty).
+ */
+uint32_t ws_hist_avg(const WsLatencyHist* h);
+
+/*!
+ * \brief Percentile (i.e. 50, 99) in [us], resolution is the bucket width.
+ */
+uint32_t ws_hist_percentile(const WsLatencyHist* h, int pct);
+
+/*!
+ * \brief WebSocket connection counters (all frame counters are indexed by opcode).
+ */
+typedef struct {
+    uint32_t rx_frames[16];              /*!< Received frames                          */
+    uint64_t rx_bytes[16];               /*!< Received payload bytes                   */
+    uint32_t tx_frames[16];              /*!< Sent frames                              */
+    uint64_t tx_bytes[16];               /*!< Sent payload bytes                       */
+    uint32_t send_failures;              /*!< send() calls that did not send the frame */
+    uint32_t lock_timeouts;              /*!< TX lock not taken in time                */
+    uint32_t tx_fragmented;              /*!< TX messages split into fragments         */
+    uint32_t tx_would_block;             /*!< trySend() calls returned WS_WOULD_BLOCK  */
+    uint32_t tx_queued;                  /*!< Messages queued for the TX task (duplex) */
+    uint32_t tx_queue_full;              /*!< Sends which found the TX queue full      */
+    uint32_t utf8_errors;                /*!< Text messages with invalid UTF-8         */
+    uint32_t connects;                   /*!< Successful connections                   */
+    uint32_t connect_failures;           /*!< Failed connection attempts               */
+    uint32_t reconnects;                 /*!< Successful connections after the first   */
+    uint32_t disconnects;                /*!< Lost connections                         */
+    uint32_t tls_resumed;                /*!< TLS handshakes with resumed session      */
+    uint32_t tls_full;                   /*!< Full TLS handshakes                      */
+    uint32_t dns_lookups;                /*!< Connects which resolved the host         */
+    uint32_t dns_cached;                 /*!< Connects with cached addresses           */
+    uint32_t connect_fallbacks;          /*!< Connects won by other than the first address */
+    uint32_t failovers;                  /*!< Connects to another endpoint than the last one */
+    uint32_t endpoint_switches;          /*!< Connections moved to a faster endpoint   */
+    uint32_t handshake_us[WS_PHASE_MAX]; /*!< Last handshake duration per phase [us]   */
+    uint32_t handshake_total_us;         /*!< Last handshake duration [us]             */
+    WsLatencyHist rtt[WS_RTT_MAX];       /*!< Round-trip times per source              */
+} WebSocketStats;
+
+/*!
+ * \brief Client memory footprint in bytes (heap blocks and task stacks).
+ */
+typedef struct {
+    uint32_t rx_buf;                     /*!< RX buffer now                            */
+    uint32_t tx_buf;                     /*!< TX buffer now                            */
+    uint32_t buffers_peak;               /*!< Largest RX + TX buffers                  */
+    uint32_t fixed;                      /*!< Client objects, transport, TX queues, urls */
+    uint32_t stacks;                     /*!< Task stacks                              */
+    uint32_t stack_free;                 /*!< Network task stack never used (0 - unknown) */
+    uint32_t total;                      /*!< fixed + stacks + buffers now             */
+    uint32_t total_peak;                 /*!< fixed + stacks + buffers_peak            */
+    uint32_t releases;                   /*!< Buffers freed or shrunk (low-memory mode) */
+} WsMemStats;
+
+/*!
+ * \brief SocketIO connection counters.
+ */
+typedef struct {
+    WebSocketStats ws;                   /*!< Underlying WebSocket counters            */
+    uint32_t events_rx;                  /*!< Received events                          */
+    uint32_t events_tx;                  /*!< Sent events                              */
+    uint32_t queued;                     /*!< Events put in the offline queue          */
+    uint32_t queue_dropped;              /*!< Events dropped by the offline queue      */
+    uint32_t replayed;                   /*!< Queued events sent after reconnect       */
+    uint32_t joins;                      /*!< Namespace joins                          */
+    uint32_t recovered;                  /*!< Joins which recovered previous session   */
+    uint32_t parse_errors;               /*!< Packets the parser could not decode/encode */
+    uint32_t conflated;                  /*!< sendLatest() values replaced before sending */
+    uint32_t shaped;                     /*!< Events delayed by the rate shaper        */
+    uint32_t shaped_would_block;         /*!< Non-waiting sends refused by the shaper  */
+    uint64_t shaped_wait_us;             /*!< Time events waited for the shaper [us]   */
+    uint32_t sink_events;                /*!< Binary events streamed to a sink         */
+    uint32_t sink_failures;              /*!< Binary events not completely in the sink */
+} SocketIoStats;
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Binary trace ring for hot-path events (build with -DWSC_TRACE).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wstrace.h"
+
+#ifdef WSC_TRACE
+#include <atomic>
+
+#if (WS_TRACE_SIZE & (WS_TRACE_SIZE - 1))
+#error "WS_TRACE_SIZE must be a power of 2"
+#endif
+
+static WsTraceRecord         ws_ring[WS_TRACE_SIZE];
+static std::atomic<uint32_t> ws_head(0);
+
+/*!
+ * \brief Put record into the ring (any task, no locks).
+ */
+void ws_trace(uint16_t id, uint32_t a, uint32_t b)
+{
+    uint32_t n = ws_head.fetch_add(1, std::memory_order_relaxed);
+    WsTraceRecord* r = &ws_ring[n & (WS_TRACE_SIZE - 1)];
+
+    r->ts = (uint32_t)esp_timer_get_time();
+    r->a = a;
+    r->b = b;
+    r->id = id;
+    r->seq = (uint16_t)n;
+}
+
+/*!
+ * \brief Copy up to max newest records (oldest first), return number of records.
+ */
+int ws_trace_dump(WsTraceRecord* out, int max)
+{
+    uint32_t head = ws_head.load(std::memory_order_relaxed);
+    uint32_t n = (head < WS_TRACE_SIZE) ? head : WS_TRACE_SIZE;
+    int r = 0;
+
+    if (n > (uint32_t)max) n = max;
+    for (uint32_t i = head - n; i != head; i++) {
+        out[r] = ws_ring[i & (WS_TRACE_SIZE - 1)];
+        /* Skip slots overwritten (or still being written) while copying */
+        if (out[r].seq == (uint16_t)i) r++;
+    }
+    return r;
+}
+
+/*!
+ * \brief Write ring as hex lines ("WST <record>") for tools/wstrace.py.
+ */
+void ws_trace_print(FILE* f)
+{
+    WsTraceRecord rec[32];
+    uint32_t head = ws_head.load(std::memory_order_relaxed);
+    uint32_t i = (head < WS_TRACE_SIZE) ? 0 : head - WS_TRACE_SIZE;
+
+    /* Chunks of 32 records - keep stack usage low */
+    while (i != head) {
+        int n = 0;
+        for (; (i != head) && (n < 32); i++) {
+            rec[n] = ws_ring[i & (WS_TRACE_SIZE - 1)];
+            if (rec[n].seq == (uint16_t)i) n++;
+        }
+        for (int k = 0; k < n; k++) {
+            const uint8_t* p = (const uint8_t*)&rec[k];
+            fprintf(f, "WST ");
+            for (int j = 0; j < (int)sizeof(WsTraceRecord); j++) fprintf(f, "%02x", p[j]);
+            fprintf(f, "\n");
+        }
+    }
+    fflush(f);
+}
+
+/*!
+ * \brief Forget all records.
+ */
+void ws_trace_clear()
+{
+    for (int i = 0; i < WS_TRACE_SIZE; i++) ws_ring[i].seq = 0xFFFF;
+    ws_head.store(0, std::memory_order_relaxed);
+}
+
+#endif
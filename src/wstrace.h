@@ -0,0 +1,76 @@
+/*
+ * Binary trace ring for hot-path events (build with -DWSC_TRACE).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSTRACE__
+#define __RV_WSTRACE__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Trace events (keep in sync with tools/wstrace.py) */
+#define WST_RX_FRAME        (1)    ///< a = opcode, b = payload length
+#define WST_TX_FRAME        (2)    ///< a = opcode, b = payload length
+#define WST_TX_FAIL         (3)    ///< a = opcode, b = payload length
+#define WST_LOCK_WAIT       (4)    ///< a = wait [us], b = 1 taken / 0 timeout
+#define WST_PARSE           (5)    ///< a = Engine.IO type << 8 | Socket.IO type, b = length
+#define WST_DISPATCH        (6)    ///< a = handler count, b = handler time [us]
+#define WST_PHASE           (7)    ///< a = WS_PHASE_xxx, b = duration [us]
+#define WST_CONNECT         (8)    ///< a = 1 connected / 0 failed, b = handshake time [us]
+#define WST_DISCONNECT      (9)    ///< a = connection count, b = 0
+#define WST_HEARTBEAT       (10)   ///< a = 1 pong / 0 ping, b = RTT or lag [us]
+#define WST_WORKER          (11)   ///< a = WS_MSG_xxx, b = handler time on the worker [us]
+
+#ifndef WS_TRACE_SIZE
+#define WS_TRACE_SIZE       (512)  ///< Ring size in records (power of 2)
+#endif
+
+/*!
+ * \brief Trace record (16 bytes, little endian when dumped).
+ */
+typedef struct {
+    uint32_t ts;                   /*!< esp_timer time [us] (low 32 bits)      */
+    uint16_t id;                   /*!< Event (WST_xxx)                        */
+    uint16_t seq;                  /*!< Sequence number (low 16 bits)          */
+    uint32_t a;                    /*!< First argument                         */
+    uint32_t b;                    /*!< Second argument                        */
+} WsTraceRecord;
+
+#ifdef WSC_TRACE
+#include <esp_timer.h>
+
+/*!
+ * \brief Put record into the ring (any task, no locks).
+ */
+void ws_trace(uint16_t id, uint32_t a, uint32_t b);
+
+/*!
+ * \brief Copy up to max newest records (oldest first), return number of records.
+ */
+int ws_trace_dump(WsTraceRecord* out, int max);
+
+/*!
+ * \brief Write ring as hex lines ("WST <record>") for tools/wstrace.py.
+ */
+void ws_trace_print(FILE* f);
+
+/*!
+ * \brief Forget all records.
+ */
+void ws_trace_clear();
+
+#define WS_TRACE(id, a, b)     ws_trace((id), (uint32_t)(a), (uint32_t)(b))
+#define WS_TRACE_T0(v)         int64_t v = esp_timer_get_time()
+#define WS_TRACE_US(v)         (esp_timer_get_time() - (v))
+#else
+#define WS_TRACE(id, a, b)     do { } while (0)
+#define WS_TRACE_T0(v)
+#define WS_TRACE_US(v)         (0)
+#endif
+
+#endif
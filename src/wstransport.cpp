@@ -0,0 +1,612 @@
+/*
+ * Socket transport (TCP/TLS) for WebSocket client.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wstransport.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifndef WS_TRANSPORT_NO_TLS
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#include <esp_crt_bundle.h>
+#endif
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+#endif
+
+static char tag[] = "WST";
+
+#ifdef DEBUG
+#define cl_wst_debug(fmt, args...)  ESP_LOGI(tag, fmt, ## args);
+#define cl_wst_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#else
+#define cl_wst_debug(fmt, args...)
+#define cl_wst_error(fmt, args...)  ESP_LOGE(tag, fmt, ## args);
+#endif
+
+/* esp_transport glue */
+#define WST(t) ((WsTransport*)esp_transport_get_context_data(t))
+static int wst_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms) { return WST(t)->connect(host, port, timeout_ms); }
+static int wst_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms) { return WST(t)->read(buffer, len, timeout_ms); }
+static int wst_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms) { return WST(t)->write(buffer, len, timeout_ms); }
+static int wst_close(esp_transport_handle_t t) { return WST(t)->close(); }
+static int wst_poll_read(esp_transport_handle_t t, int timeout_ms) { return WST(t)->pollRead(timeout_ms); }
+static int wst_poll_write(esp_transport_handle_t t, int timeout_ms) { return WST(t)->pollWrite(timeout_ms); }
+static int wst_destroy(esp_transport_handle_t) { return 0; }
+
+/*!
+ * \brief Construct a new WsTransport object.
+ * \param ssl - use TLS on top of TCP.
+ */
+WsTransport::WsTransport(bool ssl)
+{
+	m_fd        = -1;
+	m_ssl       = ssl;
+	m_resume    = false;
+	m_resumed   = false;
+	m_crtBundle = false;
+	m_caPem     = NULL;
+	m_tlsReady  = false;
+	m_tcpUs     = 0;
+	m_tlsUs     = 0;
+	m_dnsUs     = 0;
+	m_dnsCached = false;
+	m_addrIdx   = -1;
+	m_dnsCacheMs = WS_DNS_CACHE_MS;
+	clearDnsCache();
+#ifndef WS_TRANSPORT_NO_TLS
+	m_tlsOpen    = false;
+	m_hasSession = false;
+	mbedtls_ssl_session_init(&m_session);
+	mbedtls_ssl_config_init(&m_conf);
+	mbedtls_entropy_init(&m_entropy);
+	mbedtls_ctr_drbg_init(&m_drbg);
+	mbedtls_x509_crt_init(&m_ca);
+#endif
+	m_tr = esp_transport_init();
+	esp_transport_set_context_data(m_tr, this);
+	esp_transport_set_func(m_tr, wst_connect, wst_read, wst_write, wst_close, wst_poll_read, wst_poll_write, wst_destroy);
+}
+
+/*!
+ * \brief Destructor.
+ */
+WsTransport::~WsTransport()
+{
+	close();
+	esp_transport_destroy(m_tr);
+#ifndef WS_TRANSPORT_NO_TLS
+	mbedtls_ssl_session_free(&m_session);
+	mbedtls_x509_crt_free(&m_ca);
+	mbedtls_ssl_config_free(&m_conf);
+	mbedtls_ctr_drbg_free(&m_drbg);
+	mbedtls_entropy_free(&m_entropy);
+#endif
+}
+
+/*!
+ * \brief Forget stored TLS session (next handshake is a full one).
+ */
+void WsTransport::clearSession()
+{
+#ifndef WS_TRANSPORT_NO_TLS
+	if (m_hasSession) {
+		mbedtls_ssl_session_free(&m_session);
+		mbedtls_ssl_session_init(&m_session);
+		m_hasSession = false;
+	}
+#endif
+}
+
+/*!
+ * \brief Forget resolved addresses.
+ */
+void WsTransport::clearDnsCache()
+{
+	memset(m_dns, 0, sizeof(m_dns));
+}
+
+/*!
+ * \brief Next address of the family (same = true) or of any other family (same = false).
+ */
+static struct addrinfo* wst_next_family(struct addrinfo* ai, int fam, bool same)
+{
+	for (; ai; ai = ai->ai_next) {
+		if ((ai->ai_family == fam) == same) return ai;
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Resolve host (or take its addresses from the cache).
+ * \param host - host name or IP address,
+ * \param port - TCP port.
+ * \return NULL - unable to resolve.
+ */
+WsDnsEntry* WsTransport::resolve(const char* host, int port)
+{
+	struct addrinfo hints, *res = NULL, *a, *b;
+	int64_t now = esp_timer_get_time();
+	bool cache = (m_dnsCacheMs > 0) && (strlen(host) < WS_DNS_HOST_LEN), turn = true;
+	WsDnsEntry* e = NULL;
+	char ports[8];
+	int i, fam;
+
+	m_dnsCached = false;
+	m_dnsUs = 0;
+	for (i = 0; (i < WS_DNS_HOSTS) && cache; i++) {
+		WsDnsEntry* c = &m_dns[i];
+		if ((c->t_us == 0) || (c->port != port) || strcmp(c->host, host)) continue;
+		if (now - c->t_us < (int64_t)m_dnsCacheMs * 1000) {
+			m_dnsCached = true;
+			c->used_us = now;
+			return c;
+		}
+		/* Expired - resolve into the same slot */
+		e = c;
+	}
+	/* Free slot, then an expired one, then the least recently used one */
+	for (i = 0; (i < WS_DNS_HOSTS) && (!e); i++) {
+		if (m_dns[i].t_us == 0) e = &m_dns[i];
+	}
+	for (i = 0; (i < WS_DNS_HOSTS) && (!e); i++) {
+		if (now - m_dns[i].t_us >= (int64_t)m_dnsCacheMs * 1000) e = &m_dns[i];
+	}
+	if (!e) {
+		e = &m_dns[0];
+		for (i = 1; i < WS_DNS_HOSTS; i++) {
+			if (m_dns[i].used_us < e->used_us) e = &m_dns[i];
+		}
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(ports, sizeof(ports), "%d", port);
+	i = getaddrinfo(host, ports, &hints, &res);
+	m_dnsUs = esp_timer_get_time() - now;
+	if ((i != 0) || (!res)) {
+		cl_wst_error("Unable to resolve %s", host);
+		e->t_us = 0;
+		return NULL;
+	}
+	/* Alternate address families in resolver order, so a broken family costs one stagger delay */
+	fam = res->ai_family;
+	a = res;
+	b = wst_next_family(res, fam, false);
+	for (e->n = 0; (e->n < WS_DNS_ADDRS) && (a || b); turn = !turn) {
+		struct addrinfo** c = ((turn && a) || (!b)) ? &a : &b;
+		memcpy(&e->addr[e->n], (*c)->ai_addr, (*c)->ai_addrlen);
+		e->len[e->n++] = (*c)->ai_addrlen;
+		*c = wst_next_family((*c)->ai_next, fam, c == &a);
+	}
+	freeaddrinfo(res);
+	strncpy(e->host, cache ? host : "", WS_DNS_HOST_LEN - 1);
+	e->host[WS_DNS_HOST_LEN - 1] = '\0';
+	e->port = port;
+	/* Not cached - used for this connect only */
+	e->t_us = cache ? now : 0;
+	e->used_us = now;
+	return (e->n > 0) ? e : NULL;
+}
+
+/*!
+ * \brief Start non blocking connect.
+ * \return socket or -1.
+ */
+static int wst_connect_start(const struct sockaddr* addr, socklen_t len)
+{
+	int fd = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+
+	if (fd < 0) return -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	if ((::connect(fd, addr, len) < 0) && (errno != EINPROGRESS)) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*!
+ * \brief Connect to the first address which answers (happy eyeballs): the next address is tried
+ * every WS_CONNECT_STAGGER_MS (at once when all attempts failed) while earlier attempts go on.
+ * \return index of the connected address (socket in m_fd), -1 - none.
+ */
+int WsTransport::raceConnect(WsDnsEntry* e, int timeout_ms)
+{
+	int fds[WS_DNS_ADDRS], started = 0, open = 0, win = -1, i, one = 1;
+	int64_t now = esp_timer_get_time(), end = now + (int64_t)timeout_ms * 1000, next = now;
+
+	for (i = 0; i < WS_DNS_ADDRS; i++) fds[i] = -1;
+	while ((win < 0) && (now < end)) {
+		struct timeval tv;
+		fd_set wset, eset;
+		int64_t wait = end - now;
+		int maxfd = -1;
+
+		if ((started < e->n) && ((now >= next) || (open == 0))) {
+			cl_wst_debug("Connect to address %d/%d", started + 1, e->n);
+			fds[started] = wst_connect_start((const struct sockaddr*)&e->addr[started], e->len[started]);
+			if (fds[started] >= 0) open++;
+			started++;
+			next = now + WS_CONNECT_STAGGER_MS * 1000;
+			continue;
+		}
+		if (open == 0) break;
+		if ((started < e->n) && (next - now < wait)) wait = next - now;
+		FD_ZERO(&wset);
+		FD_ZERO(&eset);
+		for (i = 0; i < started; i++) {
+			if (fds[i] < 0) continue;
+			FD_SET(fds[i], &wset);
+			FD_SET(fds[i], &eset);
+			if (fds[i] > maxfd) maxfd = fds[i];
+		}
+		tv.tv_sec = wait / 1000000;
+		tv.tv_usec = wait % 1000000;
+		if (select(maxfd + 1, NULL, &wset, &eset, &tv) < 0) break;
+		for (i = 0; (i < started) && (win < 0); i++) {
+			int err = 0;
+			socklen_t l = sizeof(err);
+			if ((fds[i] < 0) || ((!FD_ISSET(fds[i], &wset)) && (!FD_ISSET(fds[i], &eset)))) continue;
+			if ((getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &err, &l) < 0) || err) {
+				/* Refused or unreachable - next address goes at once */
+				::close(fds[i]);
+				fds[i] = -1;
+				open--;
+				continue;
+			}
+			win = i;
+		}
+		now = esp_timer_get_time();
+	}
+	/* Cancel the slower attempts */
+	for (i = 0; i < started; i++) {
+		if ((fds[i] >= 0) && (i != win)) ::close(fds[i]);
+	}
+	if (win < 0) return -1;
+	m_fd = fds[win];
+	fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL, 0) & ~O_NONBLOCK);
+	setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return win;
+}
+
+/*!
+ * \brief Resolve host and open TCP connection.
+ * \param host - host name or IP address,
+ * \param port - TCP port,
+ * \param timeout_ms - timeout in [ms].
+ */
+int WsTransport::tcpConnect(const char* host, int port, int timeout_ms)
+{
+	WsDnsEntry* e = resolve(host, port);
+
+	m_addrIdx = -1;
+	if (!e) return -1;
+	m_addrIdx = raceConnect(e, timeout_ms);
+	if (m_addrIdx < 0) {
+		/* No address answers - the server may have moved, resolve again next time */
+		cl_wst_error("Unable to connect to %s (%d addresses)", host, e->n);
+		e->t_us = 0;
+		return -1;
+	}
+	if (m_addrIdx > 0) {
+		/* Working address goes first next time */
+		struct sockaddr_storage a = e->addr[m_addrIdx];
+		socklen_t l = e->len[m_addrIdx];
+		e->addr[m_addrIdx] = e->addr[0];
+		e->len[m_addrIdx] = e->len[0];
+		e->addr[0] = a;
+		e->len[0] = l;
+	}
+	return 0;
+}
+
+#ifndef WS_TRANSPORT_NO_TLS
+/*!
+ * \brief mbedtls BIO - send.
+ */
+static int wst_tls_send(void* ctx, const unsigned char* buf, size_t len)
+{
+	int r = ::send(((WsTransport*)ctx)->m_fd, buf, len, 0);
+	if (r < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+	return r;
+}
+
+/*!
+ * \brief mbedtls BIO - receive.
+ */
+static int wst_tls_recv(void* ctx, unsigned char* buf, size_t len)
+{
+	int r = ::recv(((WsTransport*)ctx)->m_fd, buf, len, 0);
+	if (r < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+	if (r == 0) return MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+	return r;
+}
+
+/*!
+ * \brief Prepare TLS configuration (once).
+ */
+int WsTransport::tlsSetup()
+{
+	int ret;
+
+	if (m_tlsReady) return 0;
+	/* Configuration may change between connections - start from scratch */
+	mbedtls_x509_crt_free(&m_ca);
+	mbedtls_x509_crt_init(&m_ca);
+	mbedtls_ssl_config_free(&m_conf);
+	mbedtls_ssl_config_init(&m_conf);
+	mbedtls_ctr_drbg_free(&m_drbg);
+	mbedtls_ctr_drbg_init(&m_drbg);
+	if ((ret = mbedtls_ctr_drbg_seed(&m_drbg, mbedtls_entropy_func, &m_entropy, NULL, 0)) != 0) {
+		cl_wst_error("mbedtls_ctr_drbg_seed failed (-0x%x)", -ret);
+		return -1;
+	}
+	if ((ret = mbedtls_ssl_config_defaults(&m_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+		cl_wst_error("mbedtls_ssl_config_defaults failed (-0x%x)", -ret);
+		return -1;
+	}
+	mbedtls_ssl_conf_rng(&m_conf, mbedtls_ctr_drbg_random, &m_drbg);
+	/* Server verification - same order as esp-tls */
+	if (m_crtBundle) {
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+		if (esp_crt_bundle_attach(&m_conf) != ESP_OK) {
+			cl_wst_error("Unable to attach certificate bundle");
+			return -1;
+		}
+		mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+#else
+		cl_wst_error("Certificate bundle is not enabled (CONFIG_MBEDTLS_CERTIFICATE_BUNDLE)");
+		return -1;
+#endif
+	} else if (m_caPem) {
+		if ((ret = mbedtls_x509_crt_parse(&m_ca, (const unsigned char*)m_caPem, strlen(m_caPem) + 1)) < 0) {
+			cl_wst_error("mbedtls_x509_crt_parse failed (-0x%x)", -ret);
+			return -1;
+		}
+		mbedtls_ssl_conf_ca_chain(&m_conf, &m_ca, NULL);
+		mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+	} else {
+#ifdef CONFIG_ESP_TLS_SKIP_SERVER_CERT_VERIFY
+		mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_NONE);
+#else
+		cl_wst_error("No server verification option set (setCACert or setCrtBundle)");
+		return -1;
+#endif
+	}
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	mbedtls_ssl_conf_session_tickets(&m_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+	/* New trust settings - do not resume session verified with old ones */
+	clearSession();
+	m_tlsReady = true;
+	return 0;
+}
+
+/*!
+ * \brief TLS handshake on connected socket.
+ * \param host - host name (SNI and certificate check),
+ * \param timeout_ms - timeout in [ms].
+ */
+int WsTransport::tlsConnect(const char* host, int timeout_ms)
+{
+	struct timeval tv;
+	TickType_t start = xTaskGetTickCount();
+	bool offered = false;
+	int ret;
+
+	m_resumed = false;
+	if (tlsSetup() < 0) return -1;
+	mbedtls_ssl_init(&m_sslCtx);
+	m_tlsOpen = true;
+	if ((ret = mbedtls_ssl_setup(&m_sslCtx, &m_conf)) != 0) {
+		cl_wst_error("mbedtls_ssl_setup failed (-0x%x)", -ret);
+		return -1;
+	}
+	mbedtls_ssl_set_hostname(&m_sslCtx, host);
+	mbedtls_ssl_set_bio(&m_sslCtx, this, wst_tls_send, wst_tls_recv, NULL);
+	if (m_resume && m_hasSession) {
+		offered = (mbedtls_ssl_set_session(&m_sslCtx, &m_session) == 0);
+	}
+	/* Blocking handshake, socket timeouts bound every single read/write */
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	while ((ret = mbedtls_ssl_handshake(&m_sslCtx)) != 0) {
+		if (((ret != MBEDTLS_ERR_SSL_WANT_READ) && (ret != MBEDTLS_ERR_SSL_WANT_WRITE)) ||
+			((int)((xTaskGetTickCount() - start) * portTICK_PERIOD_MS) >= timeout_ms)) {
+			cl_wst_error("TLS handshake failed (-0x%x)", -ret);
+			/* Server may have dropped the session - do not offer it again */
+			if (offered) clearSession();
+			return -1;
+		}
+	}
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	/* Keep session for the next connection */
+	if (m_resume) {
+		mbedtls_ssl_session s;
+		mbedtls_ssl_session_init(&s);
+		if (mbedtls_ssl_get_session(&m_sslCtx, &s) == 0) {
+			/* Server echoes the offered session ID only when it resumes (start time has 1 s resolution) */
+			m_resumed = offered && (s.MBEDTLS_PRIVATE(id_len) > 0) && (s.MBEDTLS_PRIVATE(id_len) == m_session.MBEDTLS_PRIVATE(id_len)) &&
+				(!memcmp(s.MBEDTLS_PRIVATE(id), m_session.MBEDTLS_PRIVATE(id), s.MBEDTLS_PRIVATE(id_len)));
+			mbedtls_ssl_session_free(&m_session);
+			m_session = s;
+			m_hasSession = true;
+		} else {
+			mbedtls_ssl_session_free(&s);
+		}
+	}
+	cl_wst_debug("TLS handshake done (%s, %s)", m_resumed ? "resumed" : "full", mbedtls_ssl_get_ciphersuite(&m_sslCtx));
+	return 0;
+}
+#endif
+
+/*!
+ * \brief Connect (esp_transport connect).
+ */
+int WsTransport::connect(const char* host, int port, int timeout_ms)
+{
+	int64_t t = esp_timer_get_time();
+
+	close();
+	m_tcpUs = 0;
+	m_tlsUs = 0;
+	if (tcpConnect(host, port, timeout_ms) < 0) return -1;
+	m_tcpUs = esp_timer_get_time() - t;
+	if (m_ssl) {
+#ifndef WS_TRANSPORT_NO_TLS
+		t = esp_timer_get_time();
+		if (tlsConnect(host, timeout_ms) < 0) {
+			close();
+			return -1;
+		}
+		m_tlsUs = esp_timer_get_time() - t;
+#else
+		cl_wst_error("TLS is not available in this build");
+		close();
+		return -1;
+#endif
+	}
+	return 0;
+}
+
+/*!
+ * \brief Wait for socket readable/writable.
+ */
+int WsTransport::poll(bool rd, int timeout_ms)
+{
+	struct timeval tv, *ptv = NULL;
+	fd_set set, eset;
+	int r;
+
+	if (m_fd < 0) return -1;
+	FD_ZERO(&set);
+	FD_ZERO(&eset);
+	FD_SET(m_fd, &set);
+	FD_SET(m_fd, &eset);
+	if (timeout_ms >= 0) {
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		ptv = &tv;
+	}
+	r = select(m_fd + 1, rd ? &set : NULL, rd ? NULL : &set, &eset, ptv);
+	if ((r > 0) && FD_ISSET(m_fd, &eset)) return -1;
+	return r;
+}
+
+/*!
+ * \brief Poll for read (esp_transport poll_read).
+ */
+int WsTransport::pollRead(int timeout_ms)
+{
+#ifndef WS_TRANSPORT_NO_TLS
+	/* Decrypted data already waiting in TLS context */
+	if (m_tlsOpen && (mbedtls_ssl_get_bytes_avail(&m_sslCtx) > 0)) return 1;
+#endif
+	return poll(true, timeout_ms);
+}
+
+/*!
+ * \brief Poll for write (esp_transport poll_write).
+ */
+int WsTransport::pollWrite(int timeout_ms)
+{
+	return poll(false, timeout_ms);
+}
+
+/*!
+ * \brief Read (esp_transport read).
+ */
+int WsTransport::read(char* buffer, int len, int timeout_ms)
+{
+	int r;
+
+	if (m_fd < 0) return -1;
+	if (timeout_ms >= 0) {
+		r = pollRead(timeout_ms);
+		if (r <= 0) return r;
+	}
+#ifndef WS_TRANSPORT_NO_TLS
+	if (m_tlsOpen) {
+		do {
+			r = mbedtls_ssl_read(&m_sslCtx, (unsigned char*)buffer, len);
+		} while ((r == MBEDTLS_ERR_SSL_WANT_READ) || (r == MBEDTLS_ERR_SSL_WANT_WRITE));
+		if (r == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) return 0;
+		return (r < 0) ? -1 : r;
+	}
+#endif
+	r = ::recv(m_fd, buffer, len, 0);
+	return (r < 0) ? -1 : r;
+}
+
+/*!
+ * \brief Write whole buffer (esp_transport write).
+ */
+int WsTransport::write(const char* buffer, int len, int timeout_ms)
+{
+	int r, done = 0;
+
+	if (m_fd < 0) return -1;
+	while (done < len) {
+		r = pollWrite(timeout_ms);
+		if (r <= 0) return (done > 0) ? done : r;
+#ifndef WS_TRANSPORT_NO_TLS
+		if (m_tlsOpen) {
+			r = mbedtls_ssl_write(&m_sslCtx, (const unsigned char*)buffer + done, len - done);
+			if ((r == MBEDTLS_ERR_SSL_WANT_READ) || (r == MBEDTLS_ERR_SSL_WANT_WRITE)) continue;
+		} else
+#endif
+		{
+			r = ::send(m_fd, buffer + done, len - done, 0);
+		}
+		if (r < 0) return -1;
+		done += r;
+	}
+	return done;
+}
+
+/*!
+ * \brief Close connection (esp_transport close).
+ */
+int WsTransport::close()
+{
+#ifndef WS_TRANSPORT_NO_TLS
+	if (m_tlsOpen) {
+		if (m_fd >= 0) {
+			/* Best effort close notify, never block on a dead link */
+			fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL, 0) | O_NONBLOCK);
+			mbedtls_ssl_close_notify(&m_sslCtx);
+		}
+		mbedtls_ssl_free(&m_sslCtx);
+		m_tlsOpen = false;
+	}
+#endif
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Socket transport (TCP/TLS) for WebSocket client.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSTRANSPORT__
+#define __RV_WSTRANSPORT__
+
+#include <esp_transport.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef WS_TRANSPORT_NO_TLS
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#endif
+
+#define WS_DNS_HOSTS          (4)       ///< Hosts in the DNS cache
+#define WS_DNS_ADDRS          (4)       ///< Addresses kept per host (connection attempts)
+#define WS_DNS_HOST_LEN       (64)      ///< Longest cached host name (longer names are resolved every time)
+#define WS_DNS_CACHE_MS       (300000)  ///< Default DNS cache time in [ms]
+#define WS_CONNECT_STAGGER_MS (250)     ///< Delay before the next address is tried in parallel
+
+/*!
+ * \brief Resolved addresses of a host (alternating address families, last working address first).
+ */
+typedef struct {
+    char                    host[WS_DNS_HOST_LEN];
+    int                     port;
+    int64_t                 t_us;                  /*!< Resolve time [us] (0 - free)        */
+    int64_t                 used_us;               /*!< Last use time [us]                  */
+    uint8_t                 n;                     /*!< Number of addresses                 */
+    socklen_t               len[WS_DNS_ADDRS];
+    struct sockaddr_storage addr[WS_DNS_ADDRS];
+} WsDnsEntry;
+
+/*!
+ * \brief esp_transport implementation (plain TCP or TLS) which keeps TLS session between connections.
+ */
+class WsTransport {
+public:
+    /*!
+     * \brief Construct a new WsTransport object.
+     * \param ssl - use TLS on top of TCP.
+     */
+    WsTransport(bool ssl);
+    ~WsTransport();
+
+    /*!
+     * \brief Get esp_transport handle (for esp_transport_xxx API).
+     */
+    esp_transport_handle_t handle() const { return m_tr; }
+
+    /*!
+     * \brief Set server CA certificate (PEM, NULL terminated, must stay valid).
+     */
+    void setCACert(const char* pem) { m_caPem = pem; m_tlsReady = false; }
+
+    /*!
+     * \brief Verify server with ESP-IDF certificate bundle (CONFIG_MBEDTLS_CERTIFICATE_BUNDLE).
+     */
+    void setCrtBundle(bool b) { m_crtBundle = b; m_tlsReady = false; }
+
+    /*!
+     * \brief Offer TLS session from the previous connection on reconnect (default off).
+     */
+    void setSessionResume(bool b) { m_resume = b; if (!b) clearSession(); }
+    bool getSessionResume() const { return m_resume; }
+
+    /*!
+     * \brief Forget stored TLS session (next handshake is a full one).
+     */
+    void clearSession();
+
+    /*!
+     * \brief Last TLS handshake resumed stored session.
+     */
+    bool isResumed() const { return m_resumed; }
+
+    /*!
+     * \brief Keep resolved addresses for ms (0 - resolve on every connect). Addresses are resolved
+     * again when none of them answers.
+     */
+    void setDnsCacheTime(uint32_t ms) { m_dnsCacheMs = ms; }
+    uint32_t getDnsCacheTime() const { return m_dnsCacheMs; }
+
+    /*!
+     * \brief Forget resolved addresses.
+     */
+    void clearDnsCache();
+
+    int connect(const char* host, int port, int timeout_ms);
+    int read(char* buffer, int len, int timeout_ms);
+    int write(const char* buffer, int len, int timeout_ms);
+    int pollRead(int timeout_ms);
+    int pollWrite(int timeout_ms);
+    int close();
+
+private:
+    int tcpConnect(const char* host, int port, int timeout_ms);
+    WsDnsEntry* resolve(const char* host, int port);
+    int raceConnect(WsDnsEntry* e, int timeout_ms);
+    int poll(bool rd, int timeout_ms);
+#ifndef WS_TRANSPORT_NO_TLS
+    int tlsSetup();
+    int tlsConnect(const char* host, int timeout_ms);
+#endif
+
+public:
+    esp_transport_handle_t m_tr;
+    int                    m_fd;
+    bool                   m_ssl;
+    bool                   m_resume;
+    bool                   m_resumed;
+    bool                   m_crtBundle;
+    const char*            m_caPem;
+    bool                   m_tlsReady;          /*!< TLS config initialized          */
+    uint32_t               m_tcpUs;             /*!< Last DNS + TCP connect time [us] */
+    uint32_t               m_tlsUs;             /*!< Last TLS handshake time [us]     */
+    uint32_t               m_dnsUs;             /*!< Last DNS lookup time [us] (0 - cached) */
+    bool                   m_dnsCached;         /*!< Last connect used cached addresses */
+    int                    m_addrIdx;           /*!< Address of the last connect (-1 none) */
+    uint32_t               m_dnsCacheMs;        /*!< DNS cache time [ms] (0 - off)    */
+    WsDnsEntry             m_dns[WS_DNS_HOSTS]; /*!< DNS cache                        */
+#ifndef WS_TRANSPORT_NO_TLS
+    bool                   m_tlsOpen;           /*!< TLS context is set up            */
+    bool                   m_hasSession;        /*!< m_session holds a valid session  */
+    mbedtls_ssl_context    m_sslCtx;
+    mbedtls_ssl_config     m_conf;
+    mbedtls_ssl_session    m_session;
+    mbedtls_entropy_context m_entropy;
+    mbedtls_ctr_drbg_context m_drbg;
+    mbedtls_x509_crt       m_ca;
+#endif
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Incremental UTF-8 validation of text messages (RFC 6455, section 8.1).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "wsutf8.h"
+#include <stddef.h>
+
+typedef uint32_t __attribute__((__may_alias__)) ws_word_t;
+
+/*!
+ * \brief Start of a new message.
+ */
+void ws_utf8_reset(WsUtf8* s)
+{
+    s->need = 0;
+    s->lo = 0x80;
+    s->hi = 0xBF;
+}
+
+/*!
+ * \brief Check next part of the message (ASCII runs are checked a word at a time).
+ * \return 1 - valid so far, 0 - invalid UTF-8.
+ */
+int ws_utf8_feed(WsUtf8* s, const char* data, uint32_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+
+    while (p < end) {
+        uint8_t c = *p;
+        if (s->need) {
+            /* Continuation byte */
+            if ((c < s->lo) || (c > s->hi)) return 0;
+            s->need--;
+            s->lo = 0x80;
+            s->hi = 0xBF;
+            p++;
+            continue;
+        }
+        if (c < 0x80) {
+            p++;
+            /* ASCII - skip whole words once aligned */
+            if (((uintptr_t)p & (sizeof(ws_word_t) - 1)) == 0) {
+                while ((end - p >= (ptrdiff_t)sizeof(ws_word_t)) && !(*(const ws_word_t*)p & 0x80808080u)) p += sizeof(ws_word_t);
+            }
+            continue;
+        }
+        /* Lead byte - number of continuation bytes and range of the first one (no overlong forms, surrogates, > U+10FFFF) */
+        if ((c >= 0xC2) && (c <= 0xDF)) {
+            s->need = 1;
+        } else if (c == 0xE0) {
+            s->need = 2; s->lo = 0xA0;
+        } else if (c == 0xED) {
+            s->need = 2; s->hi = 0x9F;
+        } else if ((c >= 0xE1) && (c <= 0xEF)) {
+            s->need = 2;
+        } else if (c == 0xF0) {
+            s->need = 3; s->lo = 0x90;
+        } else if ((c >= 0xF1) && (c <= 0xF3)) {
+            s->need = 3;
+        } else if (c == 0xF4) {
+            s->need = 3; s->hi = 0x8F;
+        } else {
+            return 0;
+        }
+        p++;
+    }
+    return 1;
+}
@@ -0,0 +1,40 @@
+/*
+ * Incremental UTF-8 validation of text messages (RFC 6455, section 8.1).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RV_WSUTF8__
+#define __RV_WSUTF8__
+
+#include <stdint.h>
+
+/*!
+ * \brief Validator state (kept between fragments of one message).
+ */
+typedef struct {
+    uint8_t need;                  /*!< Continuation bytes still expected      */
+    uint8_t lo;                    /*!< Lowest allowed next continuation byte  */
+    uint8_t hi;                    /*!< Highest allowed next continuation byte */
+} WsUtf8;
+
+/*!
+ * \brief Start of a new message.
+ */
+void ws_utf8_reset(WsUtf8* s);
+
+/*!
+ * \brief Check next part of the message (ASCII runs are checked a word at a time).
+ * \return 1 - valid so far, 0 - invalid UTF-8.
+ */
+int ws_utf8_feed(WsUtf8* s, const char* data, uint32_t len);
+
+/*!
+ * \brief Message ends on a character boundary (call after the last fragment).
+ */
+static inline bool ws_utf8_complete(const WsUtf8* s) { return s->need == 0; }
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __HOST_ESP_TRANSPORT_SSL_H__
+#define __HOST_ESP_TRANSPORT_SSL_H__
+
+#include "esp_transport.h"
+
+/* Emulated with WsTransport (no session resume) in host TLS builds, not available without TLS. */
+esp_transport_handle_t esp_transport_ssl_init(void);
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_crt_bundle_attach(esp_transport_handle_t t, esp_err_t ((*crt_bundle_attach)(void* conf)));
+
+#endif
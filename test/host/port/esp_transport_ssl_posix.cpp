@@ -0,0 +1,34 @@
+/*
+ * esp_transport_ssl emulation (host TLS builds only): WsTransport with TLS session resume off.
+ */
+#include "esp_transport_ssl.h"
+#include "wstransport.h"
+
+#define SSLT(t) (((WsTransport*)esp_transport_get_context_data(t))->handle())
+
+static int ssl_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms) { return esp_transport_connect(SSLT(t), host, port, timeout_ms); }
+static int ssl_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms) { return esp_transport_read(SSLT(t), buffer, len, timeout_ms); }
+static int ssl_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms) { return esp_transport_write(SSLT(t), buffer, len, timeout_ms); }
+static int ssl_close(esp_transport_handle_t t) { return esp_transport_close(SSLT(t)); }
+static int ssl_poll_read(esp_transport_handle_t t, int timeout_ms) { return esp_transport_poll_read(SSLT(t), timeout_ms); }
+static int ssl_poll_write(esp_transport_handle_t t, int timeout_ms) { return esp_transport_poll_write(SSLT(t), timeout_ms); }
+static int ssl_destroy(esp_transport_handle_t t) { delete (WsTransport*)esp_transport_get_context_data(t); return 0; }
+
+esp_transport_handle_t esp_transport_ssl_init(void)
+{
+	esp_transport_handle_t t = esp_transport_init();
+
+	esp_transport_set_context_data(t, new WsTransport(true));
+	esp_transport_set_func(t, ssl_connect, ssl_read, ssl_write, ssl_close, ssl_poll_read, ssl_poll_write, ssl_destroy);
+	return t;
+}
+
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t t, const char* data, int)
+{
+	((WsTransport*)esp_transport_get_context_data(t))->setCACert(data);
+}
+
+void esp_transport_ssl_crt_bundle_attach(esp_transport_handle_t t, esp_err_t ((*)(void* conf)))
+{
+	((WsTransport*)esp_transport_get_context_data(t))->setCrtBundle(true);
+}
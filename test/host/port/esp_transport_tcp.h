@@ -0,0 +1,9 @@
+#ifndef __HOST_ESP_TRANSPORT_TCP_H__
+#define __HOST_ESP_TRANSPORT_TCP_H__
+
+#include "esp_transport.h"
+
+/* Not implemented on the host (WsTransport is used instead). */
+esp_transport_handle_t esp_transport_tcp_init(void);
+
+#endif
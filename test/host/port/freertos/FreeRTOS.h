@@ -0,0 +1,38 @@
+/*
+ * Minimal FreeRTOS API emulation on top of POSIX threads (host builds only).
+ */
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int           BaseType_t;
+typedef unsigned int  UBaseType_t;
+typedef uint32_t      TickType_t;
+
+#define pdFALSE              ((BaseType_t)0)
+#define pdTRUE               ((BaseType_t)1)
+#define pdPASS               (pdTRUE)
+#define pdFAIL               (pdFALSE)
+#define portMAX_DELAY        ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS   ((TickType_t)1)
+#define pdMS_TO_TICKS(ms)    ((TickType_t)(ms))
+#define tskNO_AFFINITY       ((BaseType_t)0x7FFFFFFF)
+#define configMAX_PRIORITIES (25)
+#define tskIDLE_PRIORITY     (0)
+
+typedef struct host_mux { void* m; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { NULL }
+void host_mux_lock(portMUX_TYPE* mux);
+void host_mux_unlock(portMUX_TYPE* mux);
+#define portENTER_CRITICAL(mux) host_mux_lock(mux)
+#define portEXIT_CRITICAL(mux)  host_mux_unlock(mux)
+#define taskENTER_CRITICAL(mux) host_mux_lock(mux)
+#define taskEXIT_CRITICAL(mux)  host_mux_unlock(mux)
+
+BaseType_t xPortGetCoreID(void);
+
+#include "semphr.h"
+
+#endif
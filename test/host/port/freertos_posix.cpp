@@ -0,0 +1,301 @@
+/*
+ * Minimal FreeRTOS API emulation on top of POSIX threads (host builds only).
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct host_sem {
+	pthread_mutex_t m;
+	pthread_cond_t  c;
+	UBaseType_t     count;
+	UBaseType_t     max;
+};
+
+struct host_task {
+	pthread_t       th;
+	TaskFunction_t  fn;
+	void*           arg;
+	pthread_mutex_t m;
+	pthread_cond_t  c;
+	uint32_t        notify;
+};
+
+struct host_queue {
+	pthread_mutex_t m;
+	pthread_cond_t  c;
+	UBaseType_t     len;
+	UBaseType_t     size;
+	UBaseType_t     head;
+	UBaseType_t     count;
+	uint8_t*        data;
+};
+
+static pthread_key_t  s_task_key;
+static pthread_once_t s_task_once = PTHREAD_ONCE_INIT;
+
+static void host_task_key_init(void) { pthread_key_create(&s_task_key, NULL); }
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*!
+ * \brief Absolute deadline for a timed wait of \a ticks milliseconds.
+ */
+static struct timespec host_deadline(TickType_t ticks)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ticks / 1000;
+	ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+	return ts;
+}
+
+/*!
+ * \brief Wait on condition, return false on timeout.
+ */
+static bool host_wait(pthread_cond_t* c, pthread_mutex_t* m, TickType_t ticks, const struct timespec* ts)
+{
+	if (ticks == portMAX_DELAY) { pthread_cond_wait(c, m); return true; }
+	return pthread_cond_timedwait(c, m, ts) != ETIMEDOUT;
+}
+
+void host_mux_lock(portMUX_TYPE* mux)
+{
+	static pthread_mutex_t init = PTHREAD_MUTEX_INITIALIZER;
+	if (!mux->m) {
+		pthread_mutex_lock(&init);
+		if (!mux->m) {
+			pthread_mutexattr_t a;
+			pthread_mutex_t* m = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+			pthread_mutexattr_init(&a);
+			pthread_mutexattr_settype(&a, PTHREAD_MUTEX_RECURSIVE);
+			pthread_mutex_init(m, &a);
+			mux->m = m;
+		}
+		pthread_mutex_unlock(&init);
+	}
+	pthread_mutex_lock((pthread_mutex_t*)mux->m);
+}
+
+void host_mux_unlock(portMUX_TYPE* mux)
+{
+	pthread_mutex_unlock((pthread_mutex_t*)mux->m);
+}
+
+BaseType_t xPortGetCoreID(void) { return 0; }
+
+/* Semaphores */
+
+static SemaphoreHandle_t host_sem_new(UBaseType_t max, UBaseType_t initial)
+{
+	SemaphoreHandle_t s = (SemaphoreHandle_t)calloc(1, sizeof(struct host_sem));
+	if (!s) return NULL;
+	pthread_mutex_init(&s->m, NULL);
+	pthread_cond_init(&s->c, NULL);
+	s->max = max;
+	s->count = initial;
+	return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return host_sem_new(1, 0); }
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return host_sem_new(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) { return host_sem_new(max, initial); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+	struct timespec ts = host_deadline(ticks);
+	BaseType_t r = pdTRUE;
+	pthread_mutex_lock(&s->m);
+	while (s->count == 0) {
+		if (ticks == 0 || !host_wait(&s->c, &s->m, ticks, &ts)) { r = pdFALSE; break; }
+	}
+	if (r == pdTRUE) s->count--;
+	pthread_mutex_unlock(&s->m);
+	return r;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+	BaseType_t r = pdFALSE;
+	pthread_mutex_lock(&s->m);
+	if (s->count < s->max) { s->count++; r = pdTRUE; pthread_cond_signal(&s->c); }
+	pthread_mutex_unlock(&s->m);
+	return r;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s)
+{
+	if (!s) return;
+	pthread_mutex_destroy(&s->m);
+	pthread_cond_destroy(&s->c);
+	free(s);
+}
+
+/* Tasks */
+
+static void* host_task_entry(void* arg)
+{
+	TaskHandle_t t = (TaskHandle_t)arg;
+	pthread_setspecific(s_task_key, t);
+	t->fn(t->arg);
+	return NULL;
+}
+
+static TaskHandle_t host_task_new(void)
+{
+	TaskHandle_t t = (TaskHandle_t)calloc(1, sizeof(struct host_task));
+	pthread_mutex_init(&t->m, NULL);
+	pthread_cond_init(&t->c, NULL);
+	return t;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+{
+	(void)name; (void)stack; (void)prio; (void)core;
+	pthread_once(&s_task_once, host_task_key_init);
+	TaskHandle_t t = host_task_new();
+	t->fn = fn;
+	t->arg = arg;
+	if (handle) *handle = t;
+	if (pthread_create(&t->th, NULL, host_task_entry, t) != 0) {
+		if (handle) *handle = NULL;
+		free(t);
+		return pdFAIL;
+	}
+	pthread_detach(t->th);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t t)
+{
+	pthread_once(&s_task_once, host_task_key_init);
+	if (t == NULL || t == (TaskHandle_t)pthread_getspecific(s_task_key)) {
+		pthread_exit(NULL);
+	}
+	pthread_cancel(t->th);
+}
+
+void vTaskDelay(TickType_t ticks) { usleep((useconds_t)ticks * 1000); }
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(esp_timer_get_time() / 1000); }
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	pthread_once(&s_task_once, host_task_key_init);
+	TaskHandle_t t = (TaskHandle_t)pthread_getspecific(s_task_key);
+	if (!t) {
+		/* Foreign thread (e.g. main) - adopt it */
+		t = host_task_new();
+		t->th = pthread_self();
+		pthread_setspecific(s_task_key, t);
+	}
+	return t;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t t)
+{
+	pthread_mutex_lock(&t->m);
+	t->notify++;
+	pthread_cond_signal(&t->c);
+	pthread_mutex_unlock(&t->m);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	TaskHandle_t t = xTaskGetCurrentTaskHandle();
+	struct timespec ts = host_deadline(ticks);
+	uint32_t r;
+	pthread_mutex_lock(&t->m);
+	while (t->notify == 0) {
+		if (ticks == 0 || !host_wait(&t->c, &t->m, ticks, &ts)) break;
+	}
+	r = t->notify;
+	if (r) t->notify = clear ? 0 : r - 1;
+	pthread_mutex_unlock(&t->m);
+	return r;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t t) { (void)t; return 0; }
+
+/* Queues */
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t itemSize)
+{
+	QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(struct host_queue));
+	if (!q) return NULL;
+	q->data = (uint8_t*)malloc(len * itemSize);
+	if (!q->data) { free(q); return NULL; }
+	pthread_mutex_init(&q->m, NULL);
+	pthread_cond_init(&q->c, NULL);
+	q->len = len;
+	q->size = itemSize;
+	return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+	struct timespec ts = host_deadline(ticks);
+	BaseType_t r = pdTRUE;
+	pthread_mutex_lock(&q->m);
+	while (q->count == q->len) {
+		if (ticks == 0 || !host_wait(&q->c, &q->m, ticks, &ts)) { r = pdFALSE; break; }
+	}
+	if (r == pdTRUE) {
+		memcpy(q->data + ((q->head + q->count) % q->len) * q->size, item, q->size);
+		q->count++;
+		pthread_cond_broadcast(&q->c);
+	}
+	pthread_mutex_unlock(&q->m);
+	return r;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+	struct timespec ts = host_deadline(ticks);
+	BaseType_t r = pdTRUE;
+	pthread_mutex_lock(&q->m);
+	while (q->count == 0) {
+		if (ticks == 0 || !host_wait(&q->c, &q->m, ticks, &ts)) { r = pdFALSE; break; }
+	}
+	if (r == pdTRUE) {
+		memcpy(item, q->data + q->head * q->size, q->size);
+		q->head = (q->head + 1) % q->len;
+		q->count--;
+		pthread_cond_broadcast(&q->c);
+	}
+	pthread_mutex_unlock(&q->m);
+	return r;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+	UBaseType_t r;
+	pthread_mutex_lock(&q->m);
+	r = q->count;
+	pthread_mutex_unlock(&q->m);
+	return r;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+	if (!q) return;
+	free(q->data);
+	pthread_mutex_destroy(&q->m);
+	pthread_cond_destroy(&q->c);
+	free(q);
+}
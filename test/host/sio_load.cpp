@@ -0,0 +1,227 @@
+/*
+ * Load test driver for test/sio_server.js (host tool).
+ *
+ * Usage: sio_load [-d seconds] [-r rate] [-a fraction] [-s size] [-b bufsize] [-w] [-W workers] [-H us] [-m] [-L topics] [-R rate[:burst]] [-D] [-E url] [-P ms] [-M idle_ms] [url]
+ *   -d seconds  - measured run time (default 10),
+ *   -r rate     - events per second sent to the server ("load-up", default 0),
+ *   -a fraction - fraction of sent events which wait for server ack (default 0),
+ *   -s size     - payload size of sent events in bytes (default 16),
+ *   -b bufsize  - client RX/TX buffer size (default 4096),
+ *   -w          - websocket-only handshake,
+ *   -W workers  - run handlers on a dispatcher with this many workers (default 0 - network task),
+ *   -H us       - handler busy time per "load" event in [us] (slow handler, default 0),
+ *   -m          - MessagePack encoding (server: --msgpack),
+ *   -L topics   - send with sendLatest() spread over this many topics (conflation on a slow link),
+ *   -R rate     - shape sent events to rate bytes/s (burst in bytes, default rate / 10),
+ *   -D          - full-duplex mode (separate RX and TX tasks),
+ *   -E url      - another server endpoint (failover, up to 3 times),
+ *   -P ms       - probe endpoints every ms and move to a faster one,
+ *   -M idle_ms  - low-memory mode (release buffers idle for idle_ms).
+ *
+ * Server: node sio_server.js --rate 1000 --size 256 [--binary 0.1] [--ack 0.1] [--frag 4] [--msgpack]
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "socketioclient.h"
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+static std::mutex            lat_lock;
+static std::vector<uint32_t> latency;           /* Server send -> handler [us] */
+static std::atomic<uint32_t> received(0);
+static std::atomic<uint32_t> acked(0);
+static std::atomic<uint32_t> ack_lost(0);
+static std::atomic<bool>     measuring(false);
+static int                   handlerUs = 0;
+
+static int64_t realtime_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t cpu_us()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static size_t heap_used()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-d seconds] [-r rate] [-a fraction] [-s size] [-b bufsize] [-w] [-W workers] [-H us] [-m] [-L topics] [-R rate[:burst]] [-D] [-E url] [-P ms] [-M idle_ms] [url]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int duration = 10, rate = 0, size = 16, bufSize = 4096, workers = 0, topics = 0, shapeRate = 0, shapeBurst = 0, probeMs = 0, lowMemMs = 0, opt;
+    std::vector<const char*> endpoints;
+    double ackFraction = 0;
+    bool wsOnly = false, msgpack = false, duplex = false;
+
+    while ((opt = getopt(argc, argv, "d:r:a:s:b:wW:H:mL:R:DE:P:M:")) != -1) {
+        switch (opt) {
+            case 'd': duration = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'a': ackFraction = atof(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'b': bufSize = atoi(optarg); break;
+            case 'w': wsOnly = true; break;
+            case 'W': workers = atoi(optarg); break;
+            case 'H': handlerUs = atoi(optarg); break;
+            case 'm': msgpack = true; break;
+            case 'L': topics = atoi(optarg); break;
+            case 'R':
+                shapeRate = atoi(optarg);
+                shapeBurst = strchr(optarg, ':') ? atoi(strchr(optarg, ':') + 1) : shapeRate / 10;
+                break;
+            case 'D': duplex = true; break;
+            case 'E': endpoints.push_back(optarg); break;
+            case 'P': probeMs = atoi(optarg); break;
+            case 'M': lowMemMs = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    const char* url = (optind < argc) ? argv[optind] : "http://127.0.0.1:8010";
+    /* Writes to a dropped connection fail with EPIPE (as on lwIP) instead of killing the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    static SocketIoClient sio(url, NULL, 10000, bufSize);
+    sio.setWebSocketOnly(wsOnly);
+    sio.m_ws->setReconnectInterval(500);
+    sio.m_ws->setMaxBufLimit(1024 * 1024);
+    if (duplex) sio.m_ws->setFullDuplex(true);
+    for (const char* e : endpoints) {
+        if (sio.m_ws->addEndpoint(e) < 0) fprintf(stderr, "Endpoint %s not added\n", e);
+    }
+    sio.m_ws->setEndpointProbe(probeMs);
+    sio.m_ws->setLowMemory(lowMemMs);
+    if (workers > 0) {
+        static WsDispatcher disp(workers, 256);
+        disp.start();
+        sio.setDispatcher(&disp);
+    }
+    if (shapeRate > 0) sio.setRateLimit(shapeRate, shapeBurst);
+    if (msgpack) {
+        static SioMsgPackParser parser;
+        sio.setParser(&parser);
+    }
+    /* "load" event: seq, server send time [us], payload */
+    sio.on("load", [](SocketIoClient* c, char* msg) {
+        int64_t now = realtime_us();
+        char* p = strchr(msg, ',');
+        if (c->ackId() >= 0) c->sendAck(c->ackId(), "1");
+        if (handlerUs > 0) {
+            /* Slow handler (i.e. flash write) */
+            int64_t t = realtime_us() + handlerUs;
+            while (realtime_us() < t);
+        }
+        if (!measuring || !p) return;
+        int64_t t = strtoll(p + 1, NULL, 10);
+        std::lock_guard<std::mutex> l(lat_lock);
+        latency.push_back((now > t) ? (uint32_t)(now - t) : 0);
+        received++;
+    });
+    sio.start();
+
+    /* Wait for namespace join */
+    for (int i = 0; (i < 100) && (!sio.isJoined()); i++) usleep(100000);
+    if (!sio.isJoined()) {
+        fprintf(stderr, "Unable to join %s\n", url);
+        return 1;
+    }
+
+    std::string payload = "\"" + std::string(size, 'y') + "\"";
+    size_t heapPeak = heap_used(), heapStart = heapPeak;
+    uint32_t sent = 0, sendFailed = 0, seq = 0;
+    sio.resetStats();
+    int64_t cpu0 = cpu_us(), t0 = realtime_us(), tEnd = t0 + (int64_t)duration * 1000000, next = t0;
+    measuring = true;
+
+    /* Main loop: send at the requested rate, sample heap every 10 ms */
+    for (int64_t now = t0, sample = t0; now < tEnd; now = realtime_us()) {
+        if (rate > 0) {
+            while (next <= now) {
+                std::string val = std::to_string(seq++) + "," + std::to_string(realtime_us()) + "," + payload;
+                int r;
+                if ((ackFraction > 0) && ((double)rand() / RAND_MAX < ackFraction)) {
+                    r = sio.sendWithAck("load-up", val.c_str(), [](SocketIoClient*, const char* msg, int) {
+                        if (msg) acked++; else ack_lost++;
+                    });
+                } else if (topics > 0) {
+                    r = sio.sendLatest("load-up", val.c_str(), std::to_string(seq % topics).c_str());
+                } else {
+                    r = sio.send("load-up", val.c_str());
+                }
+                if (r > 0) sent++; else sendFailed++;
+                next += 1000000 / rate;
+            }
+        }
+        if (now >= sample) {
+            size_t h = heap_used();
+            if (h > heapPeak) heapPeak = h;
+            sample = now + 10000;
+        }
+        usleep(200);
+    }
+    measuring = false;
+    double sec = (realtime_us() - t0) / 1e6;
+    int64_t cpu = cpu_us() - cpu0;
+
+    SocketIoStats st;
+    sio.getStats(&st);
+    WsMemStats mem;
+    sio.getMemStats(&mem);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    std::lock_guard<std::mutex> l(lat_lock);
+    std::sort(latency.begin(), latency.end());
+    auto pct = [](double p) { return latency.empty() ? 0 : latency[(size_t)((latency.size() - 1) * p / 100)]; };
+    uint32_t msgs = st.events_rx + st.events_tx;
+
+    printf("run            %.2f s, %s%s%s%s\n", sec, url, wsOnly ? " (websocket only)" : "", msgpack ? " (msgpack)" : "", duplex ? " (full duplex)" : "");
+    printf("received       %u events, %.0f events/s (binary frames %u, reconnects %u, parse errors %u)\n", st.events_rx, st.events_rx / sec, st.ws.rx_frames[WS_FR_OP_BIN], st.ws.reconnects, st.parse_errors);
+    printf("sent           %u events, %.0f events/s (failed %u, acked %u, ack lost %u)\n", sent, sent / sec, sendFailed, (uint32_t)acked, (uint32_t)ack_lost);
+    if (shapeRate > 0) printf("shaper         %u events delayed, avg wait %.0f us, %u refused, %.0f B/s sent\n", st.shaped, st.shaped ? (double)st.shaped_wait_us / st.shaped : 0.0, st.shaped_would_block, (st.ws.tx_bytes[WS_FR_OP_TXT] + st.ws.tx_bytes[WS_FR_OP_BIN]) / sec);
+    if (topics > 0) printf("conflated      %u values replaced, %u topics waiting\n", st.conflated, sio.latestPending());
+    if (!endpoints.empty()) {
+        printf("endpoints      current %d, failovers %u, switches %u, connect failures %u\n", sio.m_ws->getEndpoint(), st.ws.failovers, st.ws.endpoint_switches, st.ws.connect_failures);
+        for (int i = 0; i < sio.m_ws->getEndpointCount(); i++) {
+            const WsEndpoint* e = sio.m_ws->getEndpointInfo(i);
+            printf("  %d %s:%d      rtt %u us, connects %u, failures %u\n", i, e->host, e->port, e->rtt_us, e->connects, e->failures);
+        }
+    }
+    printf("latency        n=%zu p50=%u p90=%u p99=%u p99.9=%u max=%u [us]\n", latency.size(), pct(50), pct(90), pct(99), pct(99.9), latency.empty() ? 0 : latency.back());
+    const WsLatencyHist* h = &st.ws.rtt[WS_RTT_ACK];
+    const WsLatencyHist* hb = &st.ws.rtt[WS_RTT_EIO_LAG];
+    printf("heartbeat lag  n=%u max=%u [us]\n", hb->count, hb->max_us);
+    printf("ack rtt        n=%u min=%u avg=%u p99=%u max=%u [us]\n", h->count, h->min_us, ws_hist_avg(h), ws_hist_percentile(h, 99), h->max_us);
+    printf("cpu            %.3f s, %.2f us/message\n", cpu / 1e6, msgs ? (double)cpu / msgs : 0.0);
+    printf("memory         heap peak %zu B (+%zu B during run), max rss %ld KB\n", heapPeak, heapPeak - heapStart, ru.ru_maxrss);
+    printf("client memory  %u B now, %u B peak (rx %u, tx %u, buffers peak %u, fixed %u, stacks %u, releases %u)\n", mem.total, mem.total_peak, mem.rx_buf, mem.tx_buf, mem.buffers_peak, mem.fixed, mem.stacks, mem.releases);
+    /* Client and worker tasks are still running - skip static destructors */
+    fflush(stdout);
+    _exit(0);
+}
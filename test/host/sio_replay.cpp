@@ -0,0 +1,132 @@
+/*
+ * Replay WebSocket/SocketIO RX capture through the client parser (host tool).
+ *
+ * Usage: sio_replay [-l loops] [-r] [-e event] capture.wscp
+ *   -l loops - replay capture N times (default 1),
+ *   -r       - keep recorded time between chunks (default: full speed),
+ *   -e event - also register on(event) handler (exercise event name routing).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "socketioclient.h"
+#include "wscapture.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+static int64_t               chunk_t0;     /* Time when the current chunk was fed [ns] */
+static std::vector<uint32_t> latency;      /* Chunk fed -> message callback [ns]       */
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void onMessage()
+{
+    latency.push_back((uint32_t)(now_ns() - chunk_t0));
+}
+
+/*!
+ * \brief Print exact percentiles of the samples (in [us]).
+ */
+static void printSamples(const char* name, std::vector<uint32_t>& v)
+{
+    uint64_t sum = 0;
+
+    if (v.empty()) {
+        printf("%-8s n=0\n", name);
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    for (uint32_t x : v) sum += x;
+    auto pct = [&v](int p) { return v[(v.size() - 1) * p / 100] / 1000.0; };
+    printf("%-8s n=%zu min=%.3f avg=%.3f p50=%.3f p99=%.3f p99.9=%.3f max=%.3f [us]\n", name, v.size(), v.front() / 1000.0,
+        sum / 1000.0 / v.size(), pct(50), pct(99), v[(v.size() - 1) * 999 / 1000] / 1000.0, v.back() / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    int loops = 1, opt;
+    bool realtime = false;
+    const char* event = NULL;
+    uint64_t bytes = 0, chunks = 0, parseNs = 0;
+    std::vector<uint32_t> chunkNs;
+
+    while ((opt = getopt(argc, argv, "l:re:")) != -1) {
+        switch (opt) {
+            case 'l': loops = atoi(optarg); break;
+            case 'r': realtime = true; break;
+            case 'e': event = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-l loops] [-r] [-e event] capture.wscp\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-l loops] [-r] [-e event] capture.wscp\n", argv[0]);
+        return 1;
+    }
+    WsCaptureReader cap(argv[optind]);
+    if (!cap.isOpen()) {
+        fprintf(stderr, "Unable to open %s\n", argv[optind]);
+        return 1;
+    }
+
+    /* Client is never started - no task, no socket, replies to the server fail silently */
+    SocketIoClient sio("http://127.0.0.1/", NULL, 0, 16384);
+    WebSocketClient* ws = sio.m_ws;
+    if (cap.flags() & WSCAP_FL_SIO) {
+        sio.setCB([](SocketIoClient*, const char*, int, int) { onMessage(); });
+        if (event) sio.on(event, [](SocketIoClient*, char*) {});
+    } else {
+        /* Plain WebSocket capture - replace Socket.IO parser */
+        ws->setCB([](WebSocketClient*, char*, int, int) { onMessage(); });
+    }
+    ws->m_sio_v = cap.eioVersion();
+
+    for (int l = 0; l < loops; l++) {
+        uint8_t type;
+        uint32_t dt;
+        std::string data;
+
+        cap.rewind();
+        while (cap.next(&type, &dt, data)) {
+            if (realtime && dt) usleep(dt);
+            if (type != WSCAP_DATA) {
+                ws->resetRx();
+                continue;
+            }
+            chunk_t0 = now_ns();
+            if (ws->feed(data.data(), data.length()) < 0) {
+                fprintf(stderr, "Protocol error at chunk %llu - drop connection\n", (unsigned long long)chunks);
+                ws->resetRx();
+            }
+            uint32_t ns = (uint32_t)(now_ns() - chunk_t0);
+            chunkNs.push_back(ns);
+            parseNs += ns;
+            bytes += data.length();
+            chunks++;
+        }
+    }
+
+    WebSocketStats st;
+    ws->getStats(&st);
+    uint32_t frames = 0;
+    for (int i = 0; i < 16; i++) frames += st.rx_frames[i];
+    double sec = parseNs / 1e9;
+    printf("%llu bytes, %llu chunks, %u frames, %zu messages, parser busy %.3f s\n", (unsigned long long)bytes, (unsigned long long)chunks, frames, latency.size(), sec);
+    if (sec > 0) printf("throughput %.2f MB/s, %.0f frames/s, %.0f messages/s\n", bytes / sec / 1e6, frames / sec, latency.size() / sec);
+    printSamples("chunk", chunkNs);
+    printSamples("message", latency);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * WebSocket frame test: payload lengths which do not fit (or are invalid) are refused, RX buffer
+ * grows after the frame which carried the Engine.IO open packet.
+ *
+ * Frames go to WebSocketClient::feed() (no task, no socket). Exit code 0 - all checks passed.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "socketioclient.h"
+#include <stdio.h>
+#include <string.h>
+
+static int messages = 0;
+static int sink_writes = 0;
+static int failures = 0;
+
+#define CHECK(c, what) do { printf("%-48s %s\n", what, (c) ? "ok" : "FAILED"); if (!(c)) failures++; } while (0)
+
+/*!
+ * \brief Feed frame to a fresh client.
+ * \param sink - binary messages go to a sink.
+ * \return feed() result.
+ */
+static int frame(const unsigned char* f, int len, bool sink)
+{
+    WebSocketClient ws("ws://127.0.0.1/", NULL, 0, 4096);
+    WsSink s;
+
+    ws.setCB([](WebSocketClient*, char*, int, int) { messages++; });
+    if (sink) {
+        ws_sink_init(&s, [](const char*, uint32_t) { sink_writes++; return 0; });
+        ws.setSink(&s);
+    }
+    messages = 0;
+    sink_writes = 0;
+    return ws.feed((const char*)f, len);
+}
+
+/*!
+ * \brief Open packet (maxPayload above the RX buffer) while a raw on() handler looks at the frame.
+ * \return RX buffer size after the frame (0 - frame refused or handler not called).
+ */
+static uint32_t open_packet()
+{
+    const char js[] = "0{\"sid\":\"abc\",\"upgrades\":[],\"pingInterval\":25000,\"pingTimeout\":20000,\"maxPayload\":100000}";
+    unsigned char f[sizeof(js) + 2];
+    SocketIoClient sio("http://127.0.0.1/", NULL, 0, 1024);
+    WebSocketClient* ws = sio.m_ws;
+    WsMemStats m;
+    int hits = 0;
+
+    ws->setMaxBufLimit(200000);
+    /* Handler table lookup reads the frame after the Socket.IO callback */
+    ws->on("0{", [&hits](WebSocketClient*, char*, int) { hits++; });
+    f[0] = 0x81;
+    f[1] = sizeof(js) - 1;
+    memcpy(&f[2], js, sizeof(js) - 1);
+    if ((ws->feed((const char*)f, sizeof(js) + 1) < 0) || (!hits)) return 0;
+    ws->getMemStats(&m);
+    return m.rx_buf;
+}
+
+int main()
+{
+    /* 64-bit length with the most significant bit set (len + header wraps around to 2) */
+    const unsigned char msb[] = { 0x82, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF8, 'a', 'b' };
+    /* Largest valid 64-bit length - larger than any buffer */
+    const unsigned char huge[] = { 0x82, 0x7F, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 'a', 'b' };
+    /* Just over the buffer: 4096 - 4 (header) + 1 */
+    const unsigned char over[] = { 0x82, 0x7E, 0x0F, 0xFD, 'a', 'b' };
+    const unsigned char ok[] = { 0x82, 0x02, 'a', 'b' };
+    const unsigned char ok64[] = { 0x82, 0x7F, 0, 0, 0, 0, 0, 0, 0, 0x02, 'a', 'b' };
+
+    CHECK((frame(msb, sizeof(msb), false) < 0) && (!messages), "length MSB set refused");
+    CHECK((frame(msb, sizeof(msb), true) < 0) && (!sink_writes), "length MSB set refused (sink)");
+    CHECK((frame(huge, sizeof(huge), false) < 0) && (!messages), "length over buffer refused (64-bit)");
+    CHECK((frame(over, sizeof(over), false) < 0) && (!messages), "length over buffer refused (16-bit)");
+    CHECK((frame(ok, sizeof(ok), false) == 0) && (messages == 1), "short frame delivered");
+    CHECK((frame(ok64, sizeof(ok64), false) == 0) && (messages == 1), "64-bit length frame delivered");
+    CHECK((frame(ok64, sizeof(ok64), true) == 0) && (sink_writes == 1), "64-bit length frame to the sink");
+    CHECK(open_packet() >= 100000, "RX buffer grown after open packet frame");
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
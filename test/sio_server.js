@@ -1,20 +1,69 @@
+// Socket.IO test server and load generator.
+//
+// Usage: node sio_server.js [options]
+//   --port N      - listen port (default 8010),
+//   --rate N      - events per second sent to every client (load mode, default: one "seq-num" per second),
+//   --size N      - payload size in bytes (load mode, default 16),
+//   --binary F    - fraction (0..1) of events sent as binary events (payload in a binary attachment),
+//   --ack F       - fraction (0..1) of events which ask the client for acknowledgement,
+//   --frag N      - split text events into N WebSocket fragments (websocket transport, text encoding only),
+//   --report N    - statistics period in seconds (default 1),
+//   --msgpack     - MessagePack encoding (socket.io-msgpack-parser, client: SioMsgPackParser),
+//   --quiet       - do not log every received event.
+//
+// Load mode emits "load" events (seq, send time [us, realtime clock], payload) and acknowledges
+// client "load-up" events, so the host driver (test/host/sio_load) can measure latency.
 const
     {Server} = require("socket.io"),
-    server = new Server(8010, {
-	allowEIO3: true // false by default
+    {performance} = require("perf_hooks");
+
+const opts = {port: 8010, rate: 0, size: 16, binary: 0, ack: 0, frag: 1, report: 1, quiet: false, msgpack: false};
+for (let i = 2; i < process.argv.length; i++) {
+    const k = process.argv[i].replace(/^--/, "");
+    if (!(k in opts)) {
+        console.error(`Unknown option ${process.argv[i]}`);
+        process.exit(1);
+    }
+    opts[k] = (typeof opts[k] === "boolean") ? true : Number(process.argv[++i]);
+}
+
+const
+    server = new Server(opts.port, {
+	allowEIO3: true, // false by default
+	maxHttpBufferSize: 16 * 1024 * 1024,
+	...(opts.msgpack ? {parser: require("socket.io-msgpack-parser")} : {}),
+	connectionStateRecovery: {
+	    maxDisconnectionDuration: 2 * 60 * 1000
+	}
     });
 
 let
     sequenceNumberByClient = new Map();
 
+// Realtime clock in [us] (same clock as CLOCK_REALTIME on the host)
+const nowUs = () => Math.round((performance.timeOrigin + performance.now()) * 1000);
+
+// Statistics of the current report period
+let stats = {sent: 0, bytes: 0, binary: 0, frag: 0, acked: 0, ackLost: 0, ackRtt: [], received: 0, recvLat: []};
+
+const percentile = (v, p) => v.length ? v[Math.min(v.length - 1, Math.floor(v.length * p / 100))] : 0;
+
 // event fired every time a new client connects:
 server.on("connection", (socket) => {
-    console.info(`Client connected [id=${socket.id}]`);
+    console.info(`Client connected [id=${socket.id}, recovered=${socket.recovered}]`);
     // initialize this client's sequence number
     sequenceNumberByClient.set(socket, 1);
 
     socket.on("ble", (v) => {
-        console.info(`ble = ${v}`);
+        if (!opts.quiet) console.info(`ble = ${v}`);
+    });
+
+    // load mode: client events (seq, send time [us], payload), acknowledged when asked
+    socket.on("load-up", (...args) => {
+        const cb = (typeof args[args.length - 1] === "function") ? args.pop() : null;
+        stats.received++;
+        if (typeof args[1] === "number") stats.recvLat.push(nowUs() - args[1]);
+        if (cb) cb(args[0]);
     });
 
     // when socket disconnects, remove it from the list:
@@ -24,10 +73,75 @@ server.on("connection", (socket) => {
     });
 });
 
-// sends each client its current sequence number
-setInterval(() => {
-    for (const [client, sequenceNumber] of sequenceNumberByClient.entries()) {
-        client.emit("seq-num", sequenceNumber);
-        sequenceNumberByClient.set(client, sequenceNumber + 1);
+/*
+ * Send one load event to the client.
+ */
+function sendLoad(socket, seq, payload) {
+    const t = nowUs();
+    if (Math.random() < opts.binary) {
+        socket.emit("load", seq, t, Buffer.from(payload));
+        stats.binary++;
+    } else if (Math.random() < opts.ack) {
+        socket.timeout(5000).emit("load", seq, t, payload, (err) => {
+            if (err) stats.ackLost++;
+            else {
+                stats.acked++;
+                stats.ackRtt.push(nowUs() - t);
+            }
+        });
+    } else if ((opts.frag > 1) && (!opts.msgpack) && (socket.conn.transport.name === "websocket")) {
+        // Engine.IO message + Socket.IO event packet, written in fragments straight to the WebSocket
+        const packet = "42" + JSON.stringify(["load", seq, t, payload]);
+        const ws = socket.conn.transport.socket, n = Math.min(opts.frag, packet.length);
+        const step = Math.ceil(packet.length / n);
+        for (let i = 0; i < packet.length; i += step) {
+            ws.send(packet.slice(i, i + step), {fin: i + step >= packet.length});
+        }
+        stats.frag++;
+    } else {
+        socket.emit("load", seq, t, payload);
     }
-}, 1000);
+    stats.sent++;
+    stats.bytes += payload.length;
+}
+
+if (opts.rate > 0) {
+    // load mode: keep the average rate with a 1 ms tick
+    const payload = "x".repeat(opts.size);
+    let credit = 0, last = performance.now();
+    setInterval(() => {
+        const now = performance.now();
+        credit = Math.min(credit + (now - last) * opts.rate / 1000, opts.rate);
+        last = now;
+        while (credit >= 1) {
+            for (const [client, sequenceNumber] of sequenceNumberByClient.entries()) {
+                sendLoad(client, sequenceNumber, payload);
+                sequenceNumberByClient.set(client, sequenceNumber + 1);
+            }
+            credit -= 1;
+        }
+    }, 1);
+} else {
+    // sends each client its current sequence number
+    setInterval(() => {
+        for (const [client, sequenceNumber] of sequenceNumberByClient.entries()) {
+            client.emit("seq-num", sequenceNumber);
+            sequenceNumberByClient.set(client, sequenceNumber + 1);
+        }
+    }, 1000);
+}
+
+if (opts.rate > 0) {
+    let cpu = process.cpuUsage();
+    setInterval(() => {
+        const c = process.cpuUsage(cpu), mem = process.memoryUsage();
+        cpu = process.cpuUsage();
+        stats.ackRtt.sort((a, b) => a - b);
+        stats.recvLat.sort((a, b) => a - b);
+        console.info(`sent ${stats.sent} (binary ${stats.binary}, fragmented ${stats.frag}, ${stats.bytes} B), ` +
+            `acks ${stats.acked} lost ${stats.ackLost} rtt p50/p99 ${percentile(stats.ackRtt, 50)}/${percentile(stats.ackRtt, 99)} us, ` +
+            `received ${stats.received} latency p50/p99 ${percentile(stats.recvLat, 50)}/${percentile(stats.recvLat, 99)} us, ` +
+            `cpu ${((c.user + c.system) / 1000).toFixed(0)} ms, rss ${(mem.rss / 1048576).toFixed(1)} MB`);
+        stats = {sent: 0, bytes: 0, binary: 0, frag: 0, acked: 0, ackLost: 0, ackRtt: [], received: 0, recvLat: []};
+    }, opts.report * 1000);
+}
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# Decoder of the WebSocket/SocketIO client trace ring (see src/wstrace.h).
+#
+# Usage: wstrace.py [log]        - "WST <hex>" lines from ws_trace_print() (other lines are ignored)
+#        wstrace.py --bin [file] - raw WsTraceRecord array from ws_trace_dump()
+#
+import struct
+import sys
+
+REC = struct.Struct("<IHHII")
+
+PHASES = ["tcp", "tls", "polling", "upgrade", "probe", "join"]
+MSG_KINDS = {0: "ws_on", 1: "sio_event", 2: "sio_ack"}
+OPCODES = {0: "cont", 1: "txt", 2: "bin", 8: "close", 9: "ping", 10: "pong"}
+
+
+def opcode(v):
+    return OPCODES.get(v, "op%d" % v)
+
+
+def parse(v):
+    e, s = v >> 8, v & 0xFF
+    return "eio '%c'" % e + (" sio '%c'" % s if (e == ord('4') and s) else "")
+
+
+EVENTS = {
+    1: ("rx_frame", lambda a, b: "%s len=%d" % (opcode(a), b)),
+    2: ("tx_frame", lambda a, b: "%s len=%d" % (opcode(a), b)),
+    3: ("tx_fail", lambda a, b: "%s len=%d" % (opcode(a), b)),
+    4: ("lock_wait", lambda a, b: "%d us%s" % (a, "" if b else " TIMEOUT")),
+    5: ("parse", lambda a, b: "%s len=%d" % (parse(a), b)),
+    6: ("dispatch", lambda a, b: "handlers=%d %d us" % (a, b)),
+    7: ("phase", lambda a, b: "%s %d us" % (PHASES[a] if a < len(PHASES) else a, b)),
+    8: ("connect", lambda a, b: ("ok %d us" % b) if a else "FAILED"),
+    9: ("disconnect", lambda a, b: "after %d connections" % a),
+    10: ("heartbeat", lambda a, b: ("pong rtt %d us" % b) if a else ("ping late %d us" % b)),
+    11: ("worker", lambda a, b: "%s %d us" % (MSG_KINDS.get(a, a), b)),
+}
+
+
+def records_hex(f):
+    for line in f:
+        i = line.find("WST ")
+        if i < 0:
+            continue
+        try:
+            data = bytes.fromhex(line[i + 4:].strip())
+        except ValueError:
+            continue
+        if len(data) == REC.size:
+            yield REC.unpack(data)
+
+
+def records_bin(f):
+    data = f.read()
+    for i in range(0, len(data) - REC.size + 1, REC.size):
+        yield REC.unpack_from(data, i)
+
+
+def main(argv):
+    binary = "--bin" in argv
+    args = [a for a in argv[1:] if a != "--bin"]
+    if binary:
+        f = open(args[0], "rb") if args else sys.stdin.buffer
+        recs = list(records_bin(f))
+    else:
+        f = open(args[0], "r", errors="replace") if args else sys.stdin
+        recs = list(records_hex(f))
+    if not recs:
+        print("no trace records")
+        return 1
+
+    # Unwrap 32-bit timestamps (records are in ring order)
+    t0, last, wrap = recs[0][0], recs[0][0], 0
+    counts, worst = {}, {}
+    for ts, eid, seq, a, b in recs:
+        if ts < last and last - ts > 0x80000000:
+            wrap += 1 << 32
+        last = ts
+        t = ts + wrap - t0
+        name, fmt = EVENTS.get(eid, ("ev%d" % eid, lambda a, b: "a=%d b=%d" % (a, b)))
+        print("%12.3f ms  #%-5d %-10s %s" % (t / 1000.0, seq, name, fmt(a, b)))
+        counts[name] = counts.get(name, 0) + 1
+        if eid == 4:
+            worst[name] = max(worst.get(name, 0), a)
+        elif eid in (6, 10):
+            worst[name] = max(worst.get(name, 0), b)
+
+    print("\n%d records, %.3f ms" % (len(recs), (last + wrap - t0) / 1000.0))
+    for name in sorted(counts):
+        extra = ("  max %d us" % worst[name]) if name in worst else ""
+        print("  %-10s %6d%s" % (name, counts[name], extra))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))